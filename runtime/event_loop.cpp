@@ -0,0 +1,236 @@
+#include "event_loop.hpp"
+#include "exceptions.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <poll.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+namespace {
+
+struct FdWatch {
+  int fd;
+  bool writable;
+  std::function<void()> callback;
+};
+
+// Every thread (i.e. every Worker) runs its own loop.
+thread_local std::deque<std::function<void()>> microtasks;
+// Keyed by (deadline, sequence number) so that timers with the same deadline
+// fire in the order they were created.
+thread_local std::map<std::pair<double, uint64_t>, std::function<void()>> timers;
+thread_local uint64_t timer_sequence = 0;
+thread_local std::vector<FdWatch> watches;
+// Shared by all threads, as they all restore into the same process at exit.
+std::mutex fd_flags_mutex;
+std::map<int, int> original_fd_flags;
+
+// Longest single wait. Timers further out than this just take another trip
+// around the loop, which keeps the poll/usleep arguments within `int`.
+constexpr int max_wait_ms = 1000000;
+// Same cap as browsers use: 2^31 - 1 ms, a little under 25 days.
+constexpr double max_timer_delay = 2147483647;
+
+double now_ms() {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void drain_microtasks() {
+  while (!microtasks.empty()) {
+    auto task = std::move(microtasks.front());
+    microtasks.pop_front();
+    task();
+  }
+}
+
+void restore_fd_flags() {
+  std::lock_guard<std::mutex> lock{fd_flags_mutex};
+  for (auto [fd, flags] : original_fd_flags) {
+    fcntl(fd, F_SETFL, flags);
+  }
+}
+
+// Takes all watches that are satisfied by `fd` becoming readable/writable
+// out of the watch list.
+std::vector<std::function<void()>> take_ready(int fd, bool readable,
+                                              bool writable) {
+  std::vector<std::function<void()>> ready;
+  for (auto it = watches.begin(); it != watches.end();) {
+    if (it->fd == fd && (it->writable ? writable : readable)) {
+      ready.push_back(std::move(it->callback));
+      it = watches.erase(it);
+    } else {
+      it++;
+    }
+  }
+  return ready;
+}
+
+#ifdef __linux__
+thread_local int epoll_fd = -1;
+// Events currently registered with epoll, per fd.
+thread_local std::map<int, uint32_t> registered;
+
+// Brings the epoll interest list in line with `watches`. Watches on fds that
+// epoll can’t handle (regular files are always ready) are returned as ready.
+std::vector<std::function<void()>> sync_epoll() {
+  if (epoll_fd < 0) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  }
+  std::map<int, uint32_t> wanted;
+  for (const auto &watch : watches) {
+    wanted[watch.fd] |= watch.writable ? EPOLLOUT : EPOLLIN;
+  }
+  for (auto it = registered.begin(); it != registered.end();) {
+    if (wanted.count(it->first) == 0) {
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, it->first, nullptr);
+      it = registered.erase(it);
+    } else {
+      it++;
+    }
+  }
+  std::vector<std::function<void()>> always_ready;
+  for (auto [fd, events] : wanted) {
+    auto it = registered.find(fd);
+    if (it != registered.end() && it->second == events)
+      continue;
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = fd;
+    int op = it == registered.end() ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    if (epoll_ctl(epoll_fd, op, fd, &event) == 0) {
+      registered[fd] = events;
+    } else {
+      for (auto &callback : take_ready(fd, true, true)) {
+        always_ready.push_back(std::move(callback));
+      }
+    }
+  }
+  return always_ready;
+}
+
+std::vector<std::function<void()>> wait_for_fds(int timeout) {
+  auto ready = sync_epoll();
+  if (!ready.empty() || watches.empty()) {
+    return ready;
+  }
+  epoll_event events[64];
+  int n = epoll_wait(epoll_fd, events, 64, timeout);
+  for (int i = 0; i < n; i++) {
+    bool failed = events[i].events & (EPOLLHUP | EPOLLERR);
+    for (auto &callback :
+         take_ready(events[i].data.fd,
+                    failed || (events[i].events & EPOLLIN),
+                    failed || (events[i].events & EPOLLOUT))) {
+      ready.push_back(std::move(callback));
+    }
+  }
+  return ready;
+}
+#else
+std::vector<std::function<void()>> wait_for_fds(int timeout) {
+  std::vector<pollfd> fds;
+  for (const auto &watch : watches) {
+    fds.push_back({watch.fd, static_cast<short>(watch.writable ? POLLOUT : POLLIN), 0});
+  }
+  std::vector<std::function<void()>> ready;
+  if (poll(fds.data(), fds.size(), timeout) <= 0) {
+    return ready;
+  }
+  for (const auto &fd : fds) {
+    bool failed = fd.revents & (POLLHUP | POLLERR);
+    for (auto &callback : take_ready(fd.fd, failed || (fd.revents & POLLIN),
+                                     failed || (fd.revents & POLLOUT))) {
+      ready.push_back(std::move(callback));
+    }
+  }
+  return ready;
+}
+#endif
+
+} // namespace
+
+void js_enqueue_microtask(std::function<void()> task) {
+  microtasks.push_back(std::move(task));
+}
+
+void js_set_timeout(double ms, std::function<void()> callback) {
+  // A NaN deadline would break the ordering of `timers`.
+  if (!(ms > 0)) {
+    ms = 0;
+  } else if (ms > max_timer_delay) {
+    ms = max_timer_delay;
+  }
+  timers.emplace(std::pair{now_ms() + ms, timer_sequence++},
+                 std::move(callback));
+}
+
+void js_watch_fd(int fd, bool writable, std::function<void()> callback) {
+  watches.push_back({fd, writable, std::move(callback)});
+}
+
+void js_set_nonblocking(int fd) {
+  std::lock_guard<std::mutex> lock{fd_flags_mutex};
+  if (original_fd_flags.count(fd) > 0)
+    return;
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0)
+    return;
+  if (original_fd_flags.empty()) {
+    std::atexit(restore_fd_flags);
+  }
+  original_fd_flags[fd] = flags;
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// In status mode, a callback that throws ends the loop with the exception
+// still pending, like an exception propagating out of it would.
+void js_run_event_loop() {
+  while (true) {
+    drain_microtasks();
+    if (js_has_pending_exception())
+      return;
+    if (timers.empty() && watches.empty())
+      break;
+
+    int timeout = -1;
+    if (!timers.empty()) {
+      double delay = timers.begin()->first.first - now_ms();
+      timeout = delay <= 0            ? 0
+                : delay >= max_wait_ms ? max_wait_ms
+                                       : static_cast<int>(delay) + 1;
+    }
+    if (!watches.empty()) {
+      for (auto &callback : wait_for_fds(timeout)) {
+        callback();
+        drain_microtasks();
+        if (js_has_pending_exception())
+          return;
+      }
+    } else if (timeout > 0) {
+      usleep(timeout * 1000);
+    }
+
+    double now = now_ms();
+    while (!timers.empty() && timers.begin()->first.first <= now) {
+      auto callback = std::move(timers.begin()->second);
+      timers.erase(timers.begin());
+      callback();
+      drain_microtasks();
+      if (js_has_pending_exception())
+        return;
+    }
+  }
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <functional>
+
+// Queues `task` to run once the current task is done, before any timers or
+// I/O callbacks.
+void js_enqueue_microtask(std::function<void()> task);
+
+// Runs `callback` once at least `ms` milliseconds have passed. NaN and
+// negative delays count as 0; delays over 2^31 - 1 ms are capped to that.
+void js_set_timeout(double ms, std::function<void()> callback);
+
+// Runs `callback` once, as soon as `fd` is readable (or writable).
+void js_watch_fd(int fd, bool writable, std::function<void()> callback);
+
+// Puts `fd` into non-blocking mode. The original flags are restored at exit.
+void js_set_nonblocking(int fd);
+
+// Runs microtasks, timers and I/O callbacks until there is nothing left to
+// wait for.
+void js_run_event_loop();
@@ -1,9 +1,29 @@
+#include "exceptions.hpp"
 #include "js_value.hpp"
 
 #include <exception>
 
-#ifdef FEATURE_EXCEPTIONS
-void js_throw(JSValue v) { throw v; }
+#if defined(FEATURE_EXCEPTIONS)
+JSValue js_throw(JSValue v) { throw v; }
+#elif defined(FEATURE_STATUS_EXCEPTIONS)
+thread_local bool js_exception_pending = false;
+static thread_local JSValue pending_exception;
+
+JSValue js_throw(JSValue v) {
+  // Follow-up errors of code that ran on after the first throw are dropped.
+  if (!js_exception_pending) {
+    pending_exception = v;
+    js_exception_pending = true;
+  }
+  return JSValue::undefined();
+}
+
+JSValue js_take_pending_exception() {
+  js_exception_pending = false;
+  JSValue v = pending_exception;
+  pending_exception = JSValue::undefined();
+  return v;
+}
 #else
-void js_throw(JSValue v) { std::terminate(); }
+JSValue js_throw(JSValue v) { std::terminate(); }
 #endif
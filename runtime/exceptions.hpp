@@ -1,4 +1,26 @@
 #pragma once
 class JSValue;
 
-void js_throw(JSValue v);
+// Throws `v`. With FEATURE_EXCEPTIONS, this unwinds the C++ stack. With
+// FEATURE_STATUS_EXCEPTIONS, it stores `v` as the thread’s pending exception,
+// unless one is pending already, and returns `undefined`; callers return
+// right away and generated code checks for the exception after every
+// statement that can throw. Without either, it terminates the program.
+JSValue js_throw(JSValue v);
+
+#ifdef FEATURE_STATUS_EXCEPTIONS
+extern thread_local bool js_exception_pending;
+
+// Clears the pending exception and returns it.
+JSValue js_take_pending_exception();
+#endif
+
+// Only status mode ever returns from `js_throw`, so runtime code can check
+// this unconditionally.
+inline bool js_has_pending_exception() {
+#ifdef FEATURE_STATUS_EXCEPTIONS
+  return js_exception_pending;
+#else
+  return false;
+#endif
+}
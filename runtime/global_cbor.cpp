@@ -0,0 +1,456 @@
+#include "global_cbor.hpp"
+#include "exceptions.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// CBOR (RFC 8949) for handing data between programs without formatting and
+// parsing numbers as text. Integral numbers encode as integers and all other
+// numbers as floats, strings as text strings, arrays as arrays and objects as
+// maps with string keys. Encoded values written back to back form a CBOR
+// sequence (RFC 8742), which `CBOR.decodeSequence` reads one at a time.
+
+namespace {
+
+enum Major : uint8_t {
+  UNSIGNED = 0,
+  NEGATIVE = 1,
+  BYTES = 2,
+  TEXT = 3,
+  ARRAY = 4,
+  MAP = 5,
+  TAG = 6,
+  SIMPLE = 7
+};
+
+constexpr uint8_t FALSE_VALUE = 0xf4;
+constexpr uint8_t TRUE_VALUE = 0xf5;
+constexpr uint8_t UNDEFINED_VALUE = 0xf7;
+constexpr uint8_t FLOAT32 = 0xfa;
+constexpr uint8_t FLOAT64 = 0xfb;
+constexpr uint8_t INDEFINITE = 31;
+constexpr uint8_t BREAK = 0xff;
+
+// Nesting deeper than this is rejected instead of overflowing the stack, and
+// it catches cyclic objects when encoding.
+constexpr int max_depth = 512;
+
+class Encoder {
+public:
+  // Returns false if an exception is pending.
+  bool value(const JSValue &v, int depth) {
+    if (depth > max_depth) {
+      js_throw(JSValue{"Can’t encode cyclic or deeply nested value"});
+      return false;
+    }
+    switch (v.type()) {
+    case JSValueType::UNDEFINED:
+    case JSValueType::FUNCTION:
+      this->out.push_back(static_cast<char>(UNDEFINED_VALUE));
+      return true;
+    case JSValueType::BOOL:
+      this->out.push_back(static_cast<char>(
+          v.coerce_to_bool() ? TRUE_VALUE : FALSE_VALUE));
+      return true;
+    case JSValueType::NUMBER:
+      this->number(std::get<JSValueType::NUMBER>(*v.value).internal);
+      return true;
+    case JSValueType::STRING:
+      this->text(std::get<JSValueType::STRING>(*v.value).internal);
+      return true;
+    case JSValueType::ARRAY:
+      return this->array(*std::get<JSValueType::ARRAY>(*v.value)->internal,
+                         depth);
+    case JSValueType::OBJECT:
+      return this->object(v, depth);
+    }
+    return true;
+  }
+
+  std::string out;
+
+private:
+  void head(uint8_t major, uint64_t arg) {
+    uint8_t initial = major << 5;
+    if (arg < 24) {
+      this->out.push_back(static_cast<char>(initial | arg));
+    } else if (arg <= 0xff) {
+      this->out.push_back(static_cast<char>(initial | 24));
+      this->put(arg, 1);
+    } else if (arg <= 0xffff) {
+      this->out.push_back(static_cast<char>(initial | 25));
+      this->put(arg, 2);
+    } else if (arg <= 0xffffffff) {
+      this->out.push_back(static_cast<char>(initial | 26));
+      this->put(arg, 4);
+    } else {
+      this->out.push_back(static_cast<char>(initial | 27));
+      this->put(arg, 8);
+    }
+  }
+
+  // Appends the low `bytes` bytes of `v`, big-endian.
+  void put(uint64_t v, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--)
+      this->out.push_back(static_cast<char>(v >> (8 * i)));
+  }
+
+  void number(double d) {
+    // Safe integers round-trip through the integer encodings. -0 has to stay
+    // a float to keep its sign.
+    if (d == std::trunc(d) && std::fabs(d) <= 9007199254740992.0 &&
+        !(d == 0 && std::signbit(d))) {
+      if (d >= 0)
+        this->head(Major::UNSIGNED, static_cast<uint64_t>(d));
+      else
+        this->head(Major::NEGATIVE, static_cast<uint64_t>(-1 - d));
+      return;
+    }
+    float f = static_cast<float>(d);
+    if (static_cast<double>(f) == d) {
+      uint32_t bits;
+      std::memcpy(&bits, &f, sizeof(bits));
+      this->out.push_back(static_cast<char>(FLOAT32));
+      this->put(bits, 4);
+      return;
+    }
+    uint64_t bits;
+    std::memcpy(&bits, &d, sizeof(bits));
+    this->out.push_back(static_cast<char>(FLOAT64));
+    this->put(bits, 8);
+  }
+
+  void text(std::string_view s) {
+    this->head(Major::TEXT, s.size());
+    this->out.append(s);
+  }
+
+  bool array(const JSArrayStorage &storage, int depth) {
+    this->head(Major::ARRAY, storage.size());
+    if (storage.kind == JSArrayStorage::Kind::PACKED_DOUBLES) {
+      for (double d : storage.doubles)
+        this->number(d);
+      return true;
+    }
+    for (auto &v : storage.values) {
+      if (!this->value(v, depth + 1))
+        return false;
+    }
+    return true;
+  }
+
+  // Like `JSON.stringify`, only string keys are kept.
+  bool object(const JSValue &v, int depth) {
+    auto &entries = *std::get<JSValueType::OBJECT>(*v.value)->internal;
+    size_t count = std::count_if(entries.begin(), entries.end(),
+                                 [](const std::pair<JSValue, JSValue> &entry) {
+                                   return entry.first.type() ==
+                                          JSValueType::STRING;
+                                 });
+    this->head(Major::MAP, count);
+    for (auto &[key, value] : entries) {
+      if (key.type() != JSValueType::STRING)
+        continue;
+      this->text(std::get<JSValueType::STRING>(*key.value).internal);
+      JSValue property = value.getter.has_value() ? (*value.getter)(v) : value;
+      if (!this->value(property, depth + 1))
+        return false;
+    }
+    return true;
+  }
+};
+
+// Decodes from a view of the input. Strings are copied straight from it into
+// the resulting values, and numbers in arrays go into packed storage without
+// being boxed.
+class Decoder {
+public:
+  explicit Decoder(std::string_view input)
+      : cur{reinterpret_cast<const uint8_t *>(input.data())},
+        end{cur + input.size()} {}
+
+  JSValue value(int depth) {
+    Head h;
+    if (!this->head(h))
+      return JSValue::undefined();
+    return this->item(h, depth);
+  }
+
+  size_t remaining() const { return this->end - this->cur; }
+
+private:
+  struct Head {
+    uint8_t major;
+    uint8_t info;
+    uint64_t arg;
+  };
+
+  JSValue fail(const char *message) {
+    // Nothing after an error is decoded.
+    this->cur = this->end;
+    return js_throw(JSValue{message});
+  }
+
+  bool read_uint(int bytes, uint64_t &out) {
+    if (this->remaining() < static_cast<size_t>(bytes)) {
+      this->fail("Truncated CBOR input");
+      return false;
+    }
+    out = 0;
+    for (int i = 0; i < bytes; i++)
+      out = (out << 8) | *this->cur++;
+    return true;
+  }
+
+  bool head(Head &h) {
+    if (this->cur == this->end) {
+      this->fail("Truncated CBOR input");
+      return false;
+    }
+    uint8_t initial = *this->cur++;
+    h.major = initial >> 5;
+    h.info = initial & 0x1f;
+    h.arg = h.info;
+    if (h.info < 24 || h.info == INDEFINITE)
+      return true;
+    if (h.info > 27) {
+      this->fail("Invalid CBOR item");
+      return false;
+    }
+    return this->read_uint(1 << (h.info - 24), h.arg);
+  }
+
+  // Whether the next byte ends an indefinite-length item, consuming it if so.
+  bool at_break() {
+    if (this->cur != this->end && *this->cur == BREAK) {
+      this->cur++;
+      return true;
+    }
+    return false;
+  }
+
+  // Numbers don’t need a box, so arrays can store them packed.
+  static bool number(const Head &h, double &d) {
+    switch (h.major) {
+    case Major::UNSIGNED:
+      d = static_cast<double>(h.arg);
+      return true;
+    case Major::NEGATIVE:
+      d = -1 - static_cast<double>(h.arg);
+      return true;
+    case Major::SIMPLE:
+      if (h.info == 25) {
+        d = half_to_double(static_cast<uint16_t>(h.arg));
+        return true;
+      }
+      if (h.info == 26) {
+        uint32_t bits = static_cast<uint32_t>(h.arg);
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        d = f;
+        return true;
+      }
+      if (h.info == 27) {
+        std::memcpy(&d, &h.arg, sizeof(d));
+        return true;
+      }
+      return false;
+    }
+    return false;
+  }
+
+  static double half_to_double(uint16_t half) {
+    int exponent = (half >> 10) & 0x1f;
+    int mantissa = half & 0x3ff;
+    double magnitude;
+    if (exponent == 0)
+      magnitude = std::ldexp(mantissa, -24);
+    else if (exponent != 31)
+      magnitude = std::ldexp(mantissa + 1024, exponent - 25);
+    else
+      magnitude = mantissa == 0 ? INFINITY : NAN;
+    return half & 0x8000 ? -magnitude : magnitude;
+  }
+
+  JSValue item(const Head &h, int depth) {
+    if (depth > max_depth)
+      return this->fail("CBOR input is nested too deeply");
+    double d;
+    if (number(h, d))
+      return JSValue{d};
+    switch (h.major) {
+    case Major::BYTES:
+    case Major::TEXT: {
+      std::string s;
+      if (!this->string(h, s))
+        return JSValue::undefined();
+      return JSValue{std::move(s)};
+    }
+    case Major::ARRAY:
+      return this->array(h, depth);
+    case Major::MAP:
+      return this->map(h, depth);
+    case Major::TAG:
+      // Tags only annotate the item that follows.
+      return this->value(depth + 1);
+    }
+    // Simple values. There is no `null`, so it decodes as `undefined`.
+    if (h.info == 20)
+      return JSValue{false};
+    if (h.info == 21)
+      return JSValue{true};
+    if (h.info == INDEFINITE)
+      return this->fail("Unexpected CBOR break");
+    return JSValue::undefined();
+  }
+
+  // Byte and text strings both become JS strings.
+  bool string(const Head &h, std::string &out) {
+    if (h.info != INDEFINITE) {
+      if (h.arg > this->remaining()) {
+        this->fail("Truncated CBOR input");
+        return false;
+      }
+      out.assign(reinterpret_cast<const char *>(this->cur), h.arg);
+      this->cur += h.arg;
+      return true;
+    }
+    // Indefinite-length strings are a series of definite-length chunks.
+    while (!this->at_break()) {
+      Head chunk;
+      if (!this->head(chunk))
+        return false;
+      if (chunk.major != h.major || chunk.info == INDEFINITE) {
+        this->fail("Invalid chunk in CBOR string");
+        return false;
+      }
+      if (chunk.arg > this->remaining()) {
+        this->fail("Truncated CBOR input");
+        return false;
+      }
+      out.append(reinterpret_cast<const char *>(this->cur), chunk.arg);
+      this->cur += chunk.arg;
+    }
+    return true;
+  }
+
+  JSValue array(const Head &h, int depth) {
+    JSValue result = JSValue::new_array({});
+    auto &storage = *std::get<JSValueType::ARRAY>(*result.value)->internal;
+    bool indefinite = h.info == INDEFINITE;
+    // Every element takes at least one byte, which bounds what a corrupt
+    // length can make us allocate.
+    if (!indefinite)
+      storage.reserve(std::min<uint64_t>(h.arg, this->remaining()));
+    for (uint64_t i = 0; indefinite || i < h.arg; i++) {
+      if (indefinite && this->at_break())
+        break;
+      Head element;
+      if (!this->head(element))
+        return JSValue::undefined();
+      double d;
+      if (storage.kind == JSArrayStorage::Kind::PACKED_DOUBLES &&
+          number(element, d)) {
+        storage.doubles.push_back(d);
+        continue;
+      }
+      JSValue v = this->item(element, depth + 1);
+      if (js_has_pending_exception())
+        return JSValue::undefined();
+      storage.push_back(std::move(v));
+    }
+    return result;
+  }
+
+  JSValue map(const Head &h, int depth) {
+    std::vector<std::pair<JSValue, JSValue>> entries;
+    bool indefinite = h.info == INDEFINITE;
+    if (!indefinite)
+      entries.reserve(std::min<uint64_t>(h.arg, this->remaining() / 2));
+    for (uint64_t i = 0; indefinite || i < h.arg; i++) {
+      if (indefinite && this->at_break())
+        break;
+      JSValue key = this->value(depth + 1);
+      if (js_has_pending_exception())
+        return JSValue::undefined();
+      JSValue v = this->value(depth + 1);
+      if (js_has_pending_exception())
+        return JSValue::undefined();
+      // Property names are strings.
+      if (key.type() != JSValueType::STRING)
+        key = JSValue{key.coerce_to_string()};
+      entries.emplace_back(std::move(key), std::move(v));
+    }
+    return JSValue::new_object(std::move(entries));
+  }
+
+  const uint8_t *cur;
+  const uint8_t *end;
+};
+
+} // namespace
+
+static JSValue cbor_encode(JSValue thisArg, std::vector<JSValue> &args) {
+  Encoder encoder;
+  if (!encoder.value(args.size() > 0 ? args[0] : JSValue::undefined(), 0))
+    return JSValue::undefined();
+  return JSValue{std::move(encoder.out)};
+}
+
+// Decodes a single value. Trailing data is an error, as it most likely means
+// the input is a sequence.
+static JSValue cbor_decode(JSValue thisArg, std::vector<JSValue> &args) {
+  if (args.size() < 1 || args[0].type() != JSValueType::STRING)
+    return js_throw(JSValue{"Can only decode strings"});
+  Decoder decoder{std::get<JSValueType::STRING>(*args[0].value).internal};
+  JSValue result = decoder.value(0);
+  if (js_has_pending_exception())
+    return JSValue::undefined();
+  if (decoder.remaining() > 0)
+    return js_throw(JSValue{"Unexpected data after CBOR value"});
+  return result;
+}
+
+// Iterates over the values of a CBOR sequence, decoding each one when it is
+// asked for. The input string is read in place.
+static JSValue cbor_decode_sequence(JSValue thisArg,
+                                    std::vector<JSValue> &args) {
+  if (args.size() < 1 || args[0].type() != JSValueType::STRING)
+    return js_throw(JSValue{"Can only decode strings"});
+  JSValue input = args[0];
+  size_t offset = 0;
+  return JSValue::iterator_from_next_func(JSValue::new_function(
+      [input, offset](JSValue thisArg,
+                      std::vector<JSValue> &args) mutable -> JSValue {
+        // The variable the input came from may since have been reassigned.
+        std::string_view data =
+            input.type() == JSValueType::STRING
+                ? std::string_view{std::get<JSValueType::STRING>(*input.value)
+                                       .internal}
+                : std::string_view{};
+        bool done = offset >= data.size();
+        JSValue value = JSValue::undefined();
+        if (!done) {
+          Decoder decoder{data.substr(offset)};
+          value = decoder.value(0);
+          offset = data.size() - decoder.remaining();
+        }
+        return JSValue::new_object(
+            {{JSValue{"value"}, value}, {JSValue{"done"}, JSValue{done}}});
+      }));
+}
+
+JSValue create_CBOR_global() {
+  JSValue global = JSValue::new_object(
+      {{JSValue{"encode"}, JSValue::new_function(&cbor_encode)},
+       {JSValue{"decode"}, JSValue::new_function(&cbor_decode)},
+       {JSValue{"decodeSequence"},
+        JSValue::new_function(&cbor_decode_sequence)}});
+
+  return global;
+}
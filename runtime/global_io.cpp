@@ -1,33 +1,130 @@
 #include "global_io.hpp"
+#include "event_loop.hpp"
 #include "exceptions.hpp"
+#include "js_promise.hpp"
 
+#include <cerrno>
+#include <deque>
+#include <poll.h>
 #include <unistd.h>
 #include <vector>
 
+// Once the async functions below are used, stdin/stdout are non-blocking, so
+// the blocking variants wait for the fd themselves.
+static void wait_for_fd(int fd, short events) {
+  pollfd p{fd, events, 0};
+  poll(&p, 1, -1);
+}
+
 static JSValue write_to_stdout(JSValue thisArg, std::vector<JSValue> &args) {
   JSValue data = args[0];
   std::string str = data.coerce_to_string();
-  write(1, str.c_str(), str.size());
+  size_t offset = 0;
+  while (offset < str.size()) {
+    auto n = write(1, str.c_str() + offset, str.size() - offset);
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        break;
+      wait_for_fd(1, POLLOUT);
+      continue;
+    }
+    offset += n;
+  }
   return JSValue{true};
 }
 
 static JSValue read_from_stdin(JSValue thisArg, std::vector<JSValue> &args) {
-  char buf[1024];
+  char buf[65536];
   std::string input{};
   while (true) {
-    auto n = read(0, buf, 1023);
-    buf[n] = 0;
-    input += std::string{buf};
-    if (n < 1023)
+    auto n = read(0, buf, sizeof(buf));
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      wait_for_fd(0, POLLIN);
+      continue;
+    }
+    if (n <= 0)
       break;
+    // Input may be binary, e.g. CBOR, so it can contain NUL bytes.
+    input.append(buf, n);
   };
   return JSValue{input};
 }
 
+static void read_chunk_when_ready(std::shared_ptr<JSPromiseState> state) {
+  char buf[65536];
+  auto n = read(0, buf, sizeof(buf));
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    js_watch_fd(0, false, [state]() { read_chunk_when_ready(state); });
+    return;
+  }
+  if (n < 0) {
+    state->reject(JSValue{"Could not read from stdin"});
+    return;
+  }
+  // Resolves with `undefined` at the end of the input.
+  state->resolve(n == 0 ? JSValue::undefined()
+                        : JSValue{std::string(buf, n)});
+}
+
+static JSValue read_chunk_from_stdin(JSValue thisArg,
+                                     std::vector<JSValue> &args) {
+  js_set_nonblocking(0);
+  auto state = std::make_shared<JSPromiseState>();
+  read_chunk_when_ready(state);
+  return js_promise_object(state);
+}
+
+namespace {
+struct PendingWrite {
+  std::string data;
+  std::shared_ptr<JSPromiseState> state;
+};
+// Async writes are queued so that they reach stdout in call order.
+thread_local std::deque<PendingWrite> stdout_queue;
+thread_local size_t stdout_offset = 0;
+} // namespace
+
+static void flush_stdout_queue() {
+  while (!stdout_queue.empty()) {
+    auto &head = stdout_queue.front();
+    while (stdout_offset < head.data.size()) {
+      auto n = write(1, head.data.c_str() + stdout_offset,
+                     head.data.size() - stdout_offset);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        js_watch_fd(1, true, flush_stdout_queue);
+        return;
+      }
+      if (n < 0) {
+        head.state->reject(JSValue{"Could not write to stdout"});
+        break;
+      }
+      stdout_offset += n;
+    }
+    head.state->resolve(JSValue{true});
+    stdout_queue.pop_front();
+    stdout_offset = 0;
+  }
+}
+
+static JSValue write_to_stdout_async(JSValue thisArg,
+                                     std::vector<JSValue> &args) {
+  js_set_nonblocking(1);
+  auto state = std::make_shared<JSPromiseState>();
+  stdout_queue.push_back({args[0].coerce_to_string(), state});
+  if (stdout_queue.size() == 1) {
+    flush_stdout_queue();
+  }
+  return js_promise_object(state);
+}
+
 JSValue create_IO_global() {
   JSValue global = JSValue::new_object(
       {{JSValue{"read_from_stdin"}, JSValue::new_function(read_from_stdin)},
-       {JSValue{"write_to_stdout"}, JSValue::new_function(write_to_stdout)}});
+       {JSValue{"write_to_stdout"}, JSValue::new_function(write_to_stdout)},
+       {JSValue{"read_chunk_from_stdin"},
+        JSValue::new_function(read_chunk_from_stdin)},
+       {JSValue{"write_to_stdout_async"},
+        JSValue::new_function(write_to_stdout_async)}});
 
   return global;
 }
@@ -53,10 +53,12 @@ static JSValue json_parse_object(const char **cur) {
     auto key = json_parse_string(cur);
     eat_whitespace(cur);
     if (**cur != ':')
-      js_throw(JSValue{"Expected `:` after property name"});
+      return js_throw(JSValue{"Expected `:` after property name"});
     (*cur)++;
     eat_whitespace(cur);
     auto value = json_parse_value(cur);
+    if (js_has_pending_exception())
+      return JSValue::undefined();
     obj.internal->push_back({key, value});
     eat_whitespace(cur);
     if (**cur == ',')
@@ -73,6 +75,8 @@ static JSValue json_parse_array(const char **cur) {
   eat_whitespace(cur);
   while (**cur != ']') {
     auto value = json_parse_value(cur);
+    if (js_has_pending_exception())
+      return JSValue::undefined();
     arr.internal->push_back(value);
     eat_whitespace(cur);
     if (**cur == ',')
@@ -103,13 +107,12 @@ static JSValue json_parse_value(const char **input) {
     *input += 5;
     return JSValue{false};
   }
-  js_throw(JSValue{"Unexpected token"});
-  return JSValue::undefined(); // unreachable
+  return js_throw(JSValue{"Unexpected token"});
 }
 
 static JSValue json_parse(JSValue thisArg, std::vector<JSValue> &args) {
   if (args[0].type() != JSValueType::STRING)
-    js_throw(JSValue{"Can only parse strings"});
+    return js_throw(JSValue{"Can only parse strings"});
   std::string input = args[0].coerce_to_string();
   const char *c = input.c_str();
   return json_parse_value(&c);
@@ -132,8 +135,8 @@ static std::string json_stringify_object(JSObject v) {
 
 static std::string json_stringify_array(JSArray v) {
   std::string result = "[";
-  for (auto v : *v.internal) {
-    result += json_stringify_value(v);
+  for (size_t i = 0; i < v.internal->size(); i++) {
+    result += json_stringify_value(v.internal->get(i));
     result += ",";
   }
   if (v.internal->size() >= 1) {
@@ -0,0 +1,74 @@
+#include "global_promise.hpp"
+#include "js_promise.hpp"
+
+#include <vector>
+
+static JSValue promise_resolve(JSValue thisArg, std::vector<JSValue> &args) {
+  auto state = std::make_shared<JSPromiseState>();
+  state->resolve(args.size() > 0 ? args[0] : JSValue::undefined());
+  return js_promise_object(state);
+}
+
+static JSValue promise_reject(JSValue thisArg, std::vector<JSValue> &args) {
+  auto state = std::make_shared<JSPromiseState>();
+  state->reject(args.size() > 0 ? args[0] : JSValue::undefined());
+  return js_promise_object(state);
+}
+
+static JSValue promise_all(JSValue thisArg, std::vector<JSValue> &args) {
+  auto state = std::make_shared<JSPromiseState>();
+  std::vector<JSValue> items;
+  if (args.size() > 0) {
+    for (auto item : args[0]) {
+      items.push_back(item);
+    }
+  }
+  auto results = std::make_shared<std::vector<JSValue>>(items.size());
+  auto remaining = std::make_shared<size_t>(items.size());
+  if (items.empty()) {
+    state->fulfill(JSValue::new_array({}));
+  }
+  for (size_t i = 0; i < items.size(); i++) {
+    auto item = std::make_shared<JSPromiseState>();
+    item->resolve(items[i]);
+    item->on_settled([=]() {
+      if (item->status == JSPromiseState::Status::REJECTED) {
+        state->reject(item->result);
+        return;
+      }
+      (*results)[i] = item->result;
+      if (--*remaining == 0) {
+        state->fulfill(JSValue::new_array(*results));
+      }
+    });
+  }
+  return js_promise_object(state);
+}
+
+static JSValue promise_with_resolvers(JSValue thisArg,
+                                      std::vector<JSValue> &args) {
+  auto state = std::make_shared<JSPromiseState>();
+  return JSValue::new_object(
+      {{JSValue{"promise"}, js_promise_object(state)},
+       {JSValue{"resolve"},
+        JSValue::new_function(
+            [=](JSValue thisArg, std::vector<JSValue> &args) -> JSValue {
+              state->resolve(args.size() > 0 ? args[0] : JSValue::undefined());
+              return JSValue::undefined();
+            })},
+       {JSValue{"reject"},
+        JSValue::new_function(
+            [=](JSValue thisArg, std::vector<JSValue> &args) -> JSValue {
+              state->reject(args.size() > 0 ? args[0] : JSValue::undefined());
+              return JSValue::undefined();
+            })}});
+}
+
+JSValue create_Promise_global() {
+  return JSValue::new_object(
+      {{JSValue{"resolve"}, JSValue::new_function(promise_resolve)},
+       {JSValue{"reject"}, JSValue::new_function(promise_reject)},
+       {JSValue{"all"}, JSValue::new_function(promise_all)},
+       {JSValue{"withResolvers"},
+        JSValue::new_function(promise_with_resolvers)}});
+}
@@ -0,0 +1,27 @@
+#include "global_runtime.hpp"
+#include "exceptions.hpp"
+#include "heap_profile.hpp"
+
+#include <string>
+#include <vector>
+
+// `Runtime.heapSnapshot(path = "heap.snapshot")` writes a snapshot of all
+// live values, for `jsxx --summarize-heap`.
+static JSValue heap_snapshot(JSValue thisArg, std::vector<JSValue> &args) {
+#ifdef FEATURE_HEAP_PROFILE
+  std::string path =
+      args.size() > 0 ? args[0].coerce_to_string() : "heap.snapshot";
+  if (!js_heap_snapshot(path.c_str()))
+    return js_throw(JSValue{"Can’t write heap snapshot to " + path});
+  return JSValue::undefined();
+#else
+  return js_throw(JSValue{"Heap snapshots need a --heap-profile build"});
+#endif
+}
+
+JSValue create_Runtime_global() {
+  JSValue global = JSValue::new_object(
+      {{JSValue{"heapSnapshot"}, JSValue::new_function(&heap_snapshot)}});
+
+  return global;
+}
@@ -3,7 +3,7 @@
 
 JSValue create_symbol_global() {
   JSValue global =
-      JSValue::new_object({{JSValue{"iterator"}, iterator_symbol}});
+      JSValue::new_object({{JSValue{"iterator"}, js_iterator_symbol()}});
 
   return global;
 }
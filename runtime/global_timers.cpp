@@ -0,0 +1,18 @@
+#include "global_timers.hpp"
+#include "event_loop.hpp"
+#include "exceptions.hpp"
+
+#include <vector>
+
+static JSValue set_timeout(JSValue thisArg, std::vector<JSValue> &args) {
+  if (args.size() < 1 || args[0].type() != JSValueType::FUNCTION)
+    return js_throw(JSValue{"setTimeout needs a function"});
+  JSValue f = args[0];
+  double ms = args.size() > 1 ? args[1].coerce_to_double() : 0;
+  js_set_timeout(ms, [f]() mutable { f({}); });
+  return JSValue::undefined();
+}
+
+JSValue create_setTimeout_global() {
+  return JSValue::new_function(set_timeout);
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "js_value.hpp"
+
+class JSValue;
+
+JSValue create_setTimeout_global();
@@ -0,0 +1,252 @@
+#include "global_worker.hpp"
+#include "event_loop.hpp"
+#include "exceptions.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#ifdef FEATURE_THREADS
+#include <thread>
+#endif
+
+namespace {
+
+// Deep-copies a value graph so that the copy shares no boxes, arrays or
+// objects with the original and can be handed to another thread. Arrays
+// listed in `transfer` give up their element storage instead of being copied
+// and are left empty.
+class StructuredCloner {
+public:
+  JSValue clone(const JSValue &v);
+
+  std::unordered_set<JSArray *> transfer;
+
+private:
+  std::unordered_map<void *, JSValue> seen;
+};
+
+JSValue StructuredCloner::clone(const JSValue &v) {
+  switch (v.type()) {
+  case JSValueType::UNDEFINED:
+  case JSValueType::BOOL:
+  case JSValueType::NUMBER:
+  case JSValueType::STRING:
+    return JSValue{v.boxed_value()};
+  case JSValueType::ARRAY: {
+    auto arr = std::get<JSValueType::ARRAY>(*v.value);
+    auto it = this->seen.find(arr.get());
+    if (it != this->seen.end())
+      return it->second;
+    JSValue result = JSValue::new_array({});
+    this->seen.emplace(arr.get(), result);
+    auto &target = *std::get<JSValueType::ARRAY>(*result.value)->internal;
+    if (this->transfer.count(arr.get()) > 0) {
+      auto &source = arr->writable_storage();
+      target = std::move(source);
+      source.clear();
+      for (auto &elem : target.values) {
+        elem = this->clone(elem);
+      }
+    } else if (arr->internal->kind ==
+               JSArrayStorage::Kind::PACKED_DOUBLES) {
+      target.doubles = arr->internal->doubles;
+    } else {
+      target.reserve(arr->internal->size());
+      for (const auto &elem : arr->internal->values) {
+        target.push_back(this->clone(elem));
+      }
+    }
+    return result;
+  }
+  case JSValueType::OBJECT: {
+    auto obj = std::get<JSValueType::OBJECT>(*v.value);
+    auto it = this->seen.find(obj.get());
+    if (it != this->seen.end())
+      return it->second;
+    JSValue result = JSValue::new_object({});
+    this->seen.emplace(obj.get(), result);
+    auto &target = *std::get<JSValueType::OBJECT>(*result.value)->internal;
+    for (const auto &entry : *obj->internal) {
+      JSValue value = entry.second;
+      if (value.getter.has_value()) {
+        value = (*value.getter)(v);
+      }
+      target.push_back({this->clone(entry.first), this->clone(value)});
+    }
+    return result;
+  }
+  case JSValueType::FUNCTION:
+    js_throw(JSValue{"DataCloneError: Functions can’t be cloned"});
+  }
+  return JSValue::undefined();
+}
+
+// A one-directional, unbounded queue of already-cloned messages.
+struct MessageChannel {
+  void post(JSValue message) {
+    {
+      std::lock_guard<std::mutex> lock{this->mutex};
+      if (this->closed)
+        return;
+      this->messages.push_back(message);
+    }
+    this->ready.notify_one();
+  }
+
+  // Blocks until a message arrives. Returns `undefined` once the channel is
+  // closed and drained.
+  JSValue receive() {
+    std::unique_lock<std::mutex> lock{this->mutex};
+    this->ready.wait(lock,
+                     [this] { return this->closed || !this->messages.empty(); });
+    if (this->messages.empty())
+      return JSValue::undefined();
+    JSValue message = this->messages.front();
+    this->messages.pop_front();
+    return message;
+  }
+
+  bool is_drained() {
+    std::lock_guard<std::mutex> lock{this->mutex};
+    return this->closed && this->messages.empty();
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock{this->mutex};
+      this->closed = true;
+    }
+    this->ready.notify_all();
+  }
+
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<JSValue> messages;
+  bool closed = false;
+};
+
+#ifdef FEATURE_THREADS
+// `postMessage(value, transferList)`, `receive()`, `close()` and iteration
+// over incoming messages, shared by both ends of a worker.
+JSValue create_port(std::shared_ptr<MessageChannel> inbox,
+                    std::shared_ptr<MessageChannel> outbox) {
+  auto post_message = [=](JSValue thisArg,
+                          std::vector<JSValue> &args) mutable -> JSValue {
+    StructuredCloner cloner{};
+    if (args.size() > 1 && args[1].type() == JSValueType::ARRAY) {
+      auto &transfer_list =
+          *std::get<JSValueType::ARRAY>(*args[1].value)->internal;
+      for (size_t i = 0; i < transfer_list.size(); i++) {
+        JSValue item = transfer_list.get(i);
+        if (item.type() != JSValueType::ARRAY)
+          return js_throw(
+              JSValue{"DataCloneError: Only arrays can be transferred"});
+        cloner.transfer.insert(std::get<JSValueType::ARRAY>(*item.value).get());
+      }
+    }
+    outbox->post(cloner.clone(args.size() > 0 ? args[0] : JSValue::undefined()));
+    return JSValue::undefined();
+  };
+  auto receive = [=](JSValue thisArg,
+                     std::vector<JSValue> &args) mutable -> JSValue {
+    return inbox->receive();
+  };
+  auto close = [=](JSValue thisArg,
+                   std::vector<JSValue> &args) mutable -> JSValue {
+    outbox->close();
+    return JSValue::undefined();
+  };
+  auto iterator = [=](JSValue thisArg,
+                      std::vector<JSValue> &args) mutable -> JSValue {
+    return JSValue::iterator_from_next_func(JSValue::new_function(
+        [=](JSValue thisArg, std::vector<JSValue> &args) mutable -> JSValue {
+          JSValue message = inbox->receive();
+          bool done = message.is_undefined() && inbox->is_drained();
+          return JSValue::new_object(
+              {{JSValue{"value"}, message}, {JSValue{"done"}, JSValue{done}}});
+        }));
+  };
+  return JSValue::new_object(
+      {{JSValue{"postMessage"}, JSValue::new_function(post_message)},
+       {JSValue{"receive"}, JSValue::new_function(receive)},
+       {JSValue{"close"}, JSValue::new_function(close)},
+       {js_iterator_symbol(), JSValue::new_function(iterator)}});
+}
+
+struct WorkerState {
+  ~WorkerState() {
+    this->inbox->close();
+    if (this->thread.joinable())
+      this->thread.join();
+  }
+
+  std::shared_ptr<MessageChannel> inbox = std::make_shared<MessageChannel>();
+  std::shared_ptr<MessageChannel> outbox = std::make_shared<MessageChannel>();
+  std::shared_ptr<std::optional<JSValue>> error =
+      std::make_shared<std::optional<JSValue>>();
+  std::thread thread;
+};
+#endif
+
+} // namespace
+
+// Runs `f(port)` on its own OS thread. Messages are structured-cloned, so
+// the two sides never share mutable state through them. `f` itself should
+// only talk to the outside world through its port: variables it captures
+// are still shared with the spawning thread.
+static JSValue worker_spawn(JSValue thisArg, std::vector<JSValue> &args) {
+#ifndef FEATURE_THREADS
+  return js_throw(JSValue{"Workers are not supported in this build"});
+#else
+  if (args.size() < 1 || args[0].type() != JSValueType::FUNCTION)
+    return js_throw(JSValue{"Worker.spawn needs a function"});
+  JSValue f = args[0];
+  auto state = std::make_shared<WorkerState>();
+  // The worker receives what we send and vice versa.
+  JSValue worker_port = create_port(state->inbox, state->outbox);
+  state->thread = std::thread(
+      [f, worker_port, outbox = state->outbox, error = state->error]() mutable {
+#ifdef FEATURE_EXCEPTIONS
+        try {
+          f({worker_port});
+          js_run_event_loop();
+        } catch (JSValue e) {
+          *error = StructuredCloner{}.clone(e);
+        }
+#elif defined(FEATURE_STATUS_EXCEPTIONS)
+        f({worker_port});
+        if (!js_has_pending_exception())
+          js_run_event_loop();
+        if (js_has_pending_exception())
+          *error = StructuredCloner{}.clone(js_take_pending_exception());
+#else
+        f({worker_port});
+        js_run_event_loop();
+#endif
+        outbox->close();
+      });
+
+  JSValue handle = create_port(state->outbox, state->inbox);
+  auto join = [state](JSValue thisArg,
+                      std::vector<JSValue> &args) mutable -> JSValue {
+    state->inbox->close();
+    if (state->thread.joinable())
+      state->thread.join();
+    if (state->error->has_value())
+      return js_throw(StructuredCloner{}.clone(state->error->value()));
+    return JSValue::undefined();
+  };
+  std::get<JSValueType::OBJECT>(*handle.value)
+      ->internal->push_back({JSValue{"join"}, JSValue::new_function(join)});
+  return handle;
+#endif
+}
+
+JSValue create_Worker_global() {
+  JSValue global = JSValue::new_object(
+      {{JSValue{"spawn"}, JSValue::new_function(worker_spawn)}});
+
+  return global;
+}
@@ -0,0 +1,215 @@
+#include "heap_profile.hpp"
+#include "js_value.hpp"
+
+#include <cstdio>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#ifdef FEATURE_HEAP_PROFILE
+#ifdef FEATURE_THREADS
+#include <mutex>
+#endif
+
+thread_local const char *js_heap_site = "<runtime>";
+
+namespace {
+
+using Box = std::remove_cvref_t<
+    decltype(std::declval<const JSValue &>().boxed_value())>;
+
+JSHeapCell *first_cell = nullptr;
+
+#ifdef FEATURE_THREADS
+std::mutex cells_mutex;
+
+struct CellsLock {
+  std::lock_guard<std::mutex> guard{cells_mutex};
+};
+
+size_t ref_count(const JSRefCount &count) {
+  return count.load(std::memory_order_relaxed);
+}
+#else
+struct CellsLock {};
+
+size_t ref_count(const JSRefCount &count) { return count; }
+#endif
+
+// Arrays and objects live outside of their box and can be shared by several
+// boxes, so they are nodes of their own.
+struct Container {
+  const JSBase *base;
+  bool is_array;
+  long refs;
+  const char *site;
+};
+
+class SnapshotWriter {
+public:
+  explicit SnapshotWriter(FILE *out) : out{out} {}
+
+  void cell(const JSHeapCell &cell) {
+    if (cell.type == &js_heap_type_id<Box>)
+      this->box(cell, *static_cast<const Box *>(cell.value));
+    else if (cell.type == &js_heap_type_id<JSValue>)
+      this->receiver(cell, *static_cast<const JSValue *>(cell.value));
+  }
+
+  void containers() {
+    for (auto &[id, container] : this->pending) {
+      std::vector<const void *> edges;
+      size_t size = this->properties(*container.base, edges);
+      if (container.is_array) {
+        auto &array = *static_cast<const JSArray *>(container.base);
+        auto &storage = *array.internal;
+        size += sizeof(JSArray) + sizeof(JSArrayStorage) +
+                storage.doubles.capacity() * sizeof(double) +
+                storage.values.capacity() * sizeof(JSValue);
+        for (auto &v : storage.values)
+          this->handle(v, edges);
+      } else {
+        auto &object = *static_cast<const JSObject *>(container.base);
+        size += sizeof(JSObject) + object.internal->capacity() *
+                                       sizeof(std::pair<JSValue, JSValue>);
+        for (auto &[key, value] : *object.internal) {
+          this->handle(key, edges);
+          this->handle(value, edges);
+        }
+      }
+      this->line(id,
+                 container.is_array ? "array elements" : "object properties",
+                 size, container.refs, container.site, edges);
+    }
+  }
+
+private:
+  void box(const JSHeapCell &cell, const Box &box) {
+    std::vector<const void *> edges;
+    size_t size = cell.size;
+    const char *type = "undefined";
+    switch (box.index()) {
+    case JSValueType::BOOL:
+      type = "boolean";
+      size += this->properties(std::get<JSValueType::BOOL>(box), edges);
+      break;
+    case JSValueType::NUMBER:
+      type = "number";
+      size += this->properties(std::get<JSValueType::NUMBER>(box), edges);
+      break;
+    case JSValueType::STRING: {
+      type = "string";
+      auto &s = std::get<JSValueType::STRING>(box);
+      size += this->properties(s, edges);
+      // Short strings are stored inline.
+      const char *data = s.internal.data();
+      auto *inline_begin = reinterpret_cast<const char *>(&s.internal);
+      if (data < inline_begin || data >= inline_begin + sizeof(std::string))
+        size += s.internal.capacity() + 1;
+      break;
+    }
+    case JSValueType::ARRAY:
+      type = "array";
+      this->container(std::get<JSValueType::ARRAY>(box), true, cell, edges);
+      break;
+    case JSValueType::OBJECT:
+      type = "object";
+      this->container(std::get<JSValueType::OBJECT>(box), false, cell, edges);
+      break;
+    case JSValueType::FUNCTION: {
+      auto &f = std::get<JSValueType::FUNCTION>(box);
+      // What a closure captured is opaque, so it shows up as references
+      // from outside the heap.
+      type = f.native ? "function" : "closure";
+      size += this->properties(f, edges);
+      break;
+    }
+    }
+    this->line(cell.value, type, size, ref_count(*cell.count), cell.site,
+               edges);
+  }
+
+  // `parent_value`s, which keep the object a method was read from alive.
+  void receiver(const JSHeapCell &cell, const JSValue &v) {
+    std::vector<const void *> edges;
+    this->handle(v, edges);
+    this->line(cell.value, "method receiver", cell.size,
+               ref_count(*cell.count), cell.site, edges);
+  }
+
+  template <typename T>
+  void container(const shared_ptr<T> &ptr, bool is_array,
+                 const JSHeapCell &cell, std::vector<const void *> &edges) {
+    edges.push_back(ptr.get());
+    // Cells are visited newest first, so this ends up attributing the
+    // container to the oldest box that refers to it, which usually made it.
+    this->pending.insert_or_assign(
+        ptr.get(), Container{ptr.get(), is_array, ptr.use_count(), cell.site});
+  }
+
+  size_t properties(const JSBase &base, std::vector<const void *> &edges) {
+    for (auto &[key, value] : base.properties) {
+      this->handle(key, edges);
+      this->handle(value, edges);
+    }
+    return base.properties.capacity() * sizeof(std::pair<JSValue, JSValue>);
+  }
+
+  void handle(const JSValue &v, std::vector<const void *> &edges) {
+    if (v.value)
+      edges.push_back(v.value.get());
+    if (v.parent_value)
+      edges.push_back(v.parent_value.get());
+  }
+
+  void line(const void *id, const char *type, size_t size, long refs,
+            const char *site, const std::vector<const void *> &edges) {
+    std::fprintf(this->out, "%p\t%s\t%zu\t%ld\t%s\t", id, type, size, refs,
+                 site);
+    for (size_t i = 0; i < edges.size(); i++)
+      std::fprintf(this->out, i == 0 ? "%p" : " %p", edges[i]);
+    std::fputc('\n', this->out);
+  }
+
+  FILE *out;
+  std::unordered_map<const void *, Container> pending;
+};
+
+} // namespace
+
+void js_heap_register(JSHeapCell &cell) {
+  CellsLock lock;
+  cell.site = js_heap_site;
+  cell.prev = nullptr;
+  cell.next = first_cell;
+  if (first_cell)
+    first_cell->prev = &cell;
+  first_cell = &cell;
+}
+
+void js_heap_unregister(JSHeapCell &cell) {
+  CellsLock lock;
+  if (cell.prev)
+    cell.prev->next = cell.next;
+  else
+    first_cell = cell.next;
+  if (cell.next)
+    cell.next->prev = cell.prev;
+}
+
+bool js_heap_snapshot(const char *path) {
+  FILE *out = std::fopen(path, "w");
+  if (!out)
+    return false;
+  std::fputs("jsxx-heap-snapshot 1\n", out);
+  {
+    CellsLock lock;
+    SnapshotWriter writer{out};
+    for (JSHeapCell *cell = first_cell; cell; cell = cell->next)
+      writer.cell(*cell);
+    writer.containers();
+  }
+  return std::fclose(out) == 0;
+}
+#endif
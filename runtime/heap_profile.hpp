@@ -0,0 +1,15 @@
+#pragma once
+
+// Only defined in `--heap-profile` builds (FEATURE_HEAP_PROFILE).
+
+// The JS source location of the statement being run. The transpiler sets it
+// before every statement, and new cells record it as their allocation site.
+extern thread_local const char *js_heap_site;
+
+// Writes every live cell to `path`, one per line: its id, type, size in
+// bytes, reference count, allocation site and the ids of the cells it
+// references. `jsxx --summarize-heap` reads the file. Other threads must not
+// change values while the snapshot is taken.
+//
+// Returns false if the file can’t be written.
+bool js_heap_snapshot(const char *path);
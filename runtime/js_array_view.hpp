@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+
+#include "exceptions.hpp"
+#include "js_value.hpp"
+
+// Direct access to an array’s elements for counted loops. The transpiler only
+// uses it for variables that are never reassigned, so the view always sees
+// the array the JS code refers to. The elements are looked up on every
+// access, as arrays created from a literal swap them for a copy when they are
+// first written to. The view holds on to the array itself, as the variable’s
+// box may be overwritten through an alias while the loop runs.
+class JSArrayView {
+public:
+  explicit JSArrayView(JSValue array) : array{array}, target{nullptr} {
+    if (array.type() == JSValueType::ARRAY) {
+      this->target = std::get<JSValueType::ARRAY>(*array.value);
+    }
+  }
+
+  bool is_array() const { return this->target != nullptr; }
+
+  size_t size() const {
+    return this->is_packed() ? this->data().doubles.size()
+                             : this->data().values.size();
+  }
+
+  // Element access for loops whose bounds check already covers `idx`.
+  JSValue operator[](size_t idx) const {
+    if (this->is_packed())
+      return JSValue{this->data().doubles[idx]};
+    return this->element(this->data().values[idx]);
+  }
+
+  // Element access for loops whose body may resize the array.
+  JSValue at(size_t idx) const {
+    if (idx >= this->size())
+      return js_throw(JSValue{"Array access out of bounds"});
+    return (*this)[idx];
+  }
+
+  JSValue set(size_t idx, JSValue value) const {
+    this->target->writable_storage().set(idx, value);
+    return value;
+  }
+
+private:
+  const JSArrayStorage &data() const { return *this->target->internal; }
+
+  bool is_packed() const {
+    return this->data().kind == JSArrayStorage::Kind::PACKED_DOUBLES;
+  }
+
+  // Like `get_property`, methods remember the array as their `this`.
+  JSValue element(JSValue v) const {
+    if (v.type() == JSValueType::FUNCTION)
+      v.set_parent(this->array);
+    return v;
+  }
+
+  JSValue array;
+  std::shared_ptr<JSArray> target;
+};
@@ -0,0 +1,117 @@
+#include "js_generator.hpp"
+
+#include <new>
+#include <utility>
+
+JSGeneratorAdapter JSGeneratorAdapter::promise_type::get_return_object() {
+  return {.h = std::experimental::coroutine_handle<promise_type>::from_promise(
+              *this)};
+}
+
+std::experimental::suspend_always
+JSGeneratorAdapter::promise_type::initial_suspend() {
+  return {};
+}
+
+std::experimental::suspend_always
+JSGeneratorAdapter::promise_type::final_suspend() noexcept {
+  return {};
+}
+
+void JSGeneratorAdapter::promise_type::return_void() noexcept {
+  this->value = std::nullopt;
+}
+
+void JSGeneratorAdapter::promise_type::unhandled_exception() {
+  this->value = std::nullopt;
+  auto ptr = std::current_exception();
+  if (ptr) {
+    std::rethrow_exception(ptr);
+  }
+}
+
+std::experimental::suspend_always
+JSGeneratorAdapter::promise_type::yield_value(JSValue value) {
+  this->value.emplace(std::move(value));
+  return {};
+}
+
+namespace {
+// Per-thread free lists of generator frames, bucketed by size. Pipelines
+// create and drop many generators of the same few functions, so almost all
+// frames are served from here.
+constexpr size_t frame_granularity = 64;
+constexpr size_t frame_buckets = 32;
+constexpr size_t max_free_frames = 64;
+
+struct FreeFrame {
+  FreeFrame *next;
+};
+
+thread_local FreeFrame *free_frames[frame_buckets];
+thread_local size_t free_frame_counts[frame_buckets];
+thread_local bool frame_pool_closed = false;
+
+struct FramePoolCleanup {
+  ~FramePoolCleanup() {
+    for (auto &head : free_frames) {
+      while (head) {
+        ::operator delete(std::exchange(head, head->next));
+      }
+    }
+    frame_pool_closed = true;
+  }
+};
+thread_local FramePoolCleanup frame_pool_cleanup;
+
+size_t frame_bucket(size_t size) { return (size - 1) / frame_granularity; }
+} // namespace
+
+void *JSGeneratorAdapter::promise_type::operator new(size_t size) {
+  size_t bucket = frame_bucket(size);
+  if (bucket >= frame_buckets)
+    return ::operator new(size);
+  (void)&frame_pool_cleanup;
+  if (FreeFrame *frame = free_frames[bucket]) {
+    free_frames[bucket] = frame->next;
+    free_frame_counts[bucket]--;
+    return frame;
+  }
+  return ::operator new((bucket + 1) * frame_granularity);
+}
+
+void JSGeneratorAdapter::promise_type::operator delete(void *ptr, size_t size) {
+  size_t bucket = frame_bucket(size);
+  if (bucket >= frame_buckets || frame_pool_closed ||
+      free_frame_counts[bucket] >= max_free_frames) {
+    ::operator delete(ptr);
+    return;
+  }
+  free_frames[bucket] = new (ptr) FreeFrame{free_frames[bucket]};
+  free_frame_counts[bucket]++;
+}
+
+JSGenerator::JSGenerator(JSGeneratorStart start, shared_ptr<void> env,
+                         JSValue thisArg, std::vector<JSValue> args)
+    : start{start}, env{std::move(env)}, thisArg{thisArg},
+      args{std::move(args)} {}
+
+JSGenerator::~JSGenerator() {
+  if (this->h.has_value()) {
+    this->h->destroy();
+  }
+}
+
+optional<JSValue> JSGenerator::resume() {
+  if (!this->h.has_value()) {
+    this->h = this->start(this->env.get(), this->thisArg, this->args).h;
+  }
+  if (this->h->done()) {
+    return std::nullopt;
+  }
+  this->h->resume();
+  if (this->h->done()) {
+    return std::nullopt;
+  }
+  return std::move(this->h->promise().value);
+}
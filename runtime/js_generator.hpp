@@ -0,0 +1,54 @@
+#pragma once
+
+#include <experimental/coroutine>
+#include <functional>
+#include <optional>
+#include <vector>
+
+#include "js_value.hpp"
+
+struct JSGeneratorAdapter {
+  struct promise_type {
+    JSGeneratorAdapter get_return_object();
+    std::experimental::suspend_always initial_suspend();
+    std::experimental::suspend_always final_suspend() noexcept;
+    void return_void() noexcept;
+    void unhandled_exception();
+
+    std::experimental::suspend_always yield_value(JSValue value);
+
+    // Frames are recycled through a per-thread pool.
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr, size_t size);
+
+    optional<JSValue> value;
+  };
+
+  std::experimental::coroutine_handle<promise_type> h;
+};
+
+// Owns the coroutine frame of one generator invocation. The frame is
+// destroyed with the generator, whether or not it ran to completion.
+class JSGenerator {
+public:
+  JSGenerator(JSGeneratorStart start, shared_ptr<void> env, JSValue thisArg,
+              std::vector<JSValue> args);
+  JSGenerator(const JSGenerator &) = delete;
+  JSGenerator &operator=(const JSGenerator &) = delete;
+  ~JSGenerator();
+
+  // Runs the generator to its next `yield`. Returns the yielded value, or
+  // nothing once the generator has finished.
+  optional<JSValue> resume();
+
+private:
+  // The frame refers to the captures in `env` and to `args`, so both must
+  // outlive it.
+  JSGeneratorStart start;
+  shared_ptr<void> env;
+  JSValue thisArg;
+  std::vector<JSValue> args;
+  optional<
+      std::experimental::coroutine_handle<JSGeneratorAdapter::promise_type>>
+      h;
+};
@@ -0,0 +1,85 @@
+#include "js_pipeline.hpp"
+
+#include "exceptions.hpp"
+
+// Calls `f` without the per-call copies of `JSValue::operator()`. `args` is
+// reused across calls, so callees that resize it don’t affect the next one.
+static JSValue call(JSValue &f, std::vector<JSValue> &args) {
+  if (f.type() != JSValueType::FUNCTION)
+    return js_throw(JSValue{"Calling a non-function"});
+  return std::get<JSValueType::FUNCTION>(*f.value).call(JSValue::undefined(),
+                                                         args);
+}
+
+// Runs every element of `array` through `stages` and hands the ones that pass
+// all filters to `sink`, together with their index among those that passed.
+template <typename Sink>
+static void run_stages(JSArrayStorage &source,
+                       std::vector<JSPipelineStage> &stages, Sink sink) {
+  // Each stage numbers the elements it sees, like the call it replaces.
+  std::vector<size_t> counts(stages.size(), 0);
+  std::vector<JSValue> args(2);
+  size_t passed = 0;
+  for (size_t i = 0; i < source.size(); i++) {
+    JSValue v = source.get(i);
+    bool keep = true;
+    for (size_t s = 0; keep && s < stages.size(); s++) {
+      args.resize(2);
+      args[0] = v;
+      args[1] = JSValue{static_cast<double>(counts[s]++)};
+      JSValue result = call(stages[s].f, args);
+      if (stages[s].kind == JSPipelineStage::Kind::MAP)
+        v = result;
+      else
+        keep = result.coerce_to_bool();
+    }
+    if (keep)
+      sink(v, passed++);
+  }
+}
+
+// The unfused chain, for values that aren’t arrays.
+static JSValue apply_stages(JSValue value,
+                            std::vector<JSPipelineStage> &stages) {
+  for (auto &stage : stages) {
+    auto name = stage.kind == JSPipelineStage::Kind::MAP ? "map" : "filter";
+    value = value[JSValue{name}]({stage.f});
+  }
+  return value;
+}
+
+JSValue js_pipeline_collect(JSValue array,
+                            std::vector<JSPipelineStage> stages) {
+  if (array.type() != JSValueType::ARRAY)
+    return apply_stages(array, stages);
+  auto &source = *std::get<JSValueType::ARRAY>(*array.value)->internal;
+  JSArray result_arr{};
+  run_stages(source, stages,
+             [&](JSValue v, size_t) { result_arr.internal->push_back(v); });
+  return JSValue{result_arr};
+}
+
+JSValue js_pipeline_reduce(JSValue array, std::vector<JSPipelineStage> stages,
+                           JSValue reducer, JSValue initial) {
+  if (array.type() != JSValueType::ARRAY)
+    return apply_stages(array, stages)[JSValue{"reduce"}]({reducer, initial});
+  auto &source = *std::get<JSValueType::ARRAY>(*array.value)->internal;
+  // Without an initial value, the first element that gets through starts the
+  // accumulation, as in `JSArray::reduce_impl`.
+  bool has_acc = !initial.is_undefined();
+  JSValue acc = initial;
+  std::vector<JSValue> args(3);
+  run_stages(source, stages, [&](JSValue v, size_t idx) {
+    if (!has_acc) {
+      acc = v;
+      has_acc = true;
+      return;
+    }
+    args.resize(3);
+    args[0] = acc;
+    args[1] = v;
+    args[2] = JSValue{static_cast<double>(idx)};
+    acc = call(reducer, args);
+  });
+  return acc;
+}
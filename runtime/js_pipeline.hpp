@@ -0,0 +1,22 @@
+#pragma once
+
+#include <vector>
+
+#include "js_value.hpp"
+
+// One `map` or `filter` call of a chain the transpiler fuses.
+struct JSPipelineStage {
+  enum class Kind : char { MAP, FILTER };
+
+  Kind kind;
+  JSValue f;
+};
+
+// `array.map(f).filter(g)…` in a single pass over `array`, without the
+// intermediate arrays. Each element runs through all stages before the next
+// one is read. Values that aren’t arrays get the regular method calls.
+JSValue js_pipeline_collect(JSValue array, std::vector<JSPipelineStage> stages);
+
+// `array.map(f).filter(g)….reduce(reducer, initial)`, likewise.
+JSValue js_pipeline_reduce(JSValue array, std::vector<JSPipelineStage> stages,
+                           JSValue reducer, JSValue initial);
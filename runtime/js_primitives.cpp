@@ -1,5 +1,15 @@
 #include "js_primitives.hpp"
 #include "exceptions.hpp"
+#include "js_generator.hpp"
+#include "js_regexp.hpp"
+#include "js_template.hpp"
+#include "pdqsort.hpp"
+#include "thread_pool.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <string_view>
 
 JSBase::JSBase() {}
 
@@ -7,7 +17,7 @@ JSValue JSUndefined::operator==(JSValue &other) {
   return JSValue{other.is_undefined()};
 }
 
-JSValue JSBase::get_property(JSValue key, JSValue parent) {
+JSValue JSBase::get_property(const JSValue &key, const JSValue &parent) {
   auto result = this->get_property_from_list(this->properties, key, parent);
   if (result.has_value()) {
     return result.value();
@@ -31,18 +41,23 @@ JSValue JSBase::get_property(JSValue key, JSValue parent) {
 }
 
 std::optional<JSValue> JSBase::get_property_from_list(
-    const std::vector<std::pair<JSValue, JSValue>> &list, JSValue key,
-    JSValue parent) {
+    const std::vector<std::pair<JSValue, JSValue>> &list, const JSValue &key,
+    const JSValue &parent) {
   auto obj = std::find_if(list.begin(), list.end(),
                           [&](const std::pair<JSValue, JSValue> &item) -> bool {
-                            return (item.first == key).coerce_to_bool();
+                            return item.first.loosely_equals(key);
                           });
   if (obj == list.end()) {
     return std::nullopt;
   }
   JSValue v = (*obj).second;
   if (v.getter.has_value()) {
-    *v.value = (*v.getter)(parent).boxed_value();
+    // Getter results go into a fresh box rather than the one stored in the
+    // list, so that concurrent reads of the same property don’t race.
+    JSValue result{(*v.getter)(parent).boxed_value()};
+    result.getter = v.getter;
+    result.setter = v.setter;
+    return std::optional{result};
   }
   return std::optional{v};
 }
@@ -53,79 +68,239 @@ JSNumber::JSNumber(double v) : JSBase(), internal{v} {};
 
 JSString::JSString(const char *v) : JSBase(), internal{std::string(v)} {};
 
-JSString::JSString(std::string v) : JSBase(), internal{v} {};
+JSString::JSString(std::string v) : JSBase(), internal{std::move(v)} {};
 
-std::vector<std::pair<JSValue, JSValue>> JSArray_prototype{
-    {JSValue{"push"}, JSValue::new_function(&JSArray::push_impl)},
-    {JSValue{"map"}, JSValue::new_function(&JSArray::map_impl)},
-    {JSValue{"filter"}, JSValue::new_function(&JSArray::filter_impl)},
-    {JSValue{"reduce"}, JSValue::new_function(&JSArray::reduce_impl)},
-    {JSValue{"join"}, JSValue::new_function(&JSArray::join_impl)},
-};
+// Method tables are built on first use, so that programs don’t pay at startup
+// for types they never touch.
+static const std::vector<std::pair<JSValue, JSValue>> &array_prototype() {
+  static const std::vector<std::pair<JSValue, JSValue>> prototype{
+      {js_iterator_symbol(), JSValue::new_function(&JSArray::iterator_impl)},
+      {JSValue{"push"}, JSValue::new_function(&JSArray::push_impl)},
+      {JSValue{"map"}, JSValue::new_function(&JSArray::map_impl)},
+      {JSValue{"filter"}, JSValue::new_function(&JSArray::filter_impl)},
+      {JSValue{"reduce"}, JSValue::new_function(&JSArray::reduce_impl)},
+      {JSValue{"join"}, JSValue::new_function(&JSArray::join_impl)},
+      {JSValue{"sort"}, JSValue::new_function(&JSArray::sort_impl)},
+      {JSValue{"slice"}, JSValue::new_function(&JSArray::slice_impl)},
+      {JSValue{"concat"}, JSValue::new_function(&JSArray::concat_impl)},
+      {JSValue{"splice"}, JSValue::new_function(&JSArray::splice_impl)},
+      {JSValue{"indexOf"}, JSValue::new_function(&JSArray::index_of_impl)},
+      {JSValue{"includes"}, JSValue::new_function(&JSArray::includes_impl)},
+      {JSValue{"parallelMap"},
+       JSValue::new_function(&JSArray::parallel_map_impl)},
+      {JSValue{"parallelFilter"},
+       JSValue::new_function(&JSArray::parallel_filter_impl)},
+      {JSValue{"parallelReduce"},
+       JSValue::new_function(&JSArray::parallel_reduce_impl)},
+  };
+  return prototype;
+}
+
+static const std::vector<std::pair<JSValue, JSValue>> &string_prototype() {
+  static const std::vector<std::pair<JSValue, JSValue>> prototype{
+      {JSValue{"split"}, JSValue::new_function(&JSString::split_impl)},
+      {JSValue{"indexOf"}, JSValue::new_function(&JSString::index_of_impl)},
+      {JSValue{"includes"}, JSValue::new_function(&JSString::includes_impl)},
+      {JSValue{"startsWith"},
+       JSValue::new_function(&JSString::starts_with_impl)},
+      {JSValue{"slice"}, JSValue::new_function(&JSString::slice_impl)},
+      {JSValue{"trim"}, JSValue::new_function(&JSString::trim_impl)},
+      {JSValue{"replace"}, JSValue::new_function(&JSString::replace_impl)},
+      {JSValue{"match"}, JSValue::new_function(&JSString::match_impl)},
+  };
+  return prototype;
+}
+
+size_t JSArrayStorage::size() const {
+  return this->kind == Kind::PACKED_DOUBLES ? this->doubles.size()
+                                            : this->values.size();
+}
 
-JSArray::JSArray() : JSBase(), internal{new std::vector<JSValue>{}} {
-  for (const auto &entry : JSArray_prototype) {
-    this->properties.push_back(entry);
+JSValue JSArrayStorage::get(size_t idx) const {
+  if (this->kind == Kind::PACKED_DOUBLES)
+    return JSValue{this->doubles[idx]};
+  return this->values[idx];
+}
+
+void JSArrayStorage::set(size_t idx, JSValue value) {
+  if (idx >= this->size()) {
+    this->resize(idx);
+    this->push_back(value);
+    return;
   }
-  std::vector<JSValue> *data = &(*this->internal);
-  auto length_prop = JSValue::with_getter_setter(
-      JSValue::new_function(
-          [=](JSValue thisArg, std::vector<JSValue> &args) mutable -> JSValue {
-            return JSValue{static_cast<double>(data->size())};
-          }),
-      JSValue::new_function(
-          [=](JSValue thisArg, std::vector<JSValue> &args) mutable -> JSValue {
-            if (args.size() < 1 || args[0].type() != JSValueType::NUMBER)
-              return JSValue::undefined();
-            JSValue v = args[0];
-            data->resize(static_cast<size_t>(v.coerce_to_double()),
-                         JSValue::undefined());
-            return JSValue::undefined();
-          }));
-  this->properties.push_back({JSValue{"length"}, length_prop});
-  this->properties.push_back(
-      {iterator_symbol, JSValue::new_function(&JSArray::iterator_impl)});
-};
+  if (this->kind == Kind::PACKED_DOUBLES) {
+    if (value.type() == JSValueType::NUMBER) {
+      this->doubles[idx] = value.get_number();
+      return;
+    }
+    this->make_generic();
+  }
+  this->values[idx] = value;
+}
+
+void JSArrayStorage::push_back(JSValue value) {
+  if (this->kind == Kind::PACKED_DOUBLES) {
+    if (value.type() == JSValueType::NUMBER) {
+      this->doubles.push_back(value.get_number());
+      return;
+    }
+    this->make_generic();
+  }
+  this->values.push_back(value);
+}
+
+void JSArrayStorage::append(const JSArrayStorage &other, size_t begin,
+                            size_t end) {
+  if (begin >= end)
+    return;
+  if (this->kind == Kind::PACKED_DOUBLES &&
+      other.kind == Kind::PACKED_DOUBLES) {
+    this->doubles.insert(this->doubles.end(), other.doubles.begin() + begin,
+                         other.doubles.begin() + end);
+    return;
+  }
+  this->make_generic();
+  if (other.kind == Kind::GENERIC) {
+    this->values.insert(this->values.end(), other.values.begin() + begin,
+                        other.values.begin() + end);
+    return;
+  }
+  this->values.reserve(this->values.size() + (end - begin));
+  for (size_t i = begin; i < end; i++) {
+    this->values.push_back(JSValue{other.doubles[i]});
+  }
+}
+
+void JSArrayStorage::insert(size_t idx,
+                            std::vector<JSValue>::const_iterator first,
+                            std::vector<JSValue>::const_iterator last) {
+  if (this->kind == Kind::PACKED_DOUBLES &&
+      std::all_of(first, last, [](const JSValue &v) {
+        return v.type() == JSValueType::NUMBER;
+      })) {
+    std::vector<double> numbers;
+    numbers.reserve(last - first);
+    for (auto it = first; it != last; ++it) {
+      numbers.push_back(it->coerce_to_double());
+    }
+    this->doubles.insert(this->doubles.begin() + idx, numbers.begin(),
+                         numbers.end());
+    return;
+  }
+  this->make_generic();
+  this->values.insert(this->values.begin() + idx, first, last);
+}
+
+void JSArrayStorage::erase(size_t begin, size_t end) {
+  if (this->kind == Kind::PACKED_DOUBLES)
+    this->doubles.erase(this->doubles.begin() + begin,
+                        this->doubles.begin() + end);
+  else
+    this->values.erase(this->values.begin() + begin,
+                       this->values.begin() + end);
+}
+
+void JSArrayStorage::resize(size_t size) {
+  if (size > this->size())
+    this->make_generic();
+  if (this->kind == Kind::PACKED_DOUBLES)
+    this->doubles.resize(size);
+  else
+    this->values.resize(size, JSValue::undefined());
+}
+
+void JSArrayStorage::reserve(size_t size) {
+  if (this->kind == Kind::PACKED_DOUBLES)
+    this->doubles.reserve(size);
+  else
+    this->values.reserve(size);
+}
+
+void JSArrayStorage::clear() {
+  this->doubles.clear();
+  this->values.clear();
+  this->kind = Kind::PACKED_DOUBLES;
+}
+
+void JSArrayStorage::make_generic() {
+  if (this->kind == Kind::GENERIC)
+    return;
+  this->values.reserve(this->doubles.size());
+  for (double v : this->doubles) {
+    this->values.push_back(JSValue{v});
+  }
+  this->doubles = {};
+  this->kind = Kind::GENERIC;
+}
+
+static bool is_length_key(const JSValue &key) {
+  return key.type() == JSValueType::STRING &&
+         std::get<JSValueType::STRING>(*key.value).internal == "length";
+}
+
+// `v` as an array length or index, if it is a non-negative integer no larger
+// than JS allows. Casting anything else to `size_t` is undefined.
+static std::optional<size_t> array_length(double v) {
+  if (!(v >= 0 && v <= 4294967295.0) || std::trunc(v) != v)
+    return std::nullopt;
+  return static_cast<size_t>(v);
+}
+
+JSArray::JSArray() : JSBase(), internal{new JSArrayStorage{}} {};
 
 JSArray::JSArray(std::vector<JSValue> data) : JSArray() {
+  this->internal->reserve(data.size());
   for (auto v : data) {
     this->internal->push_back(v);
   }
 }
 
+JSArray::JSArray(shared_ptr<JSArrayStorage> literal)
+    : JSBase(), internal{std::move(literal)}, shares_literal{true} {};
+
+JSArrayStorage &JSArray::writable_storage() {
+  if (this->shares_literal) {
+    this->internal = std::make_shared<JSArrayStorage>(*this->internal);
+    this->shares_literal = false;
+  }
+  return *this->internal;
+}
+
 JSValue JSArray::push_impl(JSValue thisArg, std::vector<JSValue> &args) {
   if (thisArg.type() != JSValueType::ARRAY)
-    js_throw(JSValue{"Called push on non-array"});
-  auto arr = std::get<JSValueType::ARRAY>(*thisArg.value);
+    return js_throw(JSValue{"Called push on non-array"});
+  auto &storage =
+      std::get<JSValueType::ARRAY>(*thisArg.value)->writable_storage();
   for (auto v : args) {
-    arr->internal->push_back(v);
+    storage.push_back(v);
   }
   return JSValue::undefined();
 }
 
 JSValue JSArray::map_impl(JSValue thisArg, std::vector<JSValue> &args) {
   if (thisArg.type() != JSValueType::ARRAY)
-    js_throw(JSValue{"Called map on non-array"});
+    return js_throw(JSValue{"Called map on non-array"});
   JSValue f = args[0];
   auto arr = std::get<JSValueType::ARRAY>(*thisArg.value);
   JSArray result_arr{};
-  for (int i = 0; i < arr->internal->size(); i++) {
+  result_arr.internal->reserve(arr->internal->size());
+  for (size_t i = 0; i < arr->internal->size(); i++) {
     result_arr.internal->push_back(
-        f({(*arr->internal)[i], JSValue{static_cast<double>(i)}}));
+        f({arr->internal->get(i), JSValue{static_cast<double>(i)}}));
   }
   return JSValue{result_arr};
 }
 
 JSValue JSArray::filter_impl(JSValue thisArg, std::vector<JSValue> &args) {
   if (thisArg.type() != JSValueType::ARRAY)
-    js_throw(JSValue{"Called filter on non-array"});
+    return js_throw(JSValue{"Called filter on non-array"});
   JSValue f = args[0];
   auto arr = std::get<JSValueType::ARRAY>(*thisArg.value);
   JSArray result_arr{};
-  for (int i = 0; i < arr->internal->size(); i++) {
-    if (f({(*arr->internal)[i], JSValue{static_cast<double>(i)}})
-            .coerce_to_bool()) {
-      result_arr.internal->push_back((*arr->internal)[i]);
+  for (size_t i = 0; i < arr->internal->size(); i++) {
+    JSValue v = arr->internal->get(i);
+    if (f({v, JSValue{static_cast<double>(i)}}).coerce_to_bool()) {
+      result_arr.internal->push_back(v);
     }
   }
   return JSValue{result_arr};
@@ -133,30 +308,347 @@ JSValue JSArray::filter_impl(JSValue thisArg, std::vector<JSValue> &args) {
 
 JSValue JSArray::reduce_impl(JSValue thisArg, std::vector<JSValue> &args) {
   if (thisArg.type() != JSValueType::ARRAY)
-    js_throw(JSValue{"Called reduce on non-array"});
+    return js_throw(JSValue{"Called reduce on non-array"});
   auto arr = std::get<JSValueType::ARRAY>(*thisArg.value);
 
   JSValue f = args[0];
 
-  int i;
+  size_t i = 0;
   JSValue acc;
   if (args.size() >= 2 && !args[1].is_undefined()) {
-    i = 0;
     acc = args[1];
   } else if (arr->internal->size() >= 1) {
     i = 1;
-    acc = (*arr->internal)[0];
+    acc = arr->internal->get(0);
   }
 
   for (; i < arr->internal->size(); i++) {
-    acc = f({acc, (*arr->internal)[i], JSValue{static_cast<double>(i)}});
+    acc = f({acc, arr->internal->get(i), JSValue{static_cast<double>(i)}});
+  }
+  return acc;
+}
+
+// Resolves the index argument `i` like `slice` and `splice` do: negative
+// values count from the end and the result is clamped to `[0, size]`.
+static size_t relative_index(const std::vector<JSValue> &args, size_t i,
+                             size_t size, size_t fallback) {
+  if (args.size() <= i || args[i].is_undefined())
+    return fallback;
+  double idx = std::trunc(args[i].coerce_to_double());
+  if (std::isnan(idx))
+    return 0;
+  if (idx < 0)
+    return static_cast<size_t>(std::max(0.0, static_cast<double>(size) + idx));
+  return static_cast<size_t>(std::min(static_cast<double>(size), idx));
+}
+
+static bool is_native_function(const JSValue &v, ExternFuncPtr f) {
+  if (v.type() != JSValueType::FUNCTION)
+    return false;
+  return std::get<JSValueType::FUNCTION>(*v.value).native == f;
+}
+
+JSValue JSArray::sort_impl(JSValue thisArg, std::vector<JSValue> &args) {
+  if (thisArg.type() != JSValueType::ARRAY)
+    return js_throw(JSValue{"Called sort on non-array"});
+  auto &storage =
+      std::get<JSValueType::ARRAY>(*thisArg.value)->writable_storage();
+  JSValue comparator = args.size() > 0 ? args[0] : JSValue::undefined();
+  if (!comparator.is_undefined() && comparator.type() != JSValueType::FUNCTION)
+    return js_throw(JSValue{"Comparator is not a function"});
+
+  if (storage.kind == JSArrayStorage::Kind::PACKED_DOUBLES) {
+    if (is_native_function(comparator, &JSArray::numeric_ascending_impl)) {
+      pdqsort(storage.doubles.begin(), storage.doubles.end(),
+              std::less<double>{});
+      return thisArg;
+    }
+    if (is_native_function(comparator, &JSArray::numeric_descending_impl)) {
+      pdqsort(storage.doubles.begin(), storage.doubles.end(),
+              std::greater<double>{});
+      return thisArg;
+    }
+  }
+
+  // Everything else sorts a copy, so a comparator that throws or modifies
+  // the array can’t leave it half-sorted. Ties are broken by the original
+  // position, which keeps the sort stable. `undefined` goes last.
+  struct Entry {
+    JSValue value;
+    std::string key;
+    size_t idx;
+  };
+  std::vector<Entry> entries;
+  std::vector<JSValue> undefineds;
+  entries.reserve(storage.size());
+  for (size_t i = 0; i < storage.size(); i++) {
+    JSValue v = storage.get(i);
+    if (v.is_undefined()) {
+      undefineds.push_back(v);
+      continue;
+    }
+    // Without a comparator, elements compare by their string form, which is
+    // computed only once per element.
+    std::string key = comparator.is_undefined() ? v.coerce_to_string() : "";
+    entries.push_back({v, std::move(key), i});
+  }
+  if (comparator.is_undefined()) {
+    pdqsort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) {
+              int order = a.key.compare(b.key);
+              return order < 0 || (order == 0 && a.idx < b.idx);
+            });
+  } else {
+    auto &f = std::get<JSValueType::FUNCTION>(*comparator.value);
+    std::vector<JSValue> call_args(2);
+    pdqsort(entries.begin(), entries.end(),
+            [&](const Entry &a, const Entry &b) {
+              call_args.resize(2);
+              call_args[0] = a.value;
+              call_args[1] = b.value;
+              double order =
+                  f.call(JSValue::undefined(), call_args).coerce_to_double();
+              return order < 0 || (!(order > 0) && a.idx < b.idx);
+            });
+  }
+  storage.clear();
+  storage.reserve(entries.size() + undefineds.size());
+  for (auto &entry : entries) {
+    storage.push_back(entry.value);
+  }
+  for (auto &v : undefineds) {
+    storage.push_back(v);
+  }
+  return thisArg;
+}
+
+JSValue JSArray::numeric_ascending_impl(JSValue thisArg,
+                                        std::vector<JSValue> &args) {
+  return args[0] - args[1];
+}
+
+JSValue JSArray::numeric_descending_impl(JSValue thisArg,
+                                         std::vector<JSValue> &args) {
+  return args[1] - args[0];
+}
+
+JSValue JSArray::slice_impl(JSValue thisArg, std::vector<JSValue> &args) {
+  if (thisArg.type() != JSValueType::ARRAY)
+    return js_throw(JSValue{"Called slice on non-array"});
+  auto &storage = *std::get<JSValueType::ARRAY>(*thisArg.value)->internal;
+  size_t begin = relative_index(args, 0, storage.size(), 0);
+  size_t end = relative_index(args, 1, storage.size(), storage.size());
+  JSArray result_arr{};
+  result_arr.internal->append(storage, begin, end);
+  return JSValue{result_arr};
+}
+
+JSValue JSArray::concat_impl(JSValue thisArg, std::vector<JSValue> &args) {
+  if (thisArg.type() != JSValueType::ARRAY)
+    return js_throw(JSValue{"Called concat on non-array"});
+  auto &storage = *std::get<JSValueType::ARRAY>(*thisArg.value)->internal;
+  JSArray result_arr{};
+  result_arr.internal->append(storage, 0, storage.size());
+  for (auto &arg : args) {
+    if (arg.type() == JSValueType::ARRAY) {
+      auto &other = *std::get<JSValueType::ARRAY>(*arg.value)->internal;
+      result_arr.internal->append(other, 0, other.size());
+    } else {
+      result_arr.internal->push_back(arg);
+    }
+  }
+  return JSValue{result_arr};
+}
+
+JSValue JSArray::splice_impl(JSValue thisArg, std::vector<JSValue> &args) {
+  if (thisArg.type() != JSValueType::ARRAY)
+    return js_throw(JSValue{"Called splice on non-array"});
+  auto &storage =
+      std::get<JSValueType::ARRAY>(*thisArg.value)->writable_storage();
+  size_t start = relative_index(args, 0, storage.size(), 0);
+  size_t delete_count = 0;
+  if (args.size() == 1) {
+    delete_count = storage.size() - start;
+  } else if (args.size() >= 2) {
+    double count = std::trunc(args[1].coerce_to_double());
+    if (count > 0)
+      delete_count = static_cast<size_t>(
+          std::min(count, static_cast<double>(storage.size() - start)));
+  }
+  JSArray removed{};
+  removed.internal->append(storage, start, start + delete_count);
+  storage.erase(start, start + delete_count);
+  if (args.size() > 2)
+    storage.insert(start, args.begin() + 2, args.end());
+  return JSValue{removed};
+}
+
+// Finds `v` from the index given by `args[1]` on, comparing strictly. With
+// `same_value_zero`, `NaN` also matches itself, as in `includes`.
+static std::optional<size_t> find_element(JSValue thisArg,
+                                          std::vector<JSValue> &args,
+                                          bool same_value_zero) {
+  auto &storage = *std::get<JSValueType::ARRAY>(*thisArg.value)->internal;
+  JSValue v = args.size() > 0 ? args[0] : JSValue::undefined();
+  size_t from = relative_index(args, 1, storage.size(), 0);
+  bool find_nan = same_value_zero && v.type() == JSValueType::NUMBER &&
+                  std::isnan(v.get_number());
+
+  if (storage.kind == JSArrayStorage::Kind::PACKED_DOUBLES) {
+    if (v.type() != JSValueType::NUMBER)
+      return std::nullopt;
+    auto begin = storage.doubles.begin() + from;
+    auto it = find_nan ? std::find_if(begin, storage.doubles.end(),
+                                      [](double d) { return std::isnan(d); })
+                       : std::find(begin, storage.doubles.end(),
+                                   v.get_number());
+    if (it == storage.doubles.end())
+      return std::nullopt;
+    return it - storage.doubles.begin();
+  }
+
+  for (size_t i = from; i < storage.values.size(); i++) {
+    const JSValue &element = storage.values[i];
+    if (element.type() != v.type())
+      continue;
+    if (element.loosely_equals(v) ||
+        (find_nan && std::isnan(element.coerce_to_double())))
+      return i;
+  }
+  return std::nullopt;
+}
+
+JSValue JSArray::index_of_impl(JSValue thisArg, std::vector<JSValue> &args) {
+  if (thisArg.type() != JSValueType::ARRAY)
+    return js_throw(JSValue{"Called indexOf on non-array"});
+  auto idx = find_element(thisArg, args, false);
+  return JSValue{idx.has_value() ? static_cast<double>(*idx) : -1.0};
+}
+
+JSValue JSArray::includes_impl(JSValue thisArg, std::vector<JSValue> &args) {
+  if (thisArg.type() != JSValueType::ARRAY)
+    return js_throw(JSValue{"Called includes on non-array"});
+  return JSValue{find_element(thisArg, args, true).has_value()};
+}
+
+// Runs `task` like `js_parallel_run`. In status mode, the first exception
+// left pending on a pool thread is thrown on the calling thread afterwards.
+static void parallel_run(size_t count,
+                         const std::function<void(size_t)> &task) {
+#ifdef FEATURE_STATUS_EXCEPTIONS
+  std::mutex error_mutex;
+  std::optional<JSValue> error;
+  js_parallel_run(count, [&](size_t i) {
+    task(i);
+    if (js_has_pending_exception()) {
+      JSValue e = js_take_pending_exception();
+      std::lock_guard<std::mutex> lock{error_mutex};
+      if (!error)
+        error = e;
+    }
+  });
+  if (error)
+    js_throw(*error);
+#else
+  js_parallel_run(count, task);
+#endif
+}
+
+// The parallel variants call `f` concurrently from pool threads. They are
+// only safe for callbacks that don’t assign to variables shared with other
+// invocations. Elements are passed as copies, as they share their box with
+// the array and a callback may assign to its parameter.
+JSValue JSArray::parallel_map_impl(JSValue thisArg,
+                                   std::vector<JSValue> &args) {
+  if (thisArg.type() != JSValueType::ARRAY)
+    return js_throw(JSValue{"Called parallelMap on non-array"});
+  JSValue f = args[0];
+  auto arr = std::get<JSValueType::ARRAY>(*thisArg.value);
+  auto chunks = js_parallel_chunks(arr->internal->size());
+  std::vector<std::vector<JSValue>> results(chunks.size());
+  parallel_run(chunks.size(), [&](size_t chunk) {
+    JSValue local_f = f;
+    for (size_t i = chunks[chunk].first; i < chunks[chunk].second; i++) {
+      results[chunk].push_back(
+          local_f({JSValue{arr->internal->get(i).boxed_value()},
+                   JSValue{static_cast<double>(i)}}));
+    }
+  });
+  JSArray result_arr{};
+  result_arr.internal->reserve(arr->internal->size());
+  for (auto &result : results) {
+    for (auto &v : result) {
+      result_arr.internal->push_back(v);
+    }
+  }
+  return JSValue{result_arr};
+}
+
+JSValue JSArray::parallel_filter_impl(JSValue thisArg,
+                                      std::vector<JSValue> &args) {
+  if (thisArg.type() != JSValueType::ARRAY)
+    return js_throw(JSValue{"Called parallelFilter on non-array"});
+  JSValue f = args[0];
+  auto arr = std::get<JSValueType::ARRAY>(*thisArg.value);
+  auto chunks = js_parallel_chunks(arr->internal->size());
+  std::vector<std::vector<JSValue>> results(chunks.size());
+  parallel_run(chunks.size(), [&](size_t chunk) {
+    JSValue local_f = f;
+    for (size_t i = chunks[chunk].first; i < chunks[chunk].second; i++) {
+      JSValue v = arr->internal->get(i);
+      if (local_f({JSValue{v.boxed_value()}, JSValue{static_cast<double>(i)}})
+              .coerce_to_bool()) {
+        results[chunk].push_back(v);
+      }
+    }
+  });
+  JSArray result_arr{};
+  for (auto &result : results) {
+    for (auto &v : result) {
+      result_arr.internal->push_back(v);
+    }
+  }
+  return JSValue{result_arr};
+}
+
+// `f` has to be associative: every chunk is folded on its own, and the chunk
+// results are then combined with `f` again, in order.
+JSValue JSArray::parallel_reduce_impl(JSValue thisArg,
+                                      std::vector<JSValue> &args) {
+  if (thisArg.type() != JSValueType::ARRAY)
+    return js_throw(JSValue{"Called parallelReduce on non-array"});
+  JSValue f = args[0];
+  auto arr = std::get<JSValueType::ARRAY>(*thisArg.value);
+  bool has_initial = args.size() >= 2 && !args[1].is_undefined();
+  if (arr->internal->size() == 0) {
+    if (!has_initial)
+      return js_throw(JSValue{"Reduce of empty array with no initial value"});
+    return args[1];
+  }
+
+  auto chunks = js_parallel_chunks(arr->internal->size());
+  std::vector<JSValue> partials(chunks.size());
+  parallel_run(chunks.size(), [&](size_t chunk) {
+    JSValue local_f = f;
+    size_t i = chunks[chunk].first;
+    JSValue acc{arr->internal->get(i).boxed_value()};
+    for (i++; i < chunks[chunk].second; i++) {
+      acc = local_f({acc, JSValue{arr->internal->get(i).boxed_value()},
+                     JSValue{static_cast<double>(i)}});
+    }
+    partials[chunk] = acc;
+  });
+
+  JSValue acc = has_initial ? f({args[1], partials[0]}) : partials[0];
+  for (size_t i = 1; i < partials.size(); i++) {
+    acc = f({acc, partials[i]});
   }
   return acc;
 }
 
 JSValue JSArray::join_impl(JSValue thisArg, std::vector<JSValue> &args) {
   if (thisArg.type() != JSValueType::ARRAY)
-    js_throw(JSValue{"Called join on non-array"});
+    return js_throw(JSValue{"Called join on non-array"});
 
   std::string delimiter = "";
   std::string result = "";
@@ -164,8 +656,16 @@ JSValue JSArray::join_impl(JSValue thisArg, std::vector<JSValue> &args) {
     delimiter = args[0].coerce_to_string();
   }
   auto arr = std::get<JSValueType::ARRAY>(*thisArg.value);
-  for (auto v : *arr->internal) {
-    result += v.coerce_to_string() + delimiter;
+  if (arr->internal->kind == JSArrayStorage::Kind::PACKED_DOUBLES) {
+    char buffer[JS_NUMBER_BUFFER_SIZE];
+    for (double v : arr->internal->doubles) {
+      result.append(buffer, js_format_number(v, buffer));
+      result += delimiter;
+    }
+  } else {
+    for (const auto &v : arr->internal->values) {
+      result += v.coerce_to_string() + delimiter;
+    }
   }
   result = result.substr(0, result.size() - delimiter.size());
   return JSValue{result};
@@ -177,10 +677,11 @@ JSValue JSArray::iterator_impl(JSValue thisArg, std::vector<JSValue> &args) {
           std::vector<JSValue> &args) mutable -> JSGeneratorAdapter {
         if (thisArg.type() != JSValueType::ARRAY) {
           js_throw(JSValue{"Called array iterator with a non-array value"});
+          co_return;
         }
         auto arr = std::get<JSValueType::ARRAY>(*thisArg.value);
-        for (auto value : *arr->internal) {
-          co_yield value;
+        for (size_t i = 0; i < arr->internal->size(); i++) {
+          co_yield arr->internal->get(i);
         }
         co_return;
       });
@@ -188,16 +689,235 @@ JSValue JSArray::iterator_impl(JSValue thisArg, std::vector<JSValue> &args) {
   return gen(args);
 }
 
-JSValue JSArray::get_property(const JSValue key, JSValue parent) {
+JSValue JSArray::get_property(const JSValue &key,
+                              const JSValue &parent) {
+  if (key.type() == JSValueType::NUMBER) {
+    auto idx = array_length(key.coerce_to_double());
+    if (!idx || *idx >= this->internal->size())
+      return js_throw(JSValue{"Array access out of bounds"});
+    return this->internal->get(*idx);
+  }
+  if (is_length_key(key)) {
+    return JSValue{static_cast<double>(this->internal->size())};
+  }
+  // Methods live in one table shared by all arrays, after the array’s own
+  // properties.
+  if (auto own = this->get_property_from_list(this->properties, key, parent))
+    return *own;
+  if (auto method =
+          this->get_property_from_list(array_prototype(), key, parent))
+    return *method;
+  return JSBase::get_property(key, parent);
+}
+
+JSValue JSArray::set_property(const JSValue &key, JSValue value,
+                              const JSValue &parent) {
   if (key.type() == JSValueType::NUMBER) {
-    auto idx = static_cast<size_t>(key.coerce_to_double());
-    if (idx >= this->internal->size())
-      js_throw(JSValue{"Array access out of bounds"});
-    return (*this->internal)[idx];
+    // The largest index is one less than the largest length.
+    auto idx = array_length(key.coerce_to_double());
+    if (!idx || *idx == 4294967295)
+      return js_throw(JSValue{"Array access out of bounds"});
+    this->writable_storage().set(*idx, value);
+    return value;
+  }
+  if (is_length_key(key)) {
+    if (value.type() == JSValueType::NUMBER) {
+      auto length = array_length(value.coerce_to_double());
+      if (!length)
+        return js_throw(JSValue{"Invalid array length"});
+      this->writable_storage().resize(*length);
+    }
+    return value;
+  }
+  JSValue target = JSBase::get_property(key, parent);
+  target = value.boxed_value();
+  return value;
+}
+
+// Finds `needle` in `haystack` from `from` on. Single bytes are found with
+// `memchr` and longer needles with `memmem`, which libc implements with SIMD
+// scans and the two-way algorithm respectively.
+static size_t find_substring(std::string_view haystack,
+                             std::string_view needle, size_t from) {
+  if (from > haystack.size())
+    return std::string_view::npos;
+  if (needle.empty())
+    return from;
+  const char *start = haystack.data() + from;
+  size_t remaining = haystack.size() - from;
+  const void *found =
+      needle.size() == 1
+          ? memchr(start, needle[0], remaining)
+          : memmem(start, remaining, needle.data(), needle.size());
+  if (found == nullptr)
+    return std::string_view::npos;
+  return static_cast<const char *>(found) - haystack.data();
+}
+
+static const std::string &string_value(const JSValue &v) {
+  return std::get<JSValueType::STRING>(*v.value).internal;
+}
+
+static std::string string_arg(const std::vector<JSValue> &args, size_t i) {
+  return i < args.size() ? args[i].coerce_to_string() : "undefined";
+}
+
+// Like `relative_index`, but negative positions count as 0, as in
+// `indexOf` and `startsWith`.
+static size_t position_arg(const std::vector<JSValue> &args, size_t i,
+                           size_t size) {
+  if (i >= args.size() || args[i].is_undefined())
+    return 0;
+  double pos = std::trunc(args[i].coerce_to_double());
+  if (std::isnan(pos) || pos < 0)
+    return 0;
+  return static_cast<size_t>(std::min(static_cast<double>(size), pos));
+}
+
+JSValue JSString::get_property(const JSValue &key,
+                               const JSValue &parent) {
+  if (is_length_key(key)) {
+    return JSValue{static_cast<double>(this->internal.size())};
   }
+  if (auto own = this->get_property_from_list(this->properties, key, parent))
+    return *own;
+  if (auto method =
+          this->get_property_from_list(string_prototype(), key, parent))
+    return *method;
   return JSBase::get_property(key, parent);
 }
 
+// Substrings are copied straight out of the source string, without
+// intermediate values.
+JSValue JSString::split_impl(JSValue thisArg, std::vector<JSValue> &args) {
+  if (thisArg.type() != JSValueType::STRING)
+    return js_throw(JSValue{"Called split on non-string"});
+  const std::string &str = string_value(thisArg);
+  size_t limit = SIZE_MAX;
+  if (args.size() > 1 && !args[1].is_undefined()) {
+    // ToUint32: NaN and infinities become 0, everything else wraps around.
+    double d = args[1].coerce_to_double();
+    limit = std::isfinite(d) ? static_cast<uint32_t>(static_cast<int64_t>(
+                                   std::fmod(std::trunc(d), 4294967296.0)))
+                             : 0;
+  }
+  JSArray result_arr{};
+  if (limit == 0)
+    return JSValue{result_arr};
+  if (args.size() == 0 || args[0].is_undefined()) {
+    result_arr.internal->push_back(JSValue{str});
+    return JSValue{result_arr};
+  }
+
+  std::string separator = args[0].coerce_to_string();
+  if (separator.empty()) {
+    for (size_t i = 0; i < str.size() && i < limit; i++) {
+      result_arr.internal->push_back(JSValue{std::string(1, str[i])});
+    }
+    return JSValue{result_arr};
+  }
+  size_t count = 0;
+  size_t pos = 0;
+  for (size_t found = find_substring(str, separator, 0);
+       found != std::string_view::npos && count < limit;
+       found = find_substring(str, separator, pos)) {
+    result_arr.internal->push_back(JSValue{str.substr(pos, found - pos)});
+    count++;
+    pos = found + separator.size();
+  }
+  if (count < limit)
+    result_arr.internal->push_back(JSValue{str.substr(pos)});
+  return JSValue{result_arr};
+}
+
+JSValue JSString::index_of_impl(JSValue thisArg, std::vector<JSValue> &args) {
+  if (thisArg.type() != JSValueType::STRING)
+    return js_throw(JSValue{"Called indexOf on non-string"});
+  const std::string &str = string_value(thisArg);
+  size_t found = find_substring(str, string_arg(args, 0),
+                                position_arg(args, 1, str.size()));
+  return JSValue{found == std::string_view::npos ? -1.0
+                                                 : static_cast<double>(found)};
+}
+
+JSValue JSString::includes_impl(JSValue thisArg, std::vector<JSValue> &args) {
+  if (thisArg.type() != JSValueType::STRING)
+    return js_throw(JSValue{"Called includes on non-string"});
+  const std::string &str = string_value(thisArg);
+  return JSValue{find_substring(str, string_arg(args, 0),
+                                position_arg(args, 1, str.size())) !=
+                 std::string_view::npos};
+}
+
+JSValue JSString::starts_with_impl(JSValue thisArg,
+                                   std::vector<JSValue> &args) {
+  if (thisArg.type() != JSValueType::STRING)
+    return js_throw(JSValue{"Called startsWith on non-string"});
+  std::string_view str = string_value(thisArg);
+  std::string prefix = string_arg(args, 0);
+  return JSValue{
+      str.substr(position_arg(args, 1, str.size())).starts_with(prefix)};
+}
+
+JSValue JSString::slice_impl(JSValue thisArg, std::vector<JSValue> &args) {
+  if (thisArg.type() != JSValueType::STRING)
+    return js_throw(JSValue{"Called slice on non-string"});
+  const std::string &str = string_value(thisArg);
+  size_t begin = relative_index(args, 0, str.size(), 0);
+  size_t end = relative_index(args, 1, str.size(), str.size());
+  return JSValue{begin < end ? str.substr(begin, end - begin) : ""};
+}
+
+// Only ASCII whitespace is trimmed.
+JSValue JSString::trim_impl(JSValue thisArg, std::vector<JSValue> &args) {
+  if (thisArg.type() != JSValueType::STRING)
+    return js_throw(JSValue{"Called trim on non-string"});
+  const std::string &str = string_value(thisArg);
+  const char *whitespace = " \t\n\v\f\r";
+  size_t begin = str.find_first_not_of(whitespace);
+  if (begin == std::string::npos)
+    return JSValue{""};
+  size_t end = str.find_last_not_of(whitespace) + 1;
+  return JSValue{str.substr(begin, end - begin)};
+}
+
+// Replaces the first occurrence of a string, or the matches of a regular
+// expression. The replacement is either a string or a function called with
+// the match, any groups, its offset and the string.
+JSValue JSString::replace_impl(JSValue thisArg, std::vector<JSValue> &args) {
+  if (thisArg.type() != JSValueType::STRING)
+    return js_throw(JSValue{"Called replace on non-string"});
+  JSValue replacement = args.size() > 1 ? args[1] : JSValue::undefined();
+  if (JSRegExp *re = args.size() > 0 ? js_as_regexp(args[0]) : nullptr)
+    return js_regexp_replace(*re, thisArg, replacement);
+  const std::string &str = string_value(thisArg);
+  std::string pattern = string_arg(args, 0);
+  size_t found = find_substring(str, pattern, 0);
+  if (found == std::string_view::npos)
+    return thisArg;
+  size_t captures[] = {found, found + pattern.size()};
+  std::string result = str.substr(0, found);
+  if (replacement.type() == JSValueType::FUNCTION) {
+    result += replacement({JSValue{pattern},
+                           JSValue{static_cast<double>(found)}, thisArg})
+                  .coerce_to_string();
+  } else {
+    js_append_substitution(result, replacement.coerce_to_string(), str,
+                           captures, 1);
+  }
+  result.append(str, captures[1]);
+  return JSValue{result};
+}
+
+JSValue JSString::match_impl(JSValue thisArg, std::vector<JSValue> &args) {
+  if (thisArg.type() != JSValueType::STRING)
+    return js_throw(JSValue{"Called match on non-string"});
+  JSRegExp *re = args.size() > 0 ? js_as_regexp(args[0]) : nullptr;
+  if (re == nullptr)
+    return js_throw(JSValue{"match needs a regular expression"});
+  return js_regexp_match(*re, string_value(thisArg));
+}
+
 JSObject::JSObject()
     : JSBase(), internal{new std::vector<std::pair<JSValue, JSValue>>{}} {};
 
@@ -205,7 +925,26 @@ JSObject::JSObject(std::vector<std::pair<JSValue, JSValue>> data) : JSObject() {
   *this->internal = data;
 };
 
-JSValue JSObject::get_property(const JSValue key, JSValue parent) {
+JSObject::JSObject(
+    shared_ptr<std::vector<std::pair<JSValue, JSValue>>> literal)
+    : JSBase(), internal{std::move(literal)}, shares_literal{true} {};
+
+std::vector<std::pair<JSValue, JSValue>> &JSObject::writable_properties() {
+  if (this->shares_literal) {
+    // Properties are assigned to in place, so the copies need boxes of their
+    // own.
+    auto copy = std::make_shared<std::vector<std::pair<JSValue, JSValue>>>();
+    copy->reserve(this->internal->size());
+    for (auto &[key, value] : *this->internal)
+      copy->push_back({key, JSValue{value.boxed_value()}});
+    this->internal = std::move(copy);
+    this->shares_literal = false;
+  }
+  return *this->internal;
+}
+
+JSValue JSObject::get_property(const JSValue &key,
+                               const JSValue &parent) {
   auto v = this->get_property_from_list(*this->internal, key, parent);
   if (v.has_value()) {
     return v.value();
@@ -231,47 +970,28 @@ JSValue JSObject::get_property(const JSValue key, JSValue parent) {
           }));
 }
 
-JSFunction::JSFunction(ExternFunc f) : JSBase(), internal{f} {};
-
-JSValue JSFunction::call(JSValue thisArg, std::vector<JSValue> &args) {
-  return this->internal(thisArg, args);
-}
-
-JSGeneratorAdapter JSGeneratorAdapter::promise_type::get_return_object() {
-  return {.h = std::experimental::coroutine_handle<promise_type>::from_promise(
-              *this)};
-}
-
-std::experimental::suspend_never
-JSGeneratorAdapter::promise_type::initial_suspend() {
-  return {};
-}
-
-std::experimental::suspend_never
-JSGeneratorAdapter::promise_type::final_suspend() noexcept {
-  return {};
-}
+JSFunction::JSFunction(ExternFuncPtr f) : JSBase(), native{f} {};
 
-void JSGeneratorAdapter::promise_type::return_void() noexcept {
-  this->value = std::nullopt;
-}
+JSFunction::JSFunction(JSClosureCode code, shared_ptr<void> env)
+    : JSBase(), code{code}, env{std::move(env)} {};
 
-void JSGeneratorAdapter::promise_type::unhandled_exception() {
-  auto ptr = std::current_exception();
-  if (ptr) {
-    std::rethrow_exception(ptr);
-  }
+JSValue JSFunction::call(JSValue thisArg, std::vector<JSValue> &args) const {
+  // The rest of a statement that threw in status mode mustn’t run JS code.
+  if (js_has_pending_exception())
+    return JSValue::undefined();
+  if (this->native)
+    return this->native(thisArg, args);
+  // The call may overwrite the value this function is stored in, so hold on
+  // to the environment until it returns.
+  shared_ptr<void> env = this->env;
+  return this->code(env, thisArg, args);
 }
 
-std::experimental::suspend_always
-JSGeneratorAdapter::promise_type::yield_value(JSValue value) {
-  this->value =
-      std::optional<shared_ptr<JSValue>>{std::make_shared<JSValue>(value)};
-  return {};
+const JSValue &js_iterator_symbol() {
+  static const JSValue symbol = JSValue::new_object({});
+  return symbol;
 }
 
-JSValue iterator_symbol = JSValue::new_object({});
-
 JSIterator::JSIterator() : JSIterator{JSValue::undefined()} {}
 
 JSIterator::JSIterator(JSValue val) : it{std::make_shared<JSValue>(val)} {}
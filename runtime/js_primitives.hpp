@@ -22,10 +22,10 @@ class JSBase {
 public:
   JSBase();
 
-  virtual JSValue get_property(JSValue key, JSValue parent);
+  virtual JSValue get_property(const JSValue &key, const JSValue &parent);
   virtual optional<JSValue>
   get_property_from_list(const std::vector<std::pair<JSValue, JSValue>> &list,
-                         JSValue key, JSValue parent);
+                         const JSValue &key, const JSValue &parent);
 
   std::vector<std::pair<JSValue, JSValue>> properties;
 };
@@ -47,23 +47,89 @@ class JSString : public JSBase {
 public:
   JSString(const char *v);
   JSString(std::string v);
+
+  virtual JSValue get_property(const JSValue &key, const JSValue &parent);
+
   std::string internal;
+
+  static JSValue split_impl(JSValue thisArg, std::vector<JSValue> &args);
+  static JSValue index_of_impl(JSValue thisArg, std::vector<JSValue> &args);
+  static JSValue includes_impl(JSValue thisArg, std::vector<JSValue> &args);
+  static JSValue starts_with_impl(JSValue thisArg, std::vector<JSValue> &args);
+  static JSValue slice_impl(JSValue thisArg, std::vector<JSValue> &args);
+  static JSValue trim_impl(JSValue thisArg, std::vector<JSValue> &args);
+  static JSValue replace_impl(JSValue thisArg, std::vector<JSValue> &args);
+  static JSValue match_impl(JSValue thisArg, std::vector<JSValue> &args);
+};
+
+// The elements of an array. As long as an array has only ever held numbers,
+// they are stored as packed doubles. Storing anything else converts the array
+// to boxed values for good.
+class JSArrayStorage {
+public:
+  enum class Kind : char { PACKED_DOUBLES, GENERIC };
+
+  size_t size() const;
+  JSValue get(size_t idx) const;
+  // Stores `value` at `idx`, filling any gap with `undefined`.
+  void set(size_t idx, JSValue value);
+  void push_back(JSValue value);
+  // Appends the elements `begin` to `end` of another array.
+  void append(const JSArrayStorage &other, size_t begin, size_t end);
+  void insert(size_t idx, std::vector<JSValue>::const_iterator first,
+              std::vector<JSValue>::const_iterator last);
+  void erase(size_t begin, size_t end);
+  void resize(size_t size);
+  void reserve(size_t size);
+  void clear();
+
+  Kind kind = Kind::PACKED_DOUBLES;
+  // Only used while `kind` is `PACKED_DOUBLES`.
+  std::vector<double> doubles;
+  // Only used once `kind` is `GENERIC`.
+  std::vector<JSValue> values;
+
+private:
+  void make_generic();
 };
 
 class JSArray : public JSBase {
 public:
   JSArray();
   JSArray(std::vector<JSValue> data);
+  // Shares the elements of a constant literal until it is written to.
+  explicit JSArray(shared_ptr<JSArrayStorage> literal);
 
-  virtual JSValue get_property(JSValue key, JSValue parent);
+  virtual JSValue get_property(const JSValue &key, const JSValue &parent);
+  JSValue set_property(const JSValue &key, JSValue value,
+                       const JSValue &parent);
+  // The elements, for changing them. Copies a literal’s elements first.
+  JSArrayStorage &writable_storage();
 
-  shared_ptr<std::vector<JSValue>> internal;
+  shared_ptr<JSArrayStorage> internal;
+  bool shares_literal = false;
 
   static JSValue push_impl(JSValue thisArg, std::vector<JSValue> &args);
   static JSValue map_impl(JSValue thisArg, std::vector<JSValue> &args);
   static JSValue join_impl(JSValue thisArg, std::vector<JSValue> &args);
   static JSValue reduce_impl(JSValue thisArg, std::vector<JSValue> &args);
   static JSValue filter_impl(JSValue thisArg, std::vector<JSValue> &args);
+  static JSValue sort_impl(JSValue thisArg, std::vector<JSValue> &args);
+  static JSValue slice_impl(JSValue thisArg, std::vector<JSValue> &args);
+  static JSValue concat_impl(JSValue thisArg, std::vector<JSValue> &args);
+  static JSValue splice_impl(JSValue thisArg, std::vector<JSValue> &args);
+  static JSValue index_of_impl(JSValue thisArg, std::vector<JSValue> &args);
+  static JSValue includes_impl(JSValue thisArg, std::vector<JSValue> &args);
+  // `(a, b) => a - b` and `(a, b) => b - a`, which `sort` recognizes.
+  static JSValue numeric_ascending_impl(JSValue thisArg,
+                                        std::vector<JSValue> &args);
+  static JSValue numeric_descending_impl(JSValue thisArg,
+                                         std::vector<JSValue> &args);
+  static JSValue parallel_map_impl(JSValue thisArg, std::vector<JSValue> &args);
+  static JSValue parallel_filter_impl(JSValue thisArg,
+                                      std::vector<JSValue> &args);
+  static JSValue parallel_reduce_impl(JSValue thisArg,
+                                      std::vector<JSValue> &args);
   static JSValue iterator_impl(JSValue thisArg, std::vector<JSValue> &args);
 };
 
@@ -71,40 +137,38 @@ class JSObject : public JSBase {
 public:
   JSObject();
   JSObject(std::vector<std::pair<JSValue, JSValue>> data);
+  // Shares the properties of a constant literal until it is written to.
+  explicit JSObject(
+      shared_ptr<std::vector<std::pair<JSValue, JSValue>>> literal);
 
-  virtual JSValue get_property(JSValue key, JSValue parent);
+  virtual JSValue get_property(const JSValue &key, const JSValue &parent);
+  // The properties, for changing them. Copies a literal’s properties first.
+  std::vector<std::pair<JSValue, JSValue>> &writable_properties();
 
   shared_ptr<std::vector<std::pair<JSValue, JSValue>>> internal;
+  bool shares_literal = false;
 };
 
-using ExternFunc = std::function<JSValue(JSValue, std::vector<JSValue> &)>;
 using ExternFuncPtr = JSValue (*)(JSValue, std::vector<JSValue> &);
+using JSClosureCode = JSValue (*)(const shared_ptr<void> &env, JSValue thisArg,
+                                  std::vector<JSValue> &args);
+// Either a plain C++ function or a closure: code plus the environment it
+// captured. Copies share the environment, so copying a function is cheap.
 class JSFunction : public JSBase {
 
 public:
-  JSFunction(ExternFunc f);
-  ExternFunc internal;
-
-  JSValue call(JSValue thisArg, std::vector<JSValue> &);
-};
-
-struct JSGeneratorAdapter {
-  struct promise_type {
-    JSGeneratorAdapter get_return_object();
-    std::experimental::suspend_never initial_suspend();
-    std::experimental::suspend_never final_suspend() noexcept;
-    void return_void() noexcept;
-    void unhandled_exception();
-
-    std::experimental::suspend_always yield_value(JSValue value);
+  JSFunction(ExternFuncPtr f);
+  JSFunction(JSClosureCode code, shared_ptr<void> env);
 
-    optional<std::shared_ptr<JSValue>> value;
-  };
+  JSValue call(JSValue thisArg, std::vector<JSValue> &) const;
 
-  std::experimental::coroutine_handle<promise_type> h;
+  ExternFuncPtr native = nullptr;
+  JSClosureCode code = nullptr;
+  shared_ptr<void> env;
 };
 
-extern JSValue iterator_symbol;
+// `Symbol.iterator`, created on first use.
+const JSValue &js_iterator_symbol();
 
 class JSIterator {
 public:
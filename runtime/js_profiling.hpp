@@ -0,0 +1,23 @@
+#pragma once
+
+#include <vector>
+
+#include "js_value.hpp"
+
+// Generated lambdas all end up as anonymous `{lambda(...)#N}` symbols. In
+// `--profile` builds the transpiler wraps every JS function in a
+// `JSNamedFunction` tagged with a local `js_<name>_L<line>` struct, so the
+// function shows up under a stable, readable symbol in `perf report`.
+template <typename Name, typename F> struct JSNamedFunction {
+  F f;
+
+  __attribute__((noinline)) auto operator()(JSValue thisArg,
+                                            std::vector<JSValue> &args) {
+    return f(thisArg, args);
+  }
+};
+
+template <typename Name, typename F>
+JSNamedFunction<Name, F> js_named_function(F f) {
+  return {f};
+}
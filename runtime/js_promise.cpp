@@ -0,0 +1,197 @@
+#include "js_promise.hpp"
+
+#include "event_loop.hpp"
+#include "exceptions.hpp"
+
+void JSPromiseState::resolve(JSValue value) {
+  if (this->resolved)
+    return;
+  this->resolved = true;
+  if (value.type() == JSValueType::OBJECT) {
+    JSValue then = value["then"];
+    if (then.type() == JSValueType::FUNCTION) {
+      auto self = this->shared_from_this();
+      js_enqueue_microtask([=]() mutable {
+        auto adopted = std::make_shared<JSPromiseState>();
+        std::vector<JSValue> args{
+            JSValue::new_function(
+                [=](JSValue thisArg, std::vector<JSValue> &args) -> JSValue {
+                  adopted->resolve(args.size() > 0 ? args[0]
+                                                   : JSValue::undefined());
+                  return JSValue::undefined();
+                }),
+            JSValue::new_function(
+                [=](JSValue thisArg, std::vector<JSValue> &args) -> JSValue {
+                  adopted->reject(args.size() > 0 ? args[0]
+                                                  : JSValue::undefined());
+                  return JSValue::undefined();
+                })};
+        adopted->on_settled(
+            [=]() { self->settle(adopted->status, adopted->result); });
+#ifdef FEATURE_EXCEPTIONS
+        try {
+          then.apply(value, args);
+        } catch (JSValue e) {
+          adopted->reject(e);
+        }
+#elif defined(FEATURE_STATUS_EXCEPTIONS)
+        then.apply(value, args);
+        if (js_has_pending_exception())
+          adopted->reject(js_take_pending_exception());
+#else
+        then.apply(value, args);
+#endif
+      });
+      return;
+    }
+  }
+  this->settle(Status::FULFILLED, value);
+}
+
+void JSPromiseState::fulfill(JSValue value) {
+  if (this->resolved)
+    return;
+  this->resolved = true;
+  this->settle(Status::FULFILLED, value);
+}
+
+void JSPromiseState::reject(JSValue reason) {
+  if (this->resolved)
+    return;
+  this->resolved = true;
+  this->settle(Status::REJECTED, reason);
+}
+
+void JSPromiseState::on_settled(std::function<void()> callback) {
+  if (this->status == Status::PENDING) {
+    this->callbacks.push_back(std::move(callback));
+  } else {
+    js_enqueue_microtask(std::move(callback));
+  }
+}
+
+void JSPromiseState::settle(Status status, JSValue result) {
+  this->status = status;
+  this->result = result;
+  for (auto &callback : this->callbacks) {
+    js_enqueue_microtask(std::move(callback));
+  }
+  this->callbacks.clear();
+}
+
+static JSValue promise_then(std::shared_ptr<JSPromiseState> state,
+                            JSValue on_fulfilled, JSValue on_rejected) {
+  auto derived = std::make_shared<JSPromiseState>();
+  state->on_settled([=]() mutable {
+    bool fulfilled = state->status == JSPromiseState::Status::FULFILLED;
+    JSValue handler = fulfilled ? on_fulfilled : on_rejected;
+    if (handler.type() != JSValueType::FUNCTION) {
+      if (fulfilled) {
+        derived->fulfill(state->result);
+      } else {
+        derived->reject(state->result);
+      }
+      return;
+    }
+#ifdef FEATURE_EXCEPTIONS
+    try {
+      derived->resolve(handler({state->result}));
+    } catch (JSValue e) {
+      derived->reject(e);
+    }
+#elif defined(FEATURE_STATUS_EXCEPTIONS)
+    JSValue result = handler({state->result});
+    if (js_has_pending_exception())
+      derived->reject(js_take_pending_exception());
+    else
+      derived->resolve(result);
+#else
+    derived->resolve(handler({state->result}));
+#endif
+  });
+  return js_promise_object(derived);
+}
+
+JSValue js_promise_object(std::shared_ptr<JSPromiseState> state) {
+  return JSValue::new_object(
+      {{JSValue{"then"},
+        JSValue::new_function(
+            [=](JSValue thisArg, std::vector<JSValue> &args) -> JSValue {
+              return promise_then(
+                  state, args.size() > 0 ? args[0] : JSValue::undefined(),
+                  args.size() > 1 ? args[1] : JSValue::undefined());
+            })},
+       {JSValue{"catch"},
+        JSValue::new_function(
+            [=](JSValue thisArg, std::vector<JSValue> &args) -> JSValue {
+              return promise_then(
+                  state, JSValue::undefined(),
+                  args.size() > 0 ? args[0] : JSValue::undefined());
+            })}});
+}
+
+bool JSAwaiter::await_ready() const noexcept { return false; }
+
+void JSAwaiter::await_suspend(std::experimental::coroutine_handle<> h) {
+  this->state->on_settled([h]() mutable { h.resume(); });
+}
+
+JSValue JSAwaiter::await_resume() {
+  if (this->state->status == JSPromiseState::Status::REJECTED) {
+    return js_throw(this->state->result);
+  }
+  return this->state->result;
+}
+
+JSAsyncAdapter::promise_type::promise_type()
+    : state{std::make_shared<JSPromiseState>()} {
+  this->state->frame_alive = true;
+}
+
+JSAsyncAdapter::promise_type::~promise_type() {
+  this->state->frame_alive = false;
+  this->state->keep_alive.reset();
+}
+
+JSAsyncAdapter JSAsyncAdapter::promise_type::get_return_object() {
+  return {.state = this->state};
+}
+
+std::experimental::suspend_never
+JSAsyncAdapter::promise_type::initial_suspend() {
+  return {};
+}
+
+std::experimental::suspend_never
+JSAsyncAdapter::promise_type::final_suspend() noexcept {
+  return {};
+}
+
+// In status mode, a function that threw returns through here too.
+void JSAsyncAdapter::promise_type::return_value(JSValue value) {
+  if (js_has_pending_exception()) {
+#ifdef FEATURE_STATUS_EXCEPTIONS
+    this->state->reject(js_take_pending_exception());
+#endif
+    return;
+  }
+  this->state->resolve(value);
+}
+
+void JSAsyncAdapter::promise_type::unhandled_exception() {
+#ifdef FEATURE_EXCEPTIONS
+  try {
+    throw;
+  } catch (JSValue e) {
+    this->state->reject(e);
+  }
+#else
+  std::terminate();
+#endif
+}
+
+JSAwaiter JSAsyncAdapter::promise_type::await_transform(JSValue value) {
+  auto awaited = std::make_shared<JSPromiseState>();
+  awaited->resolve(value);
+  return {.state = awaited};
+}
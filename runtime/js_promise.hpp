@@ -0,0 +1,66 @@
+#pragma once
+
+#include <experimental/coroutine>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "js_value.hpp"
+
+// The state behind a JS promise. Reactions always run as microtasks.
+class JSPromiseState : public std::enable_shared_from_this<JSPromiseState> {
+public:
+  enum class Status { PENDING, FULFILLED, REJECTED };
+
+  // Fulfills the promise, or adopts the state of `value` if it is a thenable.
+  void resolve(JSValue value);
+  void fulfill(JSValue value);
+  void reject(JSValue reason);
+  // Runs `callback` as a microtask once the promise has settled.
+  void on_settled(std::function<void()> callback);
+
+  Status status = Status::PENDING;
+  JSValue result;
+
+  // Set while an async function’s coroutine frame is alive. The frame refers
+  // to the captures of the callable it was started from, so that callable is
+  // kept alive alongside it.
+  bool frame_alive = false;
+  std::shared_ptr<void> keep_alive;
+
+private:
+  void settle(Status status, JSValue result);
+
+  bool resolved = false;
+  std::vector<std::function<void()>> callbacks;
+};
+
+// Creates the JS-visible promise object (with `then` and `catch`) for `state`.
+JSValue js_promise_object(std::shared_ptr<JSPromiseState> state);
+
+struct JSAwaiter {
+  bool await_ready() const noexcept;
+  void await_suspend(std::experimental::coroutine_handle<> h);
+  JSValue await_resume();
+
+  std::shared_ptr<JSPromiseState> state;
+};
+
+struct JSAsyncAdapter {
+  struct promise_type {
+    promise_type();
+    ~promise_type();
+
+    JSAsyncAdapter get_return_object();
+    std::experimental::suspend_never initial_suspend();
+    std::experimental::suspend_never final_suspend() noexcept;
+    void return_value(JSValue value);
+    void unhandled_exception();
+
+    JSAwaiter await_transform(JSValue value);
+
+    std::shared_ptr<JSPromiseState> state;
+  };
+
+  std::shared_ptr<JSPromiseState> state;
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Only builds with FEATURE_THREADS share values between threads, so only they
+// pay for atomic reference counting.
+#ifdef FEATURE_THREADS
+using JSRefCount = std::atomic<size_t>;
+
+inline void js_ref_retain(JSRefCount &count) {
+  count.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline bool js_ref_release(JSRefCount &count) {
+  return count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+}
+#else
+using JSRefCount = size_t;
+
+inline void js_ref_retain(JSRefCount &count) { count++; }
+
+inline bool js_ref_release(JSRefCount &count) { return --count == 0; }
+#endif
+
+#ifdef FEATURE_HEAP_PROFILE
+// Identifies the type a cell holds, without needing RTTI.
+template <typename T> inline const char js_heap_type_id = 0;
+
+// Heap-profiling builds register every live cell, along with the JS source
+// location that allocated it, so that `js_heap_snapshot` can walk the heap.
+struct JSHeapCell {
+  const void *type;
+  const void *value;
+  const JSRefCount *count;
+  size_t size;
+  const char *site;
+  JSHeapCell *prev;
+  JSHeapCell *next;
+};
+
+void js_heap_register(JSHeapCell &cell);
+void js_heap_unregister(JSHeapCell &cell);
+#endif
+
+// A reference-counted handle to a heap cell holding a `T`. Unlike
+// `std::shared_ptr`, the count lives in the cell itself, so a handle is a
+// single pointer and creating one takes a single allocation.
+template <typename T> class JSRef {
+  struct Cell {
+    template <typename... Args>
+    explicit Cell(Args &&...args) : value{std::forward<Args>(args)...} {}
+
+    JSRefCount count{1};
+    T value;
+#ifdef FEATURE_HEAP_PROFILE
+    JSHeapCell heap;
+#endif
+  };
+
+public:
+  JSRef() = default;
+  JSRef(const JSRef &other) : cell{other.cell} {
+    if (this->cell)
+      js_ref_retain(this->cell->count);
+  }
+  JSRef(JSRef &&other) noexcept : cell{other.cell} { other.cell = nullptr; }
+  ~JSRef() { this->reset(); }
+
+  JSRef &operator=(const JSRef &other) {
+    JSRef{other}.swap(*this);
+    return *this;
+  }
+  JSRef &operator=(JSRef &&other) noexcept {
+    JSRef{std::move(other)}.swap(*this);
+    return *this;
+  }
+
+  template <typename... Args> static JSRef make(Args &&...args) {
+    JSRef ref;
+    ref.cell = new Cell{std::forward<Args>(args)...};
+#ifdef FEATURE_HEAP_PROFILE
+    ref.cell->heap = {&js_heap_type_id<T>, &ref.cell->value, &ref.cell->count,
+                      sizeof(Cell)};
+    js_heap_register(ref.cell->heap);
+#endif
+    return ref;
+  }
+
+  void reset() {
+    if (this->cell && js_ref_release(this->cell->count)) {
+#ifdef FEATURE_HEAP_PROFILE
+      js_heap_unregister(this->cell->heap);
+#endif
+      delete this->cell;
+    }
+    this->cell = nullptr;
+  }
+  void swap(JSRef &other) noexcept { std::swap(this->cell, other.cell); }
+
+  T *get() const { return this->cell ? &this->cell->value : nullptr; }
+  T &operator*() const { return this->cell->value; }
+  T *operator->() const { return &this->cell->value; }
+  explicit operator bool() const { return this->cell != nullptr; }
+
+  bool operator==(const JSRef &other) const { return this->cell == other.cell; }
+  bool operator!=(const JSRef &other) const { return this->cell != other.cell; }
+
+private:
+  Cell *cell = nullptr;
+};
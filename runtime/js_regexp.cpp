@@ -0,0 +1,228 @@
+#include "js_regexp.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#include "exceptions.hpp"
+
+static const std::vector<std::pair<JSValue, JSValue>> &regexp_prototype() {
+  static const std::vector<std::pair<JSValue, JSValue>> prototype{
+      {JSValue{"test"}, JSValue::new_function(&JSRegExp::test_impl)},
+      {JSValue{"exec"}, JSValue::new_function(&JSRegExp::exec_impl)},
+  };
+  return prototype;
+}
+
+JSRegExp::JSRegExp(const JSRegExpPattern *pattern)
+    : JSObject(), pattern{pattern},
+      global{strchr(pattern->flags, 'g') != nullptr},
+      sticky{strchr(pattern->flags, 'y') != nullptr}, last_index{0.0} {
+  this->internal->push_back({JSValue{"lastIndex"}, this->last_index});
+  this->internal->push_back({JSValue{"source"}, JSValue{pattern->source}});
+  this->internal->push_back({JSValue{"flags"}, JSValue{pattern->flags}});
+  this->internal->push_back({JSValue{"global"}, JSValue{this->global}});
+}
+
+JSValue JSRegExp::create(const JSRegExpPattern *pattern) {
+  return JSValue{std::shared_ptr<JSObject>{new JSRegExp{pattern}}};
+}
+
+JSValue JSRegExp::get_property(const JSValue &key,
+                               const JSValue &parent) {
+  if (auto own = this->get_property_from_list(*this->internal, key, parent))
+    return *own;
+  if (auto method =
+          this->get_property_from_list(regexp_prototype(), key, parent))
+    return *method;
+  return JSObject::get_property(key, parent);
+}
+
+void JSRegExp::set_last_index(size_t idx) {
+  *this->last_index.value = *JSValue{static_cast<double>(idx)}.value;
+}
+
+bool JSRegExp::exec(const std::string &input, std::vector<size_t> &captures) {
+  captures.assign(2 * this->pattern->group_count, std::string_view::npos);
+  size_t from = 0;
+  if (this->global || this->sticky) {
+    double last_index = this->last_index.coerce_to_double();
+    if (last_index > input.size()) {
+      this->set_last_index(0);
+      return false;
+    }
+    from = last_index > 0 ? static_cast<size_t>(last_index) : 0;
+  }
+  bool found = this->pattern->exec(input, from, captures.data());
+  if (this->global || this->sticky)
+    this->set_last_index(found ? captures[1] : 0);
+  return found;
+}
+
+JSRegExp *js_as_regexp(const JSValue &v) {
+  if (v.type() != JSValueType::OBJECT)
+    return nullptr;
+  return dynamic_cast<JSRegExp *>(
+      std::get<JSValueType::OBJECT>(*v.value).get());
+}
+
+static std::string group(const std::string &input,
+                         const std::vector<size_t> &captures, size_t idx) {
+  return input.substr(captures[2 * idx],
+                      captures[2 * idx + 1] - captures[2 * idx]);
+}
+
+static bool has_group(const std::vector<size_t> &captures, size_t idx) {
+  return captures[2 * idx] != std::string_view::npos &&
+         captures[2 * idx + 1] != std::string_view::npos;
+}
+
+// The array `exec` returns: the match, then every group, with `index` and
+// `input` properties.
+static JSValue match_result(const std::string &input,
+                            const std::vector<size_t> &captures) {
+  JSArray result_arr{};
+  for (size_t i = 0; i < captures.size() / 2; i++) {
+    result_arr.internal->push_back(has_group(captures, i)
+                                       ? JSValue{group(input, captures, i)}
+                                       : JSValue::undefined());
+  }
+  result_arr.properties.push_back(
+      {JSValue{"index"}, JSValue{static_cast<double>(captures[0])}});
+  result_arr.properties.push_back({JSValue{"input"}, JSValue{input}});
+  return JSValue{result_arr};
+}
+
+JSValue JSRegExp::test_impl(JSValue thisArg, std::vector<JSValue> &args) {
+  JSRegExp *re = js_as_regexp(thisArg);
+  if (re == nullptr)
+    return js_throw(JSValue{"Called test on non-regexp"});
+  std::string input =
+      args.size() > 0 ? args[0].coerce_to_string() : "undefined";
+  if (re->pattern->test != nullptr)
+    return JSValue{re->pattern->test(input)};
+  std::vector<size_t> captures;
+  return JSValue{re->exec(input, captures)};
+}
+
+// There is no `null`, so failed matches return `undefined`.
+JSValue JSRegExp::exec_impl(JSValue thisArg, std::vector<JSValue> &args) {
+  JSRegExp *re = js_as_regexp(thisArg);
+  if (re == nullptr)
+    return js_throw(JSValue{"Called exec on non-regexp"});
+  std::string input =
+      args.size() > 0 ? args[0].coerce_to_string() : "undefined";
+  std::vector<size_t> captures;
+  if (!re->exec(input, captures))
+    return JSValue::undefined();
+  return match_result(input, captures);
+}
+
+// Continues a global search after an empty match one byte further on.
+static void skip_empty_match(JSRegExp &re,
+                             const std::vector<size_t> &captures) {
+  if (captures[0] == captures[1])
+    re.set_last_index(captures[1] + 1);
+}
+
+JSValue js_regexp_match(JSRegExp &re, const std::string &input) {
+  std::vector<size_t> captures;
+  if (!re.global) {
+    if (!re.exec(input, captures))
+      return JSValue::undefined();
+    return match_result(input, captures);
+  }
+  re.set_last_index(0);
+  JSArray matches{};
+  while (re.exec(input, captures)) {
+    matches.internal->push_back(JSValue{group(input, captures, 0)});
+    skip_empty_match(re, captures);
+  }
+  if (matches.internal->size() == 0)
+    return JSValue::undefined();
+  return JSValue{matches};
+}
+
+JSValue js_regexp_replace(JSRegExp &re, JSValue input, JSValue replacement) {
+  const std::string &str = std::get<JSValueType::STRING>(*input.value).internal;
+  bool use_function = replacement.type() == JSValueType::FUNCTION;
+  std::string replacement_str =
+      use_function ? "" : replacement.coerce_to_string();
+  if (re.global)
+    re.set_last_index(0);
+
+  std::string result;
+  size_t copied = 0;
+  std::vector<size_t> captures;
+  while (re.exec(str, captures)) {
+    result.append(str, copied, captures[0] - copied);
+    if (use_function) {
+      // The function gets the match, every group, the offset and the input.
+      std::vector<JSValue> args;
+      for (size_t i = 0; i < captures.size() / 2; i++) {
+        args.push_back(has_group(captures, i)
+                           ? JSValue{group(str, captures, i)}
+                           : JSValue::undefined());
+      }
+      args.push_back(JSValue{static_cast<double>(captures[0])});
+      args.push_back(input);
+      result += replacement(args).coerce_to_string();
+    } else {
+      js_append_substitution(result, replacement_str, str, captures.data(),
+                             re.pattern->group_count);
+    }
+    copied = captures[1];
+    if (!re.global)
+      break;
+    skip_empty_match(re, captures);
+  }
+  result.append(str, copied);
+  return JSValue{result};
+}
+
+void js_append_substitution(std::string &out, const std::string &replacement,
+                            const std::string &input, const size_t *captures,
+                            size_t group_count) {
+  for (size_t i = 0; i < replacement.size(); i++) {
+    char c = replacement[i];
+    if (c != '$' || i + 1 == replacement.size()) {
+      out += c;
+      continue;
+    }
+    char next = replacement[i + 1];
+    if (next == '$') {
+      out += '$';
+    } else if (next == '&') {
+      out.append(input, captures[0], captures[1] - captures[0]);
+    } else if (next == '`') {
+      out.append(input, 0, captures[0]);
+    } else if (next == '\'') {
+      out.append(input, captures[1]);
+    } else if (next >= '0' && next <= '9') {
+      // Two digits take precedence if they name a group.
+      size_t idx = next - '0';
+      size_t length = 1;
+      if (i + 2 < replacement.size() && replacement[i + 2] >= '0' &&
+          replacement[i + 2] <= '9') {
+        size_t two_digits = idx * 10 + (replacement[i + 2] - '0');
+        if (two_digits >= 1 && two_digits < group_count) {
+          idx = two_digits;
+          length = 2;
+        }
+      }
+      if (idx == 0 || idx >= group_count) {
+        out += c;
+        continue;
+      }
+      if (captures[2 * idx] != std::string_view::npos &&
+          captures[2 * idx + 1] != std::string_view::npos)
+        out.append(input, captures[2 * idx],
+                   captures[2 * idx + 1] - captures[2 * idx]);
+      i += length;
+      continue;
+    } else {
+      out += c;
+      continue;
+    }
+    i++;
+  }
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "js_value.hpp"
+
+// An entry on the backtracking stack of a generated matcher: either a choice
+// to try later or a change to undo before trying it.
+struct JSRegExpFrame {
+  enum Kind {
+    // Continue with `state` at `a`, with `b` as the state’s `aux` value.
+    RESUME,
+    // Continue with `state` at `b`, then at every position down to `a`.
+    BYTES,
+    // Restore capture slot `state` to `a`.
+    CAPTURE,
+    // Restore the count and start of loop `state` to `a` and `b`.
+    LOOP,
+  } kind;
+  size_t state;
+  size_t a;
+  size_t b;
+};
+
+// State of the generated matcher of one pattern while it tries to match at a
+// position.
+struct JSRegExpState {
+  std::string_view input;
+  // Start and end offset of every group, `npos` while unset.
+  size_t *captures;
+  // Iteration count and start of the current iteration of every quantified
+  // subpattern that isn’t a single character.
+  size_t *counts;
+  size_t *starts;
+  std::vector<JSRegExpFrame> stack;
+};
+
+// Undoes the changes since the most recent choice and returns the state to
+// continue with, or `npos` when there are no choices left.
+inline size_t js_regexp_backtrack(JSRegExpState &st, size_t &pos,
+                                  size_t &aux) {
+  while (!st.stack.empty()) {
+    JSRegExpFrame &frame = st.stack.back();
+    size_t state = frame.state;
+    switch (frame.kind) {
+    case JSRegExpFrame::RESUME:
+      pos = frame.a;
+      aux = frame.b;
+      st.stack.pop_back();
+      return state;
+    case JSRegExpFrame::BYTES:
+      pos = frame.b;
+      if (frame.b == frame.a) {
+        st.stack.pop_back();
+      } else {
+        frame.b--;
+      }
+      return state;
+    case JSRegExpFrame::CAPTURE:
+      st.captures[state] = frame.a;
+      break;
+    case JSRegExpFrame::LOOP:
+      st.counts[state] = frame.a;
+      st.starts[state] = frame.b;
+      break;
+    }
+    st.stack.pop_back();
+  }
+  return std::string_view::npos;
+}
+
+// A regular expression literal, compiled by the transpiler.
+struct JSRegExpPattern {
+  const char *source;
+  const char *flags;
+  // Number of capturing groups, plus one for the whole match.
+  size_t group_count;
+  // Finds the first match at or after `from`, filling `captures` with
+  // `2 * group_count` offsets.
+  bool (*exec)(std::string_view input, size_t from, size_t *captures);
+  // A DFA that decides whether there is any match, for patterns without the
+  // `g` and `y` flags that allow one, or `nullptr`.
+  bool (*test)(std::string_view input);
+};
+
+inline bool js_regexp_word_boundary(std::string_view input, size_t pos) {
+  auto is_word = [&](size_t idx) {
+    unsigned char c = input[idx];
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+           (c >= 'A' && c <= 'Z') || c == '_';
+  };
+  bool before = pos > 0 && is_word(pos - 1);
+  bool after = pos < input.size() && is_word(pos);
+  return before != after;
+}
+
+class JSRegExp : public JSObject {
+public:
+  explicit JSRegExp(const JSRegExpPattern *pattern);
+  static JSValue create(const JSRegExpPattern *pattern);
+
+  virtual JSValue get_property(const JSValue &key, const JSValue &parent);
+
+  // Runs the pattern on `input`. Global and sticky patterns start at and
+  // update `lastIndex`.
+  bool exec(const std::string &input, std::vector<size_t> &captures);
+  void set_last_index(size_t idx);
+
+  const JSRegExpPattern *pattern;
+  bool global;
+  bool sticky;
+  // Shares its box with the `lastIndex` property.
+  JSValue last_index;
+
+  static JSValue test_impl(JSValue thisArg, std::vector<JSValue> &args);
+  static JSValue exec_impl(JSValue thisArg, std::vector<JSValue> &args);
+};
+
+// The regular expression `v` holds, or `nullptr`.
+JSRegExp *js_as_regexp(const JSValue &v);
+
+JSValue js_regexp_match(JSRegExp &re, const std::string &input);
+JSValue js_regexp_replace(JSRegExp &re, JSValue input, JSValue replacement);
+
+// Appends `replacement` for a match, expanding `$$`, `$&`, `` $` ``, `$'`
+// and `$n`.
+void js_append_substitution(std::string &out, const std::string &replacement,
+                            const std::string &input, const size_t *captures,
+                            size_t group_count);
@@ -0,0 +1,91 @@
+#include "js_template.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Writes the decimal digits of `n` and returns their count.
+static size_t format_integer(uint64_t n, char *out) {
+  char digits[20];
+  size_t count = 0;
+  do {
+    digits[count++] = '0' + n % 10;
+    n /= 10;
+  } while (n > 0);
+  for (size_t i = 0; i < count; i++)
+    out[i] = digits[count - 1 - i];
+  return count;
+}
+
+size_t js_format_number(double v, char *out) {
+  double magnitude = std::fabs(v);
+  uint64_t whole, fraction_digits;
+  if (magnitude < 1e15 && magnitude == std::floor(magnitude)) {
+    whole = static_cast<uint64_t>(magnitude);
+    fraction_digits = 0;
+  } else if (magnitude < 1e8) {
+    // Below 1e14 the product is off by less than 1/128, so rounding it is
+    // exact unless it lies that close to a tie.
+    double product = magnitude * 1e6;
+    double floored = std::floor(product);
+    double fraction = product - floored;
+    if (std::fabs(fraction - 0.5) < 1.0 / 64)
+      return std::snprintf(out, JS_NUMBER_BUFFER_SIZE, "%f", v);
+    uint64_t scaled = static_cast<uint64_t>(floored) + (fraction > 0.5);
+    whole = scaled / 1000000;
+    fraction_digits = scaled % 1000000;
+  } else {
+    return std::snprintf(out, JS_NUMBER_BUFFER_SIZE, "%f", v);
+  }
+  size_t length = 0;
+  if (std::signbit(v))
+    out[length++] = '-';
+  length += format_integer(whole, out + length);
+  out[length++] = '.';
+  for (size_t i = 6; i-- > 0;) {
+    out[length + i] = '0' + fraction_digits % 10;
+    fraction_digits /= 10;
+  }
+  return length + 6;
+}
+
+// Upper bound for the length of a hole, exact for strings. Numbers on the
+// fast path and the fixed strings of other types stay below it.
+static size_t estimated_length(const JSValue &hole) {
+  if (hole.type() == JSValueType::STRING)
+    return std::get<JSValueType::STRING>(hole.boxed_value()).internal.size();
+  return 24;
+}
+
+JSValue js_template_literal(std::initializer_list<std::string_view> quasis,
+                            std::initializer_list<JSValue> holes) {
+  size_t length = 0;
+  for (std::string_view quasi : quasis)
+    length += quasi.size();
+  for (const JSValue &hole : holes)
+    length += estimated_length(hole);
+
+  std::string result;
+  result.reserve(length);
+  auto quasi = quasis.begin();
+  for (const JSValue &hole : holes) {
+    result.append(*quasi++);
+    switch (hole.type()) {
+    case JSValueType::STRING:
+      result += std::get<JSValueType::STRING>(hole.boxed_value()).internal;
+      break;
+    case JSValueType::NUMBER: {
+      char buffer[JS_NUMBER_BUFFER_SIZE];
+      double v = std::get<JSValueType::NUMBER>(hole.boxed_value()).internal;
+      result.append(buffer, js_format_number(v, buffer));
+      break;
+    }
+    default:
+      result.append(hole.coerce_to_string());
+    }
+  }
+  if (quasi != quasis.end())
+    result.append(*quasi);
+  return JSValue{std::move(result)};
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <initializer_list>
+#include <string_view>
+
+#include "js_value.hpp"
+
+// Enough room for any number `js_format_number` writes.
+constexpr size_t JS_NUMBER_BUFFER_SIZE = 352;
+
+// Writes `v` to `out` the way `std::to_string` does (`%f`), without
+// allocating. Returns the number of chars written.
+size_t js_format_number(double v, char *out);
+
+// `` `a${x}b${y}c` ``: the text between the holes and the holes' values. The
+// result is reserved once and each part appended in place.
+JSValue js_template_literal(std::initializer_list<std::string_view> quasis,
+                            std::initializer_list<JSValue> holes);
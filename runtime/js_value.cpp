@@ -1,54 +1,68 @@
 #include "js_value.hpp"
 #include "exceptions.hpp"
+#include "js_generator.hpp"
+#include "js_promise.hpp"
+#include "js_template.hpp"
 #include <cmath>
 
 JSValue::JSValue()
-    : value{new Box{std::in_place_index<JSValueType::UNDEFINED>,
-                    JSUndefined{}}} {};
+    : value{JSRef<Box>::make(std::in_place_index<JSValueType::UNDEFINED>,
+                             JSUndefined{})} {};
 
 JSValue::JSValue(bool v)
-    : value{new Box{std::in_place_index<JSValueType::BOOL>, JSBool{v}}},
+    : value{JSRef<Box>::make(std::in_place_index<JSValueType::BOOL>,
+                             JSBool{v})},
       parent_value{} {};
 
 JSValue::JSValue(JSBool v)
-    : value{new Box{std::in_place_index<JSValueType::BOOL>, v}},
+    : value{JSRef<Box>::make(std::in_place_index<JSValueType::BOOL>, v)},
       parent_value{} {};
 
 JSValue::JSValue(double v)
-    : value{new Box{std::in_place_index<JSValueType::NUMBER>, JSNumber{v}}},
+    : value{JSRef<Box>::make(std::in_place_index<JSValueType::NUMBER>,
+                             JSNumber{v})},
       parent_value{} {};
 
 JSValue::JSValue(JSNumber v)
-    : value{new Box{std::in_place_index<JSValueType::NUMBER>, v}},
+    : value{JSRef<Box>::make(std::in_place_index<JSValueType::NUMBER>, v)},
       parent_value{} {};
 
 JSValue::JSValue(const char *v)
-    : value{new Box{std::in_place_index<JSValueType::STRING>, JSString{v}}},
+    : value{JSRef<Box>::make(std::in_place_index<JSValueType::STRING>,
+                             JSString{v})},
       parent_value{} {};
 
 JSValue::JSValue(std::string v)
-    : value{new Box{std::in_place_index<JSValueType::STRING>, JSString{v}}},
+    : value{JSRef<Box>::make(std::in_place_index<JSValueType::STRING>,
+                             JSString{std::move(v)})},
       parent_value{} {};
 
 JSValue::JSValue(JSString v)
-    : value{new Box{std::in_place_index<JSValueType::STRING>, v}},
+    : value{JSRef<Box>::make(std::in_place_index<JSValueType::STRING>,
+                             std::move(v))},
       parent_value{} {};
 
 JSValue::JSValue(JSFunction v)
-    : value{new Box{std::in_place_index<JSValueType::FUNCTION>, v}},
+    : value{JSRef<Box>::make(std::in_place_index<JSValueType::FUNCTION>,
+                             std::move(v))},
       parent_value{} {};
 
 JSValue::JSValue(JSObject v)
-    : value{new Box{std::in_place_index<JSValueType::OBJECT>,
-                    shared_ptr<JSObject>{new JSObject{v}}}},
+    : value{JSRef<Box>::make(std::in_place_index<JSValueType::OBJECT>,
+                             shared_ptr<JSObject>{new JSObject{v}})},
+      parent_value{} {};
+
+JSValue::JSValue(shared_ptr<JSObject> v)
+    : value{JSRef<Box>::make(std::in_place_index<JSValueType::OBJECT>, v)},
       parent_value{} {};
 
 JSValue::JSValue(JSArray v)
-    : value{new Box{std::in_place_index<JSValueType::ARRAY>,
-                    shared_ptr<JSArray>{new JSArray{v}}}},
+    : value{JSRef<Box>::make(std::in_place_index<JSValueType::ARRAY>,
+                             shared_ptr<JSArray>{new JSArray{v}})},
       parent_value{} {};
 
-JSValue::JSValue(Box v) : value{new Box{v}}, parent_value{} {};
+JSValue::JSValue(Box v)
+    : value{JSRef<Box>::make(std::move(v))}, parent_value{} {};
 
 JSValue JSValue::undefined() { return JSValue{}; }
 
@@ -60,37 +74,49 @@ JSValue JSValue::new_array(std::vector<JSValue> values) {
   return JSValue{JSArray{values}};
 }
 
-JSValue JSValue::new_function(ExternFunc f) { return JSValue{JSFunction{f}}; }
-
-JSValue JSValue::new_generator_function(CoroutineFunc gen_f) {
-  return JSValue::new_function([=](JSValue thisArg,
-                                   std::vector<JSValue> &args) mutable
-                               -> JSValue {
-    std::shared_ptr<std::optional<
-        std::experimental::coroutine_handle<JSGeneratorAdapter::promise_type>>>
-        corot =
-            std::make_shared<std::optional<std::experimental::coroutine_handle<
-                JSGeneratorAdapter::promise_type>>>(std::nullopt);
-    return JSValue::iterator_from_next_func(JSValue::new_function(
-        [corot, gen_f](JSValue thisArg,
-                       std::vector<JSValue> &args) mutable -> JSValue {
-          if (!corot->has_value()) {
-            *corot = std::optional{gen_f(thisArg, args).h};
-          } else {
-            corot->value()();
-          }
-          auto v = corot->value().promise().value;
-          return JSValue::new_object(
-              {{JSValue{"value"},
-                *v.value_or(std::make_shared<JSValue>(JSValue::undefined()))},
-               {JSValue{"done"}, JSValue{!v.has_value()}}});
-        }));
-  });
+JSValue JSValue::from_literal(const JSValue &literal) {
+  if (literal.type() == JSValueType::ARRAY)
+    return JSValue{
+        JSArray{std::get<JSValueType::ARRAY>(*literal.value)->internal}};
+  return JSValue{
+      JSObject{std::get<JSValueType::OBJECT>(*literal.value)->internal}};
+}
+
+JSValue JSValue::new_function(ExternFuncPtr f) {
+  return JSValue{JSFunction{f}};
+}
+
+JSValue JSValue::new_closure(JSClosureCode code, shared_ptr<void> env) {
+  return JSValue{JSFunction{code, std::move(env)}};
+}
+
+JSValue js_start_generator(JSGeneratorStart start, const shared_ptr<void> &env,
+                           JSValue thisArg, std::vector<JSValue> &args) {
+  auto gen = std::make_shared<JSGenerator>(start, env, thisArg, args);
+  return JSValue::iterator_from_next_func(JSValue::new_function(
+      [gen](JSValue thisArg, std::vector<JSValue> &args) mutable -> JSValue {
+        auto v = gen->resume();
+        bool done = !v.has_value();
+        return JSValue::new_object(
+            {{JSValue{"value"}, done ? JSValue::undefined() : std::move(*v)},
+             {JSValue{"done"}, JSValue{done}}});
+      }));
+}
+
+JSValue js_start_async(const shared_ptr<void> &env,
+                       shared_ptr<JSPromiseState> state) {
+  // A suspended coroutine frame refers to the captures in `env`, which must
+  // outlive it even if the function itself is gone.
+  if (state->frame_alive) {
+    state->keep_alive = env;
+  }
+  return js_promise_object(state);
 }
 
 JSValue &JSValue::operator++() {
   if (this->type() != JSValueType::NUMBER) {
     js_throw(JSValue{"Can’t ++ something that is not a number"});
+    return *this;
   }
   this->get_number() = this->get_number() + 1.0;
   return *this;
@@ -98,7 +124,7 @@ JSValue &JSValue::operator++() {
 
 JSValue JSValue::operator++(int) {
   if (this->type() != JSValueType::NUMBER) {
-    js_throw(JSValue{"Can’t ++ something that is not a number"});
+    return js_throw(JSValue{"Can’t ++ something that is not a number"});
   }
   JSValue prev{this->get_number()};
   this->get_number() = this->get_number() + 1.0;
@@ -108,6 +134,7 @@ JSValue JSValue::operator++(int) {
 JSValue &JSValue::operator--() {
   if (this->type() != JSValueType::NUMBER) {
     js_throw(JSValue{"Can’t -- something that is not a number"});
+    return *this;
   }
   this->get_number() = this->get_number() - 1.0;
   return *this;
@@ -115,7 +142,7 @@ JSValue &JSValue::operator--() {
 
 JSValue JSValue::operator--(int) {
   if (this->type() != JSValueType::NUMBER) {
-    js_throw(JSValue{"Can’t -- something that is not a number"});
+    return js_throw(JSValue{"Can’t -- something that is not a number"});
   }
   JSValue prev{this->get_number()};
   this->get_number() = this->get_number() - 1.0;
@@ -132,67 +159,82 @@ JSValue JSValue::operator=(const Box &other) {
 
 JSValue JSValue::operator!() { return JSValue{!this->coerce_to_bool()}; }
 
-JSValue JSValue::operator==(const JSValue other) const {
-  if (this->type() == JSValueType::NUMBER) {
-    return JSValue{std::get<JSValueType::NUMBER>(*this->value).internal ==
-                   other.coerce_to_double()};
-  }
-  if (this->type() == JSValueType::STRING) {
-    return JSValue{std::get<JSValueType::STRING>(*this->value).internal ==
-                   other.coerce_to_string()};
-  }
-  if (this->type() == JSValueType::BOOL) {
-    return JSValue{std::get<JSValueType::BOOL>(*this->value).internal ==
-                   other.coerce_to_bool()};
-  }
-  if (this->type() == JSValueType::ARRAY) {
-    if (other.type() != JSValueType::ARRAY)
-      return JSValue{false};
-    return JSValue{std::get<JSValueType::ARRAY>(*this->value).get() ==
-                   std::get<JSValueType::ARRAY>(*other.value).get()};
-  }
-  if (this->type() == JSValueType::OBJECT) {
-    if (other.type() != JSValueType::OBJECT)
-      return JSValue{false};
-    return JSValue{std::get<JSValueType::OBJECT>(*this->value).get() ==
-                   std::get<JSValueType::OBJECT>(*other.value).get()};
+bool JSValue::loosely_equals(const JSValue &other) const {
+  switch (this->type()) {
+  case JSValueType::UNDEFINED:
+    return other.is_undefined();
+  case JSValueType::NUMBER:
+    return std::get<JSValueType::NUMBER>(*this->value).internal ==
+           other.coerce_to_double();
+  case JSValueType::STRING:
+    return std::get<JSValueType::STRING>(*this->value).internal ==
+           other.coerce_to_string();
+  case JSValueType::BOOL:
+    return std::get<JSValueType::BOOL>(*this->value).internal ==
+           other.coerce_to_bool();
+  case JSValueType::ARRAY:
+    return other.type() == JSValueType::ARRAY &&
+           std::get<JSValueType::ARRAY>(*this->value).get() ==
+               std::get<JSValueType::ARRAY>(*other.value).get();
+  case JSValueType::OBJECT:
+    return other.type() == JSValueType::OBJECT &&
+           std::get<JSValueType::OBJECT>(*this->value).get() ==
+               std::get<JSValueType::OBJECT>(*other.value).get();
+  case JSValueType::FUNCTION:
+    return this->value == other.value;
   }
-  return JSValue{"Equality not implemented for this type yet"};
+  return false;
 }
 
-JSValue JSValue::operator<(const JSValue other) {
-  JSValue v1{this->boxed_value()};
-  JSValue v2{other.boxed_value()};
-  if (v1.type() == JSValueType::NUMBER) {
-    return JSValue{std::get<JSValueType::NUMBER>(*v1.value).internal <
-                   v2.coerce_to_double()};
+bool JSValue::less_than(const JSValue &other) const {
+  if (this->type() == JSValueType::NUMBER) {
+    return std::get<JSValueType::NUMBER>(*this->value).internal <
+           other.coerce_to_double();
   }
-  return JSValue{false};
+  return false;
+}
+
+bool JSValue::less_than_or_equal(const JSValue &other) const {
+  return this->loosely_equals(other) || this->less_than(other);
+}
+
+JSValue JSValue::operator==(const JSValue &other) const {
+  return JSValue{this->loosely_equals(other)};
+}
+
+JSValue JSValue::operator<(const JSValue &other) {
+  return JSValue{this->less_than(other)};
 }
 
-JSValue JSValue::operator&&(const JSValue other) {
+JSValue JSValue::operator&&(const JSValue &other) {
   if (!this->coerce_to_bool())
     return *this;
   return other;
 }
 
-JSValue JSValue::operator||(const JSValue other) {
+JSValue JSValue::operator||(const JSValue &other) {
   if (!this->coerce_to_bool())
     return other;
   return *this;
 }
 
-JSValue JSValue::operator<=(const JSValue other) {
-  return *this == other || *this < other;
+JSValue JSValue::operator<=(const JSValue &other) {
+  return JSValue{this->less_than_or_equal(other)};
 }
 
-JSValue JSValue::operator>(const JSValue other) { return !(*this <= other); }
+JSValue JSValue::operator>(const JSValue &other) {
+  return JSValue{!this->less_than_or_equal(other)};
+}
 
-JSValue JSValue::operator!=(const JSValue other) { return !(*this == other); }
+JSValue JSValue::operator!=(const JSValue &other) {
+  return JSValue{!this->loosely_equals(other)};
+}
 
-JSValue JSValue::operator>=(const JSValue other) { return !(*this < other); }
+JSValue JSValue::operator>=(const JSValue &other) {
+  return JSValue{!this->less_than(other)};
+}
 
-JSValue JSValue::operator+(JSValue other) {
+JSValue JSValue::operator+(const JSValue &other) {
   if (this->type() == JSValueType::NUMBER) {
     return JSValue{std::get<JSValueType::NUMBER>(*this->value).internal +
                    other.coerce_to_double()};
@@ -204,7 +246,15 @@ JSValue JSValue::operator+(JSValue other) {
   return JSValue{"Addition not implemented for this type yet"};
 }
 
-JSValue JSValue::operator*(JSValue other) {
+JSValue JSValue::operator-(const JSValue &other) {
+  if (this->type() == JSValueType::NUMBER) {
+    return JSValue{std::get<JSValueType::NUMBER>(*this->value).internal -
+                   other.coerce_to_double()};
+  }
+  return JSValue{"Subtraction not implemented for this type yet"};
+}
+
+JSValue JSValue::operator*(const JSValue &other) {
   if (this->type() == JSValueType::NUMBER) {
     return JSValue{std::get<JSValueType::NUMBER>(*this->value).internal *
                    other.coerce_to_double()};
@@ -212,7 +262,17 @@ JSValue JSValue::operator*(JSValue other) {
   return JSValue{"Multiplication not implemented for this type yet"};
 }
 
-JSValue JSValue::operator%(JSValue other) {
+JSValue JSValue::operator/(const JSValue &other) {
+  if (this->type() == JSValueType::NUMBER) {
+    return JSValue{std::get<JSValueType::NUMBER>(*this->value).internal /
+                   other.coerce_to_double()};
+  }
+  return JSValue{"Division not implemented for this type yet"};
+}
+
+JSValue JSValue::operator-() { return JSValue{-this->coerce_to_double()}; }
+
+JSValue JSValue::operator%(const JSValue &other) {
   if (this->type() == JSValueType::NUMBER) {
     return JSValue{static_cast<double>(
         static_cast<uint32_t>(
@@ -222,7 +282,7 @@ JSValue JSValue::operator%(JSValue other) {
   return JSValue{"Modulo not implemented for this type yet"};
 }
 
-JSValue JSValue::operator[](const JSValue key) {
+JSValue JSValue::operator[](const JSValue &key) {
   return this->get_property(key, *this);
 }
 
@@ -235,23 +295,20 @@ JSValue JSValue::operator[](const size_t index) {
 }
 
 JSValue JSValue::operator()(std::vector<JSValue> args) {
-  auto this_arg_ptr = this->parent_value.value_or(
-      shared_ptr<JSValue>{new JSValue{JSValue::undefined()}});
-  return this->apply(*this_arg_ptr, args);
+  return this->apply(this->get_parent(), std::move(args));
 }
 
 JSIterator JSValue::begin() {
-  return JSIterator{(*this)[iterator_symbol]({}), *this};
+  return JSIterator{(*this)[js_iterator_symbol()]({}), *this};
 }
 
 JSIterator JSValue::end() { return JSIterator::end_marker(); }
 
-JSValue JSValue::get_property(const JSValue key, JSValue parent) {
+JSValue JSValue::get_property(const JSValue &key, const JSValue &parent) {
   JSValue v;
   switch (this->type()) {
   case JSValueType::UNDEFINED:
-    js_throw(JSValue{"Can’t read property of undefined"});
-    break;
+    return js_throw(JSValue{"Can’t read property of undefined"});
   case JSValueType::BOOL:
     v = std::get<JSValueType::BOOL>(*this->value).get_property(key, parent);
     break;
@@ -275,19 +332,44 @@ JSValue JSValue::get_property(const JSValue key, JSValue parent) {
   return v;
 }
 
+JSValue JSValue::set_property(const JSValue &key, JSValue value) {
+  if (this->type() == JSValueType::ARRAY) {
+    return std::get<JSValueType::ARRAY>(*this->value)
+        ->set_property(key, value, *this);
+  }
+  if (this->type() == JSValueType::OBJECT)
+    std::get<JSValueType::OBJECT>(*this->value)->writable_properties();
+  JSValue target = this->get_property(key, *this);
+  target = value.boxed_value();
+  return value;
+}
+
+JSValue JSValue::update_property(const JSValue &key, double delta,
+                                 bool prefix) {
+  JSValue current = this->get_property(key, *this);
+  if (current.type() != JSValueType::NUMBER) {
+    return js_throw(JSValue{delta > 0
+                                ? "Can’t ++ something that is not a number"
+                                : "Can’t -- something that is not a number"});
+  }
+  double old_value = current.get_number();
+  this->set_property(key, JSValue{old_value + delta});
+  return JSValue{prefix ? old_value + delta : old_value};
+}
+
 JSValue JSValue::with_getter_setter(JSValue getter, JSValue setter) {
   JSValue b{};
   b.getter = std::optional{[=](JSValue v) -> JSValue {
     if (getter.type() != JSValueType::FUNCTION)
       return JSValue::undefined();
-    auto f = std::get<JSValueType::FUNCTION>(*getter.value);
+    auto &f = std::get<JSValueType::FUNCTION>(*getter.value);
     std::vector<JSValue> params{};
     return f.call(v, params);
   }};
   b.setter = std::optional{[=](JSValue v, JSValue new_v) -> JSValue {
     if (setter.type() != JSValueType::FUNCTION)
       return JSValue::undefined();
-    auto f = std::get<JSValueType::FUNCTION>(*setter.value);
+    auto &f = std::get<JSValueType::FUNCTION>(*setter.value);
     std::vector<JSValue> params{new_v};
     return f.call(v, params);
   }};
@@ -327,8 +409,11 @@ std::string JSValue::coerce_to_string() const {
     return std::get<JSValueType::BOOL>(*this->value).internal
                ? std::string{"true"}
                : std::string{"false"};
-  case JSValueType::NUMBER:
-    return std::to_string(std::get<JSValueType::NUMBER>(*this->value).internal);
+  case JSValueType::NUMBER: {
+    char buffer[JS_NUMBER_BUFFER_SIZE];
+    double v = std::get<JSValueType::NUMBER>(*this->value).internal;
+    return std::string(buffer, js_format_number(v, buffer));
+  }
   case JSValueType::STRING:
     return std::get<JSValueType::STRING>(*this->value).internal;
   case JSValueType::ARRAY:
@@ -363,29 +448,29 @@ bool JSValue::coerce_to_bool() const {
 
 JSValue JSValue::apply(JSValue thisArg, std::vector<JSValue> args) {
   if (this->type() != JSValueType::FUNCTION) {
-    js_throw(JSValue{"Calling a non-function"});
+    return js_throw(JSValue{"Calling a non-function"});
   }
-  JSFunction f = std::get<JSValueType::FUNCTION>(*this->value);
-  return f.call(thisArg, args);
+  return std::get<JSValueType::FUNCTION>(*this->value).call(thisArg, args);
 }
 
-void JSValue::set_parent(JSValue parent) {
-  this->parent_value = std::optional{std::make_shared<JSValue>(parent)};
+void JSValue::set_parent(const JSValue &parent) {
+  this->parent_value = JSRef<JSValue>::make(parent);
 }
 
-JSValue JSValue::get_parent() {
-  return *this->parent_value.value_or(
-      std::make_shared<JSValue>(JSValue::undefined()));
+JSValue JSValue::get_parent() const {
+  return this->parent_value ? *this->parent_value : JSValue::undefined();
 }
 
 const JSValue::Box &JSValue::boxed_value() const { return *this->value; }
 
 JSValue JSValue::iterator_from_next_func(JSValue next_func) {
   auto obj = JSValue::new_object({{JSValue{"next"}, next_func}});
-  obj[iterator_symbol] =
-      JSValue::new_function([=](JSValue thisArg,
-                                std::vector<JSValue> &args) mutable -> JSValue {
-        return obj;
+  // Returning `thisArg` rather than capturing `obj` avoids a reference cycle
+  // that would keep the iterator (and its generator frame) alive forever.
+  obj[js_iterator_symbol()] =
+      JSValue::new_function([](JSValue thisArg,
+                               std::vector<JSValue> &args) mutable -> JSValue {
+        return thisArg;
       }).boxed_value();
   return obj;
 };
@@ -5,6 +5,7 @@
 #include <variant>
 
 #include "js_primitives.hpp"
+#include "js_ref.hpp"
 
 using std::optional;
 using std::shared_ptr;
@@ -19,14 +20,19 @@ class JSObject;
 class JSFunction;
 class JSIterator;
 class JSGeneratorAdapter;
+class JSAsyncAdapter;
+class JSPromiseState;
 class JSValue;
 
-// Idk what C++ wants from me... This type alias is defined in
+// Idk what C++ wants from me... These type aliases are defined in
 // `js_primitives.hpp` but the cyclic includes seem to make it impossible to see
 // that here.
-using ExternFunc = std::function<JSValue(JSValue, std::vector<JSValue> &)>;
-using CoroutineFunc =
-    std::function<JSGeneratorAdapter(JSValue, std::vector<JSValue> &)>;
+using ExternFuncPtr = JSValue (*)(JSValue, std::vector<JSValue> &);
+using JSClosureCode = JSValue (*)(const shared_ptr<void> &env, JSValue thisArg,
+                                  std::vector<JSValue> &args);
+// Starts the coroutine of a generator function whose environment is `env`.
+using JSGeneratorStart = JSGeneratorAdapter (*)(void *env, JSValue thisArg,
+                                                std::vector<JSValue> &args);
 
 enum JSValueType : char {
   UNDEFINED,
@@ -58,6 +64,8 @@ public:
   JSValue(JSFunction v);
   JSValue(JSObject v);
   JSValue(JSArray v);
+  // Keeps the dynamic type of objects like `JSRegExp`.
+  JSValue(std::shared_ptr<JSObject> v);
   JSValue(Box v);
 
   JSValue operator=(const Box &other);
@@ -65,19 +73,22 @@ public:
   JSValue operator++(int); // Postfix
   JSValue &operator--();   // Prefix
   JSValue operator--(int); // Postfix
-  JSValue operator==(const JSValue other) const;
+  JSValue operator==(const JSValue &other) const;
   JSValue operator!();
-  JSValue operator<(const JSValue other);
-  JSValue operator<=(const JSValue other);
-  JSValue operator>(const JSValue other);
-  JSValue operator!=(const JSValue other);
-  JSValue operator>=(const JSValue other);
-  JSValue operator&&(const JSValue other);
-  JSValue operator||(const JSValue other);
-  JSValue operator+(JSValue other);
-  JSValue operator*(JSValue other);
-  JSValue operator%(JSValue other);
-  JSValue operator[](const JSValue index);
+  JSValue operator<(const JSValue &other);
+  JSValue operator<=(const JSValue &other);
+  JSValue operator>(const JSValue &other);
+  JSValue operator!=(const JSValue &other);
+  JSValue operator>=(const JSValue &other);
+  JSValue operator&&(const JSValue &other);
+  JSValue operator||(const JSValue &other);
+  JSValue operator+(const JSValue &other);
+  JSValue operator-(const JSValue &other);
+  JSValue operator*(const JSValue &other);
+  JSValue operator/(const JSValue &other);
+  JSValue operator-();
+  JSValue operator%(const JSValue &other);
+  JSValue operator[](const JSValue &index);
   JSValue operator[](const char *index);
   JSValue operator[](const size_t index);
   JSValue operator()(std::vector<JSValue> args);
@@ -87,15 +98,33 @@ public:
 
   static JSValue new_object(std::vector<std::pair<JSValue, JSValue>>);
   static JSValue new_array(std::vector<JSValue>);
-  static JSValue new_function(ExternFunc f);
-  static JSValue new_generator_function(CoroutineFunc gen_f);
+  // A new array or object with the elements of `literal`, a constant array
+  // or object literal that is created once. They are only copied once the
+  // new value is written to.
+  static JSValue from_literal(const JSValue &literal);
+  static JSValue new_function(ExternFuncPtr f);
+  // `f` is called as `f(thisArg, args)`. It becomes the environment of the
+  // closure, allocated once and shared by all copies of the function.
+  template <typename F> static JSValue new_function(F f);
+  template <typename F> static JSValue new_generator_function(F gen_f);
+  template <typename F> static JSValue new_async_function(F async_f);
+  static JSValue new_closure(JSClosureCode code, shared_ptr<void> env);
   static JSValue undefined();
   static JSValue iterator_from_next_func(JSValue next_func);
   static JSValue with_getter_setter(JSValue getter, JSValue setter);
 
-  JSValue get_property(const JSValue key, JSValue parent);
+  JSValue get_property(const JSValue &key, const JSValue &parent);
+  // `this[key] = value`. Returns `value`.
+  JSValue set_property(const JSValue &key, JSValue value);
+  // `this[key] += delta`, evaluating to the old value unless `prefix`.
+  JSValue update_property(const JSValue &key, double delta, bool prefix);
   JSValue apply(JSValue thisArg, std::vector<JSValue> args);
 
+  // Comparisons for conditions, without boxing the result.
+  bool loosely_equals(const JSValue &other) const;
+  bool less_than(const JSValue &other) const;
+  bool less_than_or_equal(const JSValue &other) const;
+
   JSValueType type() const;
   double coerce_to_double() const;
   std::string coerce_to_string() const;
@@ -103,13 +132,52 @@ public:
 
   bool is_undefined() const;
   double &get_number();
-  void set_parent(JSValue parent_value);
-  JSValue get_parent();
+  void set_parent(const JSValue &parent_value);
+  JSValue get_parent() const;
   const Box &boxed_value() const;
 
-  shared_ptr<Box> value;
-  optional<shared_ptr<JSValue>> parent_value;
+  JSRef<Box> value;
+  // The object a method was read from, which becomes its `this`.
+  JSRef<JSValue> parent_value;
 
   std::optional<Getter> getter = std::nullopt;
   std::optional<Setter> setter = std::nullopt;
 };
+
+// Used by the generator and async function templates below.
+JSValue js_start_generator(JSGeneratorStart start, const shared_ptr<void> &env,
+                           JSValue thisArg, std::vector<JSValue> &args);
+JSValue js_start_async(const shared_ptr<void> &env,
+                       shared_ptr<JSPromiseState> state);
+
+template <typename F> JSValue JSValue::new_function(F f) {
+  return JSValue::new_closure(
+      [](const shared_ptr<void> &env, JSValue thisArg,
+         std::vector<JSValue> &args) -> JSValue {
+        return (*static_cast<F *>(env.get()))(thisArg, args);
+      },
+      std::make_shared<F>(std::move(f)));
+}
+
+template <typename F> JSValue JSValue::new_generator_function(F gen_f) {
+  return JSValue::new_closure(
+      [](const shared_ptr<void> &env, JSValue thisArg,
+         std::vector<JSValue> &args) -> JSValue {
+        return js_start_generator(
+            [](void *env, JSValue thisArg, std::vector<JSValue> &args) {
+              return (*static_cast<F *>(env))(thisArg, args);
+            },
+            env, thisArg, args);
+      },
+      std::make_shared<F>(std::move(gen_f)));
+}
+
+template <typename F> JSValue JSValue::new_async_function(F async_f) {
+  return JSValue::new_closure(
+      [](const shared_ptr<void> &env, JSValue thisArg,
+         std::vector<JSValue> &args) -> JSValue {
+        auto state = (*static_cast<F *>(env.get()))(thisArg, args).state;
+        return js_start_async(env, state);
+      },
+      std::make_shared<F>(std::move(async_f)));
+}
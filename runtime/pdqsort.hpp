@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <utility>
+
+// Pattern-defeating quicksort (after Orson Peters): quicksort with
+// median-of-three pivots (a ninther on large ranges), insertion sort for
+// small ranges, an early exit for input that turns out to be sorted already
+// and a heapsort fallback once partitions keep coming out unbalanced. Not
+// stable.
+//
+// Every scan is bounds-checked, so a comparator that isn’t a strict weak
+// order (like an arbitrary JS callback) yields an unspecified order but never
+// reads outside the range.
+namespace pdqsort_detail {
+
+constexpr ptrdiff_t insertion_sort_threshold = 24;
+constexpr ptrdiff_t ninther_threshold = 128;
+constexpr ptrdiff_t partial_insertion_sort_limit = 8;
+
+template <typename Iter, typename Compare>
+void insertion_sort(Iter begin, Iter end, Compare &comp) {
+  if (begin == end)
+    return;
+  for (Iter cur = begin + 1; cur != end; ++cur) {
+    for (Iter sift = cur; sift != begin && comp(*sift, *(sift - 1)); --sift)
+      std::iter_swap(sift, sift - 1);
+  }
+}
+
+// Like `insertion_sort`, but gives up once it had to move too many elements.
+template <typename Iter, typename Compare>
+bool partial_insertion_sort(Iter begin, Iter end, Compare &comp) {
+  if (begin == end)
+    return true;
+  ptrdiff_t moves = 0;
+  for (Iter cur = begin + 1; cur != end; ++cur) {
+    Iter sift = cur;
+    for (; sift != begin && comp(*sift, *(sift - 1)); --sift)
+      std::iter_swap(sift, sift - 1);
+    moves += cur - sift;
+    if (moves > partial_insertion_sort_limit)
+      return false;
+  }
+  return true;
+}
+
+template <typename Iter, typename Compare>
+void sort2(Iter a, Iter b, Compare &comp) {
+  if (comp(*b, *a))
+    std::iter_swap(a, b);
+}
+
+template <typename Iter, typename Compare>
+void sort3(Iter a, Iter b, Iter c, Compare &comp) {
+  sort2(a, b, comp);
+  sort2(b, c, comp);
+  sort2(a, b, comp);
+}
+
+// Partitions around the pivot at `begin`, putting elements equal to it on
+// the right. Returns the pivot’s final position and whether the range was
+// partitioned already.
+template <typename Iter, typename Compare>
+std::pair<Iter, bool> partition_right(Iter begin, Iter end, Compare &comp) {
+  Iter first = begin;
+  while (++first != end && comp(*first, *begin))
+    ;
+  Iter last = end;
+  while (--last > first && !comp(*last, *begin))
+    ;
+  bool already_partitioned = first >= last;
+  while (first < last) {
+    std::iter_swap(first, last);
+    while (++first < last && comp(*first, *begin))
+      ;
+    while (--last > first && !comp(*last, *begin))
+      ;
+  }
+  Iter pivot_pos = first - 1;
+  std::iter_swap(begin, pivot_pos);
+  return {pivot_pos, already_partitioned};
+}
+
+// Partitions around the pivot at `begin`, putting elements equal to it on
+// the left. Used when the pivot equals an element left of the range, so
+// the equal elements are already in their final place.
+template <typename Iter, typename Compare>
+Iter partition_left(Iter begin, Iter end, Compare &comp) {
+  Iter last = end;
+  while (--last > begin && comp(*begin, *last))
+    ;
+  Iter first = begin;
+  while (++first < last && !comp(*begin, *first))
+    ;
+  while (first < last) {
+    std::iter_swap(first, last);
+    while (--last > begin && comp(*begin, *last))
+      ;
+    while (++first < last && !comp(*begin, *first))
+      ;
+  }
+  std::iter_swap(begin, last);
+  return last;
+}
+
+template <typename Iter, typename Compare>
+void pdqsort_loop(Iter begin, Iter end, Compare &comp, int bad_allowed,
+                  bool leftmost) {
+  while (true) {
+    ptrdiff_t size = end - begin;
+    if (size < insertion_sort_threshold) {
+      insertion_sort(begin, end, comp);
+      return;
+    }
+
+    // Move the chosen pivot to `begin`.
+    ptrdiff_t half = size / 2;
+    if (size > ninther_threshold) {
+      sort3(begin, begin + half, end - 1, comp);
+      sort3(begin + 1, begin + (half - 1), end - 2, comp);
+      sort3(begin + 2, begin + (half + 1), end - 3, comp);
+      sort3(begin + (half - 1), begin + half, begin + (half + 1), comp);
+      std::iter_swap(begin, begin + half);
+    } else {
+      sort3(begin + half, begin, end - 1, comp);
+    }
+
+    // Runs of equal elements are done in one step.
+    if (!leftmost && !comp(*(begin - 1), *begin)) {
+      begin = partition_left(begin, end, comp) + 1;
+      continue;
+    }
+
+    auto [pivot_pos, already_partitioned] = partition_right(begin, end, comp);
+    ptrdiff_t left_size = pivot_pos - begin;
+    ptrdiff_t right_size = end - (pivot_pos + 1);
+    if (left_size < size / 8 || right_size < size / 8) {
+      if (--bad_allowed == 0) {
+        std::make_heap(begin, end, comp);
+        std::sort_heap(begin, end, comp);
+        return;
+      }
+      // Swap a few elements around to break up the pattern that led here.
+      if (left_size >= insertion_sort_threshold) {
+        std::iter_swap(begin, begin + left_size / 4);
+        std::iter_swap(pivot_pos - 1, pivot_pos - left_size / 4);
+      }
+      if (right_size >= insertion_sort_threshold) {
+        std::iter_swap(pivot_pos + 1, pivot_pos + (1 + right_size / 4));
+        std::iter_swap(end - 1, end - right_size / 4);
+      }
+    } else if (already_partitioned &&
+               partial_insertion_sort(begin, pivot_pos, comp) &&
+               partial_insertion_sort(pivot_pos + 1, end, comp)) {
+      return;
+    }
+
+    pdqsort_loop(begin, pivot_pos, comp, bad_allowed, leftmost);
+    begin = pivot_pos + 1;
+    leftmost = false;
+  }
+}
+
+} // namespace pdqsort_detail
+
+template <typename Iter, typename Compare>
+void pdqsort(Iter begin, Iter end, Compare comp) {
+  if (end - begin < 2)
+    return;
+  int bad_allowed = std::bit_width(static_cast<size_t>(end - begin));
+  pdqsort_detail::pdqsort_loop(begin, end, comp, bad_allowed, true);
+}
@@ -0,0 +1,217 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+#ifdef FEATURE_THREADS
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+struct Batch {
+  const std::function<void(size_t)> *task;
+  std::atomic<size_t> remaining;
+  std::mutex error_mutex;
+  std::exception_ptr error;
+};
+
+struct Job {
+  Batch *batch;
+  size_t index;
+};
+
+struct WorkQueue {
+  std::mutex mutex;
+  std::deque<Job> jobs;
+};
+
+thread_local size_t current_worker = SIZE_MAX;
+
+class ThreadPool {
+public:
+  static ThreadPool &get() {
+    static ThreadPool pool;
+    return pool;
+  }
+
+  size_t size() const { return this->queues.size(); }
+
+  void run(Batch &batch, size_t count) {
+    size_t home = current_worker != SIZE_MAX ? current_worker : 0;
+    for (size_t i = 0; i < count; i++) {
+      auto &queue = *this->queues[(home + i) % this->queues.size()];
+      std::lock_guard<std::mutex> lock{queue.mutex};
+      queue.jobs.push_back({&batch, i});
+    }
+    {
+      std::lock_guard<std::mutex> lock{this->sleep_mutex};
+      this->queued += count;
+    }
+    this->wake.notify_all();
+
+    // Help out until our own batch is drained. Jobs from other batches are
+    // fair game too, they might be what our tasks are waiting on. Once there
+    // is nothing left to take, sleep until our last tasks finish elsewhere or
+    // more jobs come in.
+    Job job;
+    while (batch.remaining.load(std::memory_order_acquire) > 0) {
+      if (this->pop(home, job)) {
+        this->execute(job);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock{this->sleep_mutex};
+      this->wake.wait(lock, [&] {
+        return batch.remaining.load(std::memory_order_acquire) == 0 ||
+               this->queued > 0;
+      });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock{this->sleep_mutex};
+      this->stopping = true;
+    }
+    this->wake.notify_all();
+    for (auto &thread : this->threads) {
+      thread.join();
+    }
+  }
+
+private:
+  ThreadPool() {
+    size_t num_workers = std::thread::hardware_concurrency();
+    if (num_workers > 1) {
+      num_workers--; // The submitting thread works too.
+    }
+    for (size_t i = 0; i < num_workers; i++) {
+      this->queues.push_back(std::make_unique<WorkQueue>());
+    }
+    for (size_t i = 0; i < num_workers; i++) {
+      this->threads.emplace_back([this, i] { this->worker_loop(i); });
+    }
+  }
+
+  void worker_loop(size_t id) {
+    current_worker = id;
+    Job job;
+    while (true) {
+      if (this->pop(id, job)) {
+        this->execute(job);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock{this->sleep_mutex};
+      this->wake.wait(lock,
+                      [this] { return this->stopping || this->queued > 0; });
+      if (this->stopping)
+        return;
+    }
+  }
+
+  // Takes the newest job from our own queue, or steals the oldest job from
+  // somebody else’s.
+  bool pop(size_t id, Job &job) {
+    {
+      auto &own = *this->queues[id];
+      std::lock_guard<std::mutex> lock{own.mutex};
+      if (!own.jobs.empty()) {
+        job = own.jobs.back();
+        own.jobs.pop_back();
+        this->mark_taken();
+        return true;
+      }
+    }
+    for (size_t i = 1; i < this->queues.size(); i++) {
+      auto &victim = *this->queues[(id + i) % this->queues.size()];
+      std::lock_guard<std::mutex> lock{victim.mutex};
+      if (!victim.jobs.empty()) {
+        job = victim.jobs.front();
+        victim.jobs.pop_front();
+        this->mark_taken();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void mark_taken() {
+    std::lock_guard<std::mutex> lock{this->sleep_mutex};
+    this->queued--;
+  }
+
+  void execute(const Job &job) {
+    try {
+      (*job.batch->task)(job.index);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock{job.batch->error_mutex};
+      if (!job.batch->error) {
+        job.batch->error = std::current_exception();
+      }
+    }
+    if (job.batch->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      // Wakes the submitting thread if it is waiting. Taking the lock first
+      // makes sure it either sees the count or is already asleep.
+      std::lock_guard<std::mutex> lock{this->sleep_mutex};
+      this->wake.notify_all();
+    }
+  }
+
+  std::vector<std::unique_ptr<WorkQueue>> queues;
+  std::vector<std::thread> threads;
+  std::mutex sleep_mutex;
+  std::condition_variable wake;
+  long queued = 0;
+  bool stopping = false;
+};
+
+} // namespace
+
+void js_parallel_run(size_t count, const std::function<void(size_t)> &task) {
+  auto &pool = ThreadPool::get();
+  if (count <= 1 || pool.size() == 0) {
+    for (size_t i = 0; i < count; i++) {
+      task(i);
+    }
+    return;
+  }
+  Batch batch{&task, {count}, {}, nullptr};
+  pool.run(batch, count);
+  if (batch.error) {
+    std::rethrow_exception(batch.error);
+  }
+}
+
+static size_t js_parallel_width() {
+  return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
+#else
+void js_parallel_run(size_t count, const std::function<void(size_t)> &task) {
+  for (size_t i = 0; i < count; i++) {
+    task(i);
+  }
+}
+
+static size_t js_parallel_width() { return 1; }
+#endif
+
+// Chunks shouldn’t be so small that scheduling overhead dominates, but there
+// should be a few per core so that stealing can even out uneven callbacks.
+static const size_t min_chunk_size = 256;
+static const size_t chunks_per_core = 4;
+
+std::vector<std::pair<size_t, size_t>> js_parallel_chunks(size_t n) {
+  size_t num_chunks =
+      std::min(js_parallel_width() * chunks_per_core,
+               (n + min_chunk_size - 1) / min_chunk_size);
+  num_chunks = std::max<size_t>(num_chunks, 1);
+  std::vector<std::pair<size_t, size_t>> chunks;
+  for (size_t i = 0; i < num_chunks; i++) {
+    chunks.push_back({n * i / num_chunks, n * (i + 1) / num_chunks});
+  }
+  return chunks;
+}
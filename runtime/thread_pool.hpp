@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// Splits [0, n) into contiguous [begin, end) ranges sized for the thread pool.
+std::vector<std::pair<size_t, size_t>> js_parallel_chunks(size_t n);
+
+// Runs `task(0)` ... `task(count - 1)` on a work-stealing pool sized to the
+// core count and blocks until all of them are done. The calling thread helps
+// out while it waits, so nested parallel calls can’t deadlock. The first
+// exception thrown by a task is rethrown on the calling thread.
+//
+// Without FEATURE_THREADS, all tasks run inline on the calling thread.
+void js_parallel_run(size_t count, const std::function<void(size_t)> &task);
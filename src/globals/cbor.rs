@@ -0,0 +1,11 @@
+use crate::globals::Global;
+
+pub fn cbor_global() -> Global {
+    Global {
+        name: "CBOR".into(),
+        additional_headers: Some(vec!["runtime/global_cbor.hpp".into()]),
+        additional_sources: Some(vec!["runtime/global_cbor.cpp".into()]),
+        init: None,
+        factory: "create_CBOR_global()".into(),
+    }
+}
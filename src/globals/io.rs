@@ -4,6 +4,7 @@ pub fn io_global() -> Global {
     Global {
         name: "IO".into(),
         additional_headers: Some(vec!["runtime/global_io.hpp".into()]),
+        additional_sources: Some(vec!["runtime/global_io.cpp".into()]),
         init: None,
         factory: "create_IO_global()".into(),
     }
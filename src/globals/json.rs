@@ -4,6 +4,7 @@ pub fn json_global() -> Global {
     Global {
         name: "JSON".into(),
         additional_headers: Some(vec!["runtime/global_json.hpp".into()]),
+        additional_sources: Some(vec!["runtime/global_json.cpp".into()]),
         init: None,
         factory: "create_JSON_global()".into(),
     }
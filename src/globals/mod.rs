@@ -1,10 +1,17 @@
+pub mod cbor;
 pub mod io;
 pub mod json;
+pub mod promise;
+pub mod runtime;
 pub mod symbol;
+pub mod timers;
+pub mod worker;
 
 pub struct Global {
     pub name: String,
     pub additional_headers: Option<Vec<String>>,
+    /// Runtime files to compile and link when the program uses the global.
+    pub additional_sources: Option<Vec<String>>,
     pub init: Option<String>,
     pub factory: String,
 }
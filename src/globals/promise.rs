@@ -0,0 +1,11 @@
+use crate::globals::Global;
+
+pub fn promise_global() -> Global {
+    Global {
+        name: "Promise".into(),
+        additional_headers: Some(vec!["runtime/global_promise.hpp".into()]),
+        additional_sources: Some(vec!["runtime/global_promise.cpp".into()]),
+        init: None,
+        factory: "create_Promise_global()".into(),
+    }
+}
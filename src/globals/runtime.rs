@@ -0,0 +1,11 @@
+use crate::globals::Global;
+
+pub fn runtime_global() -> Global {
+    Global {
+        name: "Runtime".into(),
+        additional_headers: Some(vec!["runtime/global_runtime.hpp".into()]),
+        additional_sources: Some(vec!["runtime/global_runtime.cpp".into()]),
+        init: None,
+        factory: "create_Runtime_global()".into(),
+    }
+}
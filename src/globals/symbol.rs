@@ -4,6 +4,7 @@ pub fn symbol_global() -> Global {
     Global {
         name: "Symbol".into(),
         additional_headers: Some(vec!["runtime/global_symbol.hpp".into()]),
+        additional_sources: Some(vec!["runtime/global_symbol.cpp".into()]),
         init: None,
         factory: "create_symbol_global()".into(),
     }
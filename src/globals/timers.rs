@@ -0,0 +1,11 @@
+use crate::globals::Global;
+
+pub fn timers_global() -> Global {
+    Global {
+        name: "setTimeout".into(),
+        additional_headers: Some(vec!["runtime/global_timers.hpp".into()]),
+        additional_sources: Some(vec!["runtime/global_timers.cpp".into()]),
+        init: None,
+        factory: "create_setTimeout_global()".into(),
+    }
+}
@@ -0,0 +1,11 @@
+use crate::globals::Global;
+
+pub fn worker_global() -> Global {
+    Global {
+        name: "Worker".into(),
+        additional_headers: Some(vec!["runtime/global_worker.hpp".into()]),
+        additional_sources: Some(vec!["runtime/global_worker.cpp".into()]),
+        init: None,
+        factory: "create_Worker_global()".into(),
+    }
+}
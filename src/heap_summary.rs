@@ -0,0 +1,248 @@
+use std::collections::HashMap;
+
+use anyhow::{anyhow, Result};
+
+/// How many allocation sites the summary lists.
+const MAX_SITES: usize = 20;
+
+/// A cell of a heap snapshot, as written by `js_heap_snapshot`.
+struct Node {
+    kind: String,
+    size: usize,
+    refs: usize,
+    site: String,
+    edges: Vec<usize>,
+}
+
+fn parse(snapshot: &str) -> Result<Vec<Node>> {
+    let mut lines = snapshot.lines();
+    if lines.next() != Some("jsxx-heap-snapshot 1") {
+        return Err(anyhow!("Not a heap snapshot"));
+    }
+    let rows = lines
+        .filter(|line| !line.is_empty())
+        .map(|line| {
+            let fields: Vec<&str> = line.split('\t').collect();
+            if fields.len() != 6 {
+                return Err(anyhow!("Malformed heap snapshot line: {}", line));
+            }
+            Ok(fields)
+        })
+        .collect::<Result<Vec<Vec<&str>>>>()?;
+    let ids: HashMap<&str, usize> = rows
+        .iter()
+        .enumerate()
+        .map(|(idx, fields)| (fields[0], idx))
+        .collect();
+    rows.iter()
+        .map(|fields| {
+            Ok(Node {
+                kind: fields[1].to_string(),
+                size: fields[2].parse()?,
+                refs: fields[3].parse()?,
+                site: fields[4].to_string(),
+                edges: fields[5]
+                    .split(' ')
+                    .filter_map(|id| ids.get(id).copied())
+                    .collect(),
+            })
+        })
+        .collect()
+}
+
+/// The result of analyzing the reference graph of a snapshot.
+struct Analysis {
+    /// The immediate dominator of each reachable cell, `None` for cells that
+    /// are referenced from outside the heap.
+    idom: Vec<Option<usize>>,
+    reachable: Vec<bool>,
+    /// The bytes that would be freed along with each cell.
+    retained: Vec<usize>,
+}
+
+/// Cells with more references than the heap accounts for are held by the
+/// stack, globals, closures or the runtime. Everything else that can’t be
+/// reached from them is only kept alive by reference cycles: leaked.
+///
+/// Computes dominators with the algorithm of Cooper, Harvey and Kennedy,
+/// using an extra node that refers to all the externally held cells.
+fn analyze(nodes: &[Node]) -> Analysis {
+    let root = nodes.len();
+    let mut incoming = vec![0; nodes.len()];
+    let mut preds: Vec<Vec<usize>> = vec![vec![]; nodes.len() + 1];
+    for (idx, node) in nodes.iter().enumerate() {
+        for &target in &node.edges {
+            incoming[target] += 1;
+            preds[target].push(idx);
+        }
+    }
+    let roots: Vec<usize> = (0..nodes.len())
+        .filter(|&idx| nodes[idx].refs > incoming[idx])
+        .collect();
+    for &idx in &roots {
+        preds[idx].push(root);
+    }
+    // Postorder, iteratively, as chains of references can be long.
+    let mut postorder = vec![];
+    let mut visited = vec![false; nodes.len() + 1];
+    let mut stack = vec![(root, 0)];
+    visited[root] = true;
+    while let Some((idx, next)) = stack.pop() {
+        let successors = if idx == root {
+            &roots
+        } else {
+            &nodes[idx].edges
+        };
+        match successors.get(next) {
+            Some(&succ) => {
+                stack.push((idx, next + 1));
+                if !visited[succ] {
+                    visited[succ] = true;
+                    stack.push((succ, 0));
+                }
+            }
+            None => postorder.push(idx),
+        }
+    }
+    let mut order = vec![usize::MAX; nodes.len() + 1];
+    for (pos, &idx) in postorder.iter().enumerate() {
+        order[idx] = pos;
+    }
+
+    let mut idom = vec![usize::MAX; nodes.len() + 1];
+    idom[root] = root;
+    let intersect = |idom: &[usize], mut a: usize, mut b: usize| {
+        while a != b {
+            while order[a] < order[b] {
+                a = idom[a];
+            }
+            while order[b] < order[a] {
+                b = idom[b];
+            }
+        }
+        a
+    };
+    let mut changed = true;
+    while changed {
+        changed = false;
+        for &idx in postorder.iter().rev().skip(1) {
+            let new_idom = preds[idx]
+                .iter()
+                .filter(|&&pred| idom[pred] != usize::MAX)
+                .fold(None, |acc, &pred| match acc {
+                    None => Some(pred),
+                    Some(acc) => Some(intersect(&idom, pred, acc)),
+                })
+                .unwrap();
+            if idom[idx] != new_idom {
+                idom[idx] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    let mut retained: Vec<usize> = nodes.iter().map(|node| node.size).collect();
+    retained.push(0);
+    for &idx in &postorder {
+        if idx != root {
+            retained[idom[idx]] += retained[idx];
+        }
+    }
+    retained.pop();
+    Analysis {
+        idom: (0..nodes.len())
+            .map(|idx| Some(idom[idx]).filter(|&dom| dom != root && dom != usize::MAX))
+            .collect(),
+        reachable: visited[..nodes.len()].to_vec(),
+        retained,
+    }
+}
+
+#[derive(Default)]
+struct Group {
+    cells: usize,
+    bytes: usize,
+    retained: usize,
+}
+
+/// Groups the reachable cells by `key`. A cell’s retained size counts
+/// towards its group unless its dominator is in the same group already.
+fn group_by<'a>(
+    nodes: &'a [Node],
+    analysis: &Analysis,
+    key: impl Fn(&'a Node) -> &'a str,
+) -> Vec<(&'a str, Group)> {
+    let mut groups: HashMap<&str, Group> = HashMap::new();
+    for (idx, node) in nodes.iter().enumerate() {
+        if !analysis.reachable[idx] {
+            continue;
+        }
+        let group = groups.entry(key(node)).or_default();
+        group.cells += 1;
+        group.bytes += node.size;
+        if analysis.idom[idx].map_or(true, |dom| key(&nodes[dom]) != key(node)) {
+            group.retained += analysis.retained[idx];
+        }
+    }
+    let mut groups: Vec<(&str, Group)> = groups.into_iter().collect();
+    groups.sort_by(|a, b| b.1.retained.cmp(&a.1.retained).then(a.0.cmp(b.0)));
+    groups
+}
+
+fn render_groups(title: &str, groups: &[(&str, Group)]) -> String {
+    let mut out = format!(
+        "{}:\n{:>10} {:>12} {:>12}  {}\n",
+        title, "cells", "bytes", "retained", "name"
+    );
+    for (name, group) in groups {
+        out += &format!(
+            "{:>10} {:>12} {:>12}  {}\n",
+            group.cells, group.bytes, group.retained, name
+        );
+    }
+    out
+}
+
+/// Renders counts, sizes and retained sizes by type and by allocation site,
+/// and lists the cells that are only kept alive by reference cycles.
+///
+/// What closures and generators captured is opaque to the snapshot, so the
+/// values they hold count as referenced from outside the heap.
+pub fn summarize(snapshot: &str) -> Result<String> {
+    let nodes = parse(snapshot)?;
+    let analysis = analyze(&nodes);
+    let total: usize = nodes.iter().map(|node| node.size).sum();
+    let mut out = format!("{} live cells, {} bytes\n\n", nodes.len(), total);
+    out += &render_groups(
+        "By type",
+        &group_by(&nodes, &analysis, |node| node.kind.as_str()),
+    );
+    out += "\n";
+    let sites = group_by(&nodes, &analysis, |node| node.site.as_str());
+    out += &render_groups("By allocation site", &sites[..sites.len().min(MAX_SITES)]);
+
+    let mut leaks: HashMap<(&str, &str), Group> = HashMap::new();
+    for (idx, node) in nodes.iter().enumerate() {
+        if analysis.reachable[idx] {
+            continue;
+        }
+        let group = leaks.entry((&node.site, &node.kind)).or_default();
+        group.cells += 1;
+        group.bytes += node.size;
+    }
+    if !leaks.is_empty() {
+        let mut leaks: Vec<((&str, &str), Group)> = leaks.into_iter().collect();
+        leaks.sort_by(|a, b| b.1.bytes.cmp(&a.1.bytes).then(a.0.cmp(&b.0)));
+        out += &format!(
+            "\nLeaked in reference cycles:\n{:>10} {:>12}  {}\n",
+            "cells", "bytes", "site"
+        );
+        for ((site, kind), group) in leaks {
+            out += &format!(
+                "{:>10} {:>12}  {} ({})\n",
+                group.cells, group.bytes, site, kind
+            );
+        }
+    }
+    Ok(out)
+}
@@ -1,6 +1,7 @@
 use std::{
     fs::File,
     io::{Read, Write},
+    path::Path,
     process::{Command, Stdio},
 };
 
@@ -8,9 +9,15 @@ use anyhow::{anyhow, Result};
 use clap::Parser;
 use swc_common::BytePos;
 use swc_ecma_parser::{lexer::Lexer, EsConfig, Parser as ESParser, StringInput, Syntax};
+use swc_ecma_visit::swc_ecma_ast::Module;
 
 mod command_utils;
 mod globals;
+mod heap_summary;
+mod modules;
+mod optimizer;
+mod regexp;
+mod scope;
 mod transpiler;
 
 #[cfg(test)]
@@ -31,11 +38,49 @@ struct Args {
     #[clap(long = "wasm", default_value_t = false, value_parser)]
     wasm: bool,
 
+    /// Propagate exceptions as status values instead of C++ exceptions,
+    /// which is what `--wasm` uses
+    #[clap(long = "status-exceptions", default_value_t = false, value_parser)]
+    status_exceptions: bool,
+
+    /// Build without threads: values use non-atomic reference counts, the
+    /// parallel array methods run sequentially and `Worker` is unavailable
+    #[clap(long = "single-threaded", default_value_t = false, value_parser)]
+    single_threaded: bool,
+
+    /// Build for sampling profilers: emit `#line` directives, named function
+    /// symbols, debug info and frame pointers, plus a `.symbols` map
+    #[clap(long = "profile", default_value_t = false, value_parser)]
+    profile: bool,
+
+    /// Record where each value was allocated, so that
+    /// `Runtime.heapSnapshot()` can write a heap snapshot
+    #[clap(long = "heap-profile", default_value_t = false, value_parser)]
+    heap_profile: bool,
+
+    /// Print a summary of a heap snapshot instead of compiling
+    #[clap(long = "summarize-heap", value_parser)]
+    summarize_heap: Option<String>,
+
+    /// Fold constants, drop dead code and hoist literals out of loops
+    #[clap(short = 'O', long = "optimize", default_value_t = false, value_parser)]
+    optimize: bool,
+
+    /// Optimize for binary size and let the linker drop unused code
+    #[clap(long = "min-size", default_value_t = false, value_parser)]
+    min_size: bool,
+
+    /// Build from this module and the modules it imports, instead of from a
+    /// program read from stdin. Each module is compiled separately, in
+    /// parallel, and only recompiled when it changes
+    #[clap(long = "entry", value_parser)]
+    entry: Option<String>,
+
     /// Extra flags to path to clang++
     extra_flags: Vec<String>,
 }
 
-fn js_to_cpp<T: AsRef<str>>(mut transpiler: transpiler::Transpiler, input: T) -> Result<String> {
+fn parse_module<T: AsRef<str>>(input: T, optimize: bool) -> Result<Module> {
     let syntax = Syntax::Es(EsConfig::default());
     let lexer = Lexer::new(
         syntax,
@@ -48,13 +93,32 @@ fn js_to_cpp<T: AsRef<str>>(mut transpiler: transpiler::Transpiler, input: T) ->
         None,
     );
     let mut parser = ESParser::new_from(lexer);
-    let module = parser
+    let mut module = parser
         .parse_module()
         .map_err(|err| anyhow!(format!("{:?}", err)))?;
+    if optimize {
+        optimizer::optimize(&mut module);
+    }
+    Ok(module)
+}
+
+fn all_globals() -> Vec<globals::Global> {
+    vec![
+        globals::io::io_global(),
+        globals::json::json_global(),
+        globals::cbor::cbor_global(),
+        globals::symbol::symbol_global(),
+        globals::worker::worker_global(),
+        globals::promise::promise_global(),
+        globals::timers::timers_global(),
+        globals::runtime::runtime_global(),
+    ]
+}
 
-    transpiler.globals.push(globals::io::io_global());
-    transpiler.globals.push(globals::json::json_global());
-    transpiler.globals.push(globals::symbol::symbol_global());
+fn js_to_cpp<T: AsRef<str>>(transpiler: &mut transpiler::Transpiler, input: T) -> Result<String> {
+    let module = parse_module(input.as_ref(), transpiler.optimize)?;
+    transpiler.set_source(input.as_ref());
+    transpiler.globals.extend(all_globals());
     transpiler.transpile_module(&module)
 }
 
@@ -63,6 +127,7 @@ fn cpp_to_binary(
     outputname: String,
     clang_path: String,
     flags: &[String],
+    global_sources: &[String],
 ) -> Result<()> {
     let cpp_file_name = format!("./{}.cpp", outputname);
     let mut tempfile = File::create(&cpp_file_name)?;
@@ -78,15 +143,11 @@ fn cpp_to_binary(
                 "-o",
                 outputname.as_ref(),
                 cpp_file_name.as_ref(),
-                "runtime/global_json.cpp",
-                "runtime/global_symbol.cpp",
-                "runtime/global_io.cpp",
-                "runtime/js_primitives.cpp",
-                "runtime/js_value.cpp",
-                "runtime/exceptions.cpp",
             ]
             .into_iter(),
         )
+        .chain(modules::RUNTIME_SOURCES.iter().copied())
+        .chain(global_sources.iter().map(|source| source.as_ref()))
         .collect::<Vec<&str>>();
 
     let mut child = Command::new(&clang_path)
@@ -101,38 +162,143 @@ fn cpp_to_binary(
     Ok(())
 }
 
+/// Flags for native (non-wasm) builds, which get exceptions and, unless
+/// `single_threaded`, threads.
+fn native_flags(status_exceptions: bool, single_threaded: bool) -> Vec<String> {
+    let exceptions = if status_exceptions {
+        "-DFEATURE_STATUS_EXCEPTIONS"
+    } else {
+        "-DFEATURE_EXCEPTIONS"
+    };
+    let mut flags = vec![exceptions.to_string()];
+    if !single_threaded {
+        flags.push("-DFEATURE_THREADS".to_string());
+        flags.push("-pthread".to_string());
+    }
+    flags
+}
+
+/// Flags for `--min-size`: every function and global goes into its own
+/// section, so that the linker can garbage-collect the unused ones.
+fn min_size_flags() -> Vec<String> {
+    vec![
+        "-Os".to_string(),
+        "-ffunction-sections".to_string(),
+        "-fdata-sections".to_string(),
+        "-Wl,--gc-sections".to_string(),
+    ]
+}
+
+/// The clang++ flags for `args`, and the name of the binary to build.
+fn build_flags(args: &Args, status_exceptions: bool) -> (Vec<String>, String) {
+    let mut flags = args.extra_flags.clone();
+    let mut extension = "".to_string();
+    if args.wasm {
+        flags.push("-fno-exceptions".to_string());
+        flags.push("-DFEATURE_STATUS_EXCEPTIONS".to_string());
+        flags.push("--target=wasm32-wasi".to_string());
+        if let Ok(wasi_sdk_prefix) = std::env::var("WASI_SDK_PREFIX") {
+            flags.push(format!("--sysroot={}/share/wasi-sysroot", wasi_sdk_prefix));
+        }
+        extension = ".wasm".to_string();
+    } else {
+        flags.extend(native_flags(status_exceptions, args.single_threaded));
+    }
+    if args.profile {
+        flags.push("-g".to_string());
+        if !args.wasm {
+            flags.push("-fno-omit-frame-pointer".to_string());
+            flags.push("-mno-omit-leaf-frame-pointer".to_string());
+        }
+    }
+    if args.heap_profile {
+        flags.push("-DFEATURE_HEAP_PROFILE".to_string());
+    }
+    if args.min_size {
+        flags.extend(min_size_flags());
+    }
+    (flags, format!("output{}", extension))
+}
+
+fn clang_format(code: &str) -> Result<String> {
+    let (_status, stdout, _stderr) =
+        command_utils::pipe_through_shell::<String>("clang-format", &[], code.as_bytes())?;
+    Ok(String::from_utf8(stdout)?)
+}
+
+/// Builds the program whose entry module is `entry`. `#line` directives and
+/// allocation sites refer to the module files themselves.
+fn build_entry(args: &Args, transpiler: &mut transpiler::Transpiler, entry: &Path) -> Result<()> {
+    let program = modules::transpile_program(transpiler, entry)?;
+    if args.emit_cpp {
+        for unit in &program.units {
+            println!("// {}\n{}", unit.file_name, clang_format(&unit.code)?);
+        }
+        return Ok(());
+    }
+    let (flags, outputname) = build_flags(args, transpiler.status_exceptions);
+    if args.profile {
+        std::fs::write(format!("{}.symbols", outputname), &program.symbol_map)?;
+    }
+    modules::build(
+        &program,
+        Path::new(modules::BUILD_DIR),
+        &outputname,
+        &args.clang_path,
+        &flags,
+    )?;
+    Ok(())
+}
+
 fn main() -> Result<()> {
     let args = Args::parse();
 
+    if let Some(snapshot) = &args.summarize_heap {
+        print!(
+            "{}",
+            heap_summary::summarize(&std::fs::read_to_string(snapshot)?)?
+        );
+        return Ok(());
+    }
+
+    let mut transpiler = transpiler::Transpiler::new();
+    transpiler.status_exceptions = args.wasm || args.status_exceptions;
+    transpiler.feature_exceptions = !transpiler.status_exceptions;
+    transpiler.profile = args.profile;
+    transpiler.heap_profile = args.heap_profile;
+    transpiler.optimize = args.optimize;
+
+    if let Some(entry) = &args.entry {
+        return build_entry(&args, &mut transpiler, Path::new(entry));
+    }
+
     let mut input: String = String::new();
     std::io::stdin().read_to_string(&mut input)?;
 
-    let mut transpiler = transpiler::Transpiler::new();
-    transpiler.feature_exceptions = !args.wasm;
-    let cpp_code = js_to_cpp(transpiler, &input)?;
+    transpiler.source_name = "output.js".to_string();
+    let cpp_code = js_to_cpp(&mut transpiler, &input)?;
 
     if args.emit_cpp {
-        let (_status, stdout, _stderr) =
-            command_utils::pipe_through_shell::<String>("clang-format", &[], cpp_code.as_bytes())?;
-        println!("{}", String::from_utf8(stdout)?);
+        println!("{}", clang_format(&cpp_code)?);
     } else {
-        let mut flags = args.extra_flags.clone();
-        let mut extension = "".to_string();
-        if args.wasm {
-            flags.push("-fno-exceptions".to_string());
-            flags.push("--target=wasm32-wasi".to_string());
-            if let Ok(wasi_sdk_prefix) = std::env::var("WASI_SDK_PREFIX") {
-                flags.push(format!("--sysroot={}/share/wasi-sysroot", wasi_sdk_prefix));
-            }
-            extension = ".wasm".to_string();
-        } else {
-            flags.push("-DFEATURE_EXCEPTIONS".to_string());
+        let (flags, outputname) = build_flags(&args, transpiler.status_exceptions);
+        if args.profile {
+            // `#line` directives point at this copy of the input so that
+            // `perf annotate` and debuggers can show the JS source.
+            std::fs::write(&transpiler.source_name, &input)?;
+            std::fs::write(format!("{}.symbols", outputname), transpiler.symbol_map())?;
+        }
+        if args.heap_profile {
+            // Allocation sites refer to this copy of the input.
+            std::fs::write(&transpiler.source_name, &input)?;
         }
+        let global_sources = transpiler.global_sources();
         cpp_to_binary(
             cpp_code,
-            format!("output{}", extension),
+            outputname,
             args.clang_path,
             &flags,
+            &global_sources,
         )?;
     }
     Ok(())
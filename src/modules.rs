@@ -0,0 +1,370 @@
+use std::{
+    collections::{hash_map::DefaultHasher, BTreeMap, HashMap},
+    hash::{Hash, Hasher},
+    path::{Path, PathBuf},
+    process::Command,
+    sync::Mutex,
+};
+
+use anyhow::{anyhow, Result};
+use swc_ecma_ast::{Module, ModuleDecl, ModuleItem};
+
+use crate::transpiler::{ModuleInterface, Transpiler};
+
+/// Where `--entry` builds keep generated code and object files between
+/// builds.
+pub const BUILD_DIR: &str = "jsxx-build";
+
+/// The runtime sources every program links.
+pub const RUNTIME_SOURCES: &[&str] = &[
+    "runtime/js_primitives.cpp",
+    "runtime/js_value.cpp",
+    "runtime/exceptions.cpp",
+    "runtime/thread_pool.cpp",
+    "runtime/js_generator.cpp",
+    "runtime/js_promise.cpp",
+    "runtime/js_pipeline.cpp",
+    "runtime/js_regexp.cpp",
+    "runtime/js_template.cpp",
+    "runtime/event_loop.cpp",
+    "runtime/heap_profile.cpp",
+];
+
+/// A module of a multi-file program.
+struct SourceModule {
+    /// The path that `#line` directives and allocation sites refer to.
+    name: String,
+    namespace: String,
+    source: String,
+    module: Module,
+    /// The imported modules, by import specifier.
+    imports: BTreeMap<String, PathBuf>,
+}
+
+/// A generated translation unit.
+pub struct Unit {
+    pub file_name: String,
+    pub code: String,
+    /// The generated headers it includes.
+    pub headers: Vec<String>,
+}
+
+/// The generated code of a multi-file program.
+pub struct Program {
+    /// Generated headers, by file name.
+    pub headers: HashMap<String, String>,
+    pub units: Vec<Unit>,
+    pub global_sources: Vec<String>,
+    pub symbol_map: String,
+}
+
+/// Transpiles `entry` and the modules it imports, each into a translation
+/// unit of its own, plus one for `main()`.
+pub fn transpile_program(transpiler: &mut Transpiler, entry: &Path) -> Result<Program> {
+    let modules = load_modules(entry, transpiler.optimize)?;
+    let mut program = Program {
+        headers: HashMap::new(),
+        units: vec![],
+        global_sources: vec![],
+        symbol_map: String::new(),
+    };
+    let mut interfaces: HashMap<PathBuf, ModuleInterface> = HashMap::new();
+    for (path, module) in &modules {
+        let imports = module
+            .imports
+            .iter()
+            .map(|(specifier, path)| (specifier.clone(), interfaces[path].clone()))
+            .collect::<BTreeMap<String, ModuleInterface>>();
+        let headers = imports
+            .values()
+            .map(|import| format!("{}.hpp", import.namespace))
+            .chain(std::iter::once(format!("{}.hpp", module.namespace)))
+            .collect();
+        transpiler.set_source(&module.source);
+        transpiler.source_name = module.name.clone();
+        transpiler.globals = crate::all_globals();
+        let (interface, header, code) =
+            transpiler.transpile_es_module(&module.module, &module.namespace, imports)?;
+        for source in transpiler.global_sources() {
+            if !program.global_sources.contains(&source) {
+                program.global_sources.push(source);
+            }
+        }
+        program.symbol_map += &transpiler.symbol_map();
+        transpiler.symbols.clear();
+        program
+            .headers
+            .insert(format!("{}.hpp", module.namespace), header);
+        program.units.push(Unit {
+            file_name: format!("{}.cpp", module.namespace),
+            code,
+            headers,
+        });
+        interfaces.insert(path.clone(), interface);
+    }
+    let entry_interface = &interfaces[&modules.last().unwrap().0];
+    program.units.push(Unit {
+        file_name: "js_main.cpp".into(),
+        code: transpiler.transpile_entry_main(entry_interface),
+        headers: vec![format!("{}.hpp", entry_interface.namespace)],
+    });
+    Ok(program)
+}
+
+/// Loads `entry` and everything it imports, dependencies first. Only
+/// relative imports are supported, and imports may not be cyclic.
+fn load_modules(entry: &Path, optimize: bool) -> Result<Vec<(PathBuf, SourceModule)>> {
+    let entry = entry.canonicalize()?;
+    let root = entry.parent().unwrap().to_path_buf();
+    let mut modules = vec![];
+    let mut stack = vec![];
+    load_module(&entry, &root, optimize, &mut stack, &mut modules)?;
+    let mut namespaces = HashMap::new();
+    for (path, module) in &modules {
+        if let Some(other) = namespaces.insert(&module.namespace, path) {
+            return Err(anyhow!(
+                "{} and {} map to the same C++ namespace",
+                other.display(),
+                path.display()
+            ));
+        }
+    }
+    Ok(modules)
+}
+
+fn load_module(
+    path: &Path,
+    root: &Path,
+    optimize: bool,
+    stack: &mut Vec<PathBuf>,
+    modules: &mut Vec<(PathBuf, SourceModule)>,
+) -> Result<()> {
+    if modules.iter().any(|(loaded, _)| loaded == path) {
+        return Ok(());
+    }
+    if let Some(pos) = stack.iter().position(|visiting| visiting == path) {
+        let cycle = stack[pos..]
+            .iter()
+            .chain(std::iter::once(&path.to_path_buf()))
+            .map(|path| path.display().to_string())
+            .collect::<Vec<String>>()
+            .join(" -> ");
+        return Err(anyhow!("Cyclic imports are not supported: {}", cycle));
+    }
+    let source = std::fs::read_to_string(path)
+        .map_err(|err| anyhow!("Can’t read {}: {}", path.display(), err))?;
+    let module = crate::parse_module(&source, optimize)?;
+    let dir = path.parent().unwrap();
+    let mut imports = BTreeMap::new();
+    for specifier in import_specifiers(&module) {
+        if !specifier.starts_with("./") && !specifier.starts_with("../") {
+            return Err(anyhow!(
+                "Only relative imports are supported, not {:?}",
+                specifier
+            ));
+        }
+        let import = dir.join(&specifier).canonicalize().map_err(|err| {
+            anyhow!(
+                "Can’t resolve {:?} in {}: {}",
+                specifier,
+                path.display(),
+                err
+            )
+        })?;
+        imports.insert(specifier, import);
+    }
+    stack.push(path.to_path_buf());
+    for import in imports.values() {
+        load_module(import, root, optimize, stack, modules)?;
+    }
+    stack.pop();
+
+    let name = path
+        .strip_prefix(root)
+        .unwrap_or(path)
+        .display()
+        .to_string();
+    let namespace = format!(
+        "js_module_{}",
+        Path::new(&name)
+            .with_extension("")
+            .display()
+            .to_string()
+            .chars()
+            .map(|c| if c.is_ascii_alphanumeric() { c } else { '_' })
+            .collect::<String>()
+    );
+    modules.push((
+        path.to_path_buf(),
+        SourceModule {
+            name,
+            namespace,
+            source,
+            module,
+            imports,
+        },
+    ));
+    Ok(())
+}
+
+fn import_specifiers(module: &Module) -> Vec<String> {
+    module
+        .body
+        .iter()
+        .filter_map(|item| match item {
+            ModuleItem::ModuleDecl(ModuleDecl::Import(import_decl)) => Some(&import_decl.src),
+            ModuleItem::ModuleDecl(ModuleDecl::ExportNamed(named_export)) => {
+                named_export.src.as_ref()
+            }
+            ModuleItem::ModuleDecl(ModuleDecl::ExportAll(export_all)) => Some(&export_all.src),
+            _ => None,
+        })
+        .map(|src| src.value.to_string())
+        .collect()
+}
+
+/// A translation unit to compile, unless the object file from a previous
+/// build is still up to date.
+struct CompileJob {
+    source: PathBuf,
+    object: PathBuf,
+    /// Stored next to the object file, to tell whether it is up to date.
+    stamp: PathBuf,
+    key: String,
+}
+
+/// Compiles the translation units of `program` and the runtime in parallel
+/// and links them into `output`. Object files are kept in `build_dir`, and
+/// only translation units whose code, included headers or flags changed
+/// since the last build are recompiled.
+///
+/// Returns the number of translation units compiled.
+pub fn build(
+    program: &Program,
+    build_dir: &Path,
+    output: &str,
+    clang_path: &str,
+    flags: &[String],
+) -> Result<usize> {
+    std::fs::create_dir_all(build_dir)?;
+    for (file_name, code) in &program.headers {
+        write_if_changed(&build_dir.join(file_name), code)?;
+    }
+
+    // Everything a translation unit’s object file depends on besides its own
+    // code and the generated headers it includes.
+    let mut common = DefaultHasher::new();
+    clang_path.hash(&mut common);
+    flags.hash(&mut common);
+    let mut runtime_headers: Vec<PathBuf> = std::fs::read_dir("runtime")?
+        .map(|entry| Ok(entry?.path()))
+        .collect::<Result<Vec<PathBuf>>>()?
+        .into_iter()
+        .filter(|path| path.extension().map_or(false, |ext| ext == "hpp"))
+        .collect();
+    runtime_headers.sort();
+    for header in &runtime_headers {
+        std::fs::read_to_string(header)?.hash(&mut common);
+    }
+    let job = |source: PathBuf, code: &str, headers: &[String]| {
+        let mut hasher = common.clone();
+        code.hash(&mut hasher);
+        for header in headers {
+            program.headers[header].hash(&mut hasher);
+        }
+        let stem = source
+            .with_extension("")
+            .display()
+            .to_string()
+            .replace(|c: char| !c.is_ascii_alphanumeric(), "_");
+        CompileJob {
+            object: build_dir.join(format!("{}.o", stem)),
+            stamp: build_dir.join(format!("{}.stamp", stem)),
+            key: format!("{:016x}", hasher.finish()),
+            source,
+        }
+    };
+    let mut jobs = vec![];
+    for unit in &program.units {
+        let source = build_dir.join(&unit.file_name);
+        write_if_changed(&source, &unit.code)?;
+        jobs.push(job(source, &unit.code, &unit.headers));
+    }
+    for source in RUNTIME_SOURCES
+        .iter()
+        .map(|source| source.to_string())
+        .chain(program.global_sources.iter().cloned())
+    {
+        let code = std::fs::read_to_string(&source)?;
+        jobs.push(job(PathBuf::from(source), &code, &[]));
+    }
+
+    let objects: Vec<PathBuf> = jobs.iter().map(|job| job.object.clone()).collect();
+    let stale: Vec<CompileJob> = jobs
+        .into_iter()
+        .filter(|job| {
+            !job.object.exists()
+                || std::fs::read_to_string(&job.stamp).map_or(true, |key| key != job.key)
+        })
+        .collect();
+    let compiled = stale.len();
+    let include_dir = build_dir.display().to_string();
+    run_parallel(stale, |job| {
+        let status = Command::new(clang_path)
+            .args(flags)
+            .args(["--std=c++20", "-I.", "-I", &include_dir, "-c"])
+            .arg(&job.source)
+            .arg("-o")
+            .arg(&job.object)
+            .status()?;
+        if !status.success() {
+            return Err(anyhow!("Compiling {} failed", job.source.display()));
+        }
+        std::fs::write(&job.stamp, &job.key)?;
+        Ok(())
+    })?;
+
+    let status = Command::new(clang_path)
+        .args(flags)
+        .arg("-o")
+        .arg(output)
+        .args(&objects)
+        .status()?;
+    if !status.success() {
+        return Err(anyhow!("Linking {} failed", output));
+    }
+    Ok(compiled)
+}
+
+/// Runs `f` on every job, on as many threads as there are cores.
+fn run_parallel<T: Send>(jobs: Vec<T>, f: impl Fn(T) -> Result<()> + Sync) -> Result<()> {
+    let threads = std::thread::available_parallelism().map_or(1, |n| n.get());
+    let jobs = Mutex::new(jobs.into_iter());
+    let errors = Mutex::new(vec![]);
+    std::thread::scope(|scope| {
+        for _ in 0..threads {
+            scope.spawn(|| loop {
+                let job = match jobs.lock().unwrap().next() {
+                    Some(job) => job,
+                    None => break,
+                };
+                if let Err(err) = f(job) {
+                    errors.lock().unwrap().push(err.to_string());
+                }
+            });
+        }
+    });
+    let errors = errors.into_inner().unwrap();
+    if !errors.is_empty() {
+        return Err(anyhow!(errors.join("\n")));
+    }
+    Ok(())
+}
+
+/// Leaves unchanged files alone, so their timestamps stay put.
+fn write_if_changed(path: &Path, contents: &str) -> Result<()> {
+    if std::fs::read_to_string(path).map_or(true, |old| old != contents) {
+        std::fs::write(path, contents)?;
+    }
+    Ok(())
+}
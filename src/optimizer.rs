@@ -0,0 +1,245 @@
+//! Constant folding and dead-code elimination, enabled with `-O`.
+//!
+//! Folding follows the runtime’s semantics where they differ from the spec’s
+//! (only positive numbers are truthy, `%` works on `uint32`s, numbers
+//! stringify like `std::to_string`), so `-O` never changes what a program
+//! prints.
+
+use swc_common::DUMMY_SP;
+use swc_ecma_ast::*;
+use swc_ecma_visit::{VisitMut, VisitMutWith};
+
+pub fn optimize(module: &mut Module) {
+    module.visit_mut_with(&mut Optimizer);
+}
+
+struct Optimizer;
+
+impl VisitMut for Optimizer {
+    fn visit_mut_expr(&mut self, expr: &mut Expr) {
+        expr.visit_mut_children_with(self);
+        if let Some(folded) = fold(expr) {
+            *expr = folded;
+        }
+    }
+
+    fn visit_mut_stmt(&mut self, stmt: &mut Stmt) {
+        stmt.visit_mut_children_with(self);
+        let empty = || Stmt::Empty(EmptyStmt { span: DUMMY_SP });
+        let replacement = match stmt {
+            Stmt::If(if_stmt) => match constant(&if_stmt.test) {
+                Some(test) if test.truthy() => std::mem::replace(&mut *if_stmt.cons, empty()),
+                Some(_) => if_stmt.alt.take().map(|alt| *alt).unwrap_or_else(empty),
+                None => return,
+            },
+            Stmt::While(while_stmt) => match constant(&while_stmt.test) {
+                Some(test) if !test.truthy() => empty(),
+                _ => return,
+            },
+            Stmt::For(for_stmt) => match for_stmt.test.as_deref().and_then(constant) {
+                Some(test) if !test.truthy() => match for_stmt.init.take() {
+                    Some(VarDeclOrExpr::VarDecl(var_decl)) => Stmt::Decl(Decl::Var(var_decl)),
+                    Some(VarDeclOrExpr::Expr(expr)) => Stmt::Expr(ExprStmt {
+                        span: for_stmt.span,
+                        expr,
+                    }),
+                    None => empty(),
+                },
+                _ => return,
+            },
+            _ => return,
+        };
+        *stmt = replacement;
+    }
+
+    fn visit_mut_stmts(&mut self, stmts: &mut Vec<Stmt>) {
+        stmts.visit_mut_children_with(self);
+        // Nothing after a jump runs, except that function declarations are
+        // hoisted.
+        if let Some(idx) = stmts.iter().position(|stmt| {
+            matches!(
+                stmt,
+                Stmt::Return(_) | Stmt::Throw(_) | Stmt::Break(_) | Stmt::Continue(_)
+            )
+        }) {
+            let unreachable = stmts.split_off(idx + 1);
+            stmts.extend(
+                unreachable
+                    .into_iter()
+                    .filter(|stmt| matches!(stmt, Stmt::Decl(Decl::Fn(_)))),
+            );
+        }
+        stmts.retain(|stmt| !matches!(stmt, Stmt::Empty(_)));
+    }
+}
+
+/// A literal value known at compile time.
+enum Const {
+    Num(f64),
+    /// The string’s value and its escaped source text without quotes.
+    Str(String, String),
+    Bool(bool),
+}
+
+impl Const {
+    fn truthy(&self) -> bool {
+        match self {
+            Const::Num(n) => *n > 0.0,
+            Const::Str(value, _) => !value.is_empty(),
+            Const::Bool(b) => *b,
+        }
+    }
+
+    /// Strings aren’t converted: the runtime’s `std::stod` may throw.
+    fn to_double(&self) -> Option<f64> {
+        match self {
+            Const::Num(n) => Some(*n),
+            Const::Bool(b) => Some(if *b { 1.0 } else { 0.0 }),
+            Const::Str(..) => None,
+        }
+    }
+
+    /// Returns the value and the escaped source text.
+    fn to_string(&self) -> (String, String) {
+        match self {
+            Const::Str(value, raw) => (value.clone(), raw.clone()),
+            Const::Num(n) => (format!("{:.6}", n), format!("{:.6}", n)),
+            Const::Bool(b) => (b.to_string(), b.to_string()),
+        }
+    }
+
+    fn loosely_equals(&self, other: &Const) -> Option<bool> {
+        match self {
+            Const::Num(n) => Some(*n == other.to_double()?),
+            Const::Str(value, _) => Some(*value == other.to_string().0),
+            Const::Bool(b) => Some(*b == other.truthy()),
+        }
+    }
+
+    fn less_than(&self, other: &Const) -> Option<bool> {
+        match self {
+            Const::Num(n) => Some(*n < other.to_double()?),
+            _ => Some(false),
+        }
+    }
+
+    fn into_expr(self) -> Option<Expr> {
+        let span = DUMMY_SP;
+        let lit = match self {
+            // The transpiler can’t spell NaN or infinities as literals.
+            Const::Num(value) if !value.is_finite() => return None,
+            Const::Num(value) => Lit::Num(Number {
+                span,
+                value,
+                raw: None,
+            }),
+            Const::Str(value, raw) => Lit::Str(Str {
+                span,
+                value: value.into(),
+                raw: Some(format!("\"{}\"", raw).into()),
+            }),
+            Const::Bool(value) => Lit::Bool(Bool { span, value }),
+        };
+        Some(Expr::Lit(lit))
+    }
+}
+
+fn constant(expr: &Expr) -> Option<Const> {
+    match expr {
+        Expr::Lit(Lit::Num(num)) => Some(Const::Num(num.value)),
+        Expr::Lit(Lit::Str(str)) => {
+            let raw = str
+                .raw
+                .as_ref()
+                .map(|raw| raw[1..raw.len() - 1].to_string())
+                .unwrap_or(str.value.to_string());
+            Some(Const::Str(str.value.to_string(), raw))
+        }
+        Expr::Lit(Lit::Bool(b)) => Some(Const::Bool(b.value)),
+        Expr::Paren(paren_expr) => constant(&paren_expr.expr),
+        _ => None,
+    }
+}
+
+/// Returns the simplified form of `expr`, if there is one. Operands have
+/// already been folded.
+fn fold(expr: &mut Expr) -> Option<Expr> {
+    match expr {
+        Expr::Paren(paren_expr) if matches!(*paren_expr.expr, Expr::Lit(_)) => {
+            Some(*paren_expr.expr.clone())
+        }
+        Expr::Unary(unary_expr) => {
+            let arg = constant(&unary_expr.arg)?;
+            match unary_expr.op {
+                UnaryOp::Bang => Const::Bool(!arg.truthy()).into_expr(),
+                UnaryOp::Minus => Const::Num(-arg.to_double()?).into_expr(),
+                _ => None,
+            }
+        }
+        Expr::Cond(cond_expr) => {
+            let branch = if constant(&cond_expr.test)?.truthy() {
+                &mut cond_expr.cons
+            } else {
+                &mut cond_expr.alt
+            };
+            Some(std::mem::replace(
+                &mut **branch,
+                Expr::Invalid(Invalid { span: DUMMY_SP }),
+            ))
+        }
+        Expr::Bin(bin_expr) => {
+            let left = constant(&bin_expr.left)?;
+            if let BinaryOp::LogicalAnd | BinaryOp::LogicalOr = bin_expr.op {
+                let take_left = left.truthy() == (bin_expr.op == BinaryOp::LogicalOr);
+                let operand = if take_left {
+                    &mut bin_expr.left
+                } else {
+                    &mut bin_expr.right
+                };
+                return Some(std::mem::replace(
+                    &mut **operand,
+                    Expr::Invalid(Invalid { span: DUMMY_SP }),
+                ));
+            }
+            let right = constant(&bin_expr.right)?;
+            fold_binary(bin_expr.op, &left, &right)?.into_expr()
+        }
+        _ => None,
+    }
+}
+
+fn fold_binary(op: BinaryOp, left: &Const, right: &Const) -> Option<Const> {
+    let arithmetic = |f: fn(f64, f64) -> f64| match left {
+        Const::Num(l) => Some(Const::Num(f(*l, right.to_double()?))),
+        _ => None,
+    };
+    Some(match op {
+        BinaryOp::Add => match left {
+            Const::Str(value, raw) => {
+                let (right_value, right_raw) = right.to_string();
+                Const::Str(value.clone() + &right_value, raw.clone() + &right_raw)
+            }
+            _ => arithmetic(|l, r| l + r)?,
+        },
+        BinaryOp::Sub => arithmetic(|l, r| l - r)?,
+        BinaryOp::Mul => arithmetic(|l, r| l * r)?,
+        BinaryOp::Div => arithmetic(|l, r| l / r)?,
+        BinaryOp::Mod => {
+            // Casting to `uint32_t` is only defined for values in range.
+            let as_u32 = |n: f64| (0.0..4294967296.0).contains(&n).then(|| n as u32);
+            let l = match left {
+                Const::Num(l) => as_u32(*l)?,
+                _ => return None,
+            };
+            let r = as_u32(right.to_double()?).filter(|r| *r != 0)?;
+            Const::Num((l % r) as f64)
+        }
+        BinaryOp::EqEq | BinaryOp::EqEqEq => Const::Bool(left.loosely_equals(right)?),
+        BinaryOp::NotEq | BinaryOp::NotEqEq => Const::Bool(!left.loosely_equals(right)?),
+        BinaryOp::Lt => Const::Bool(left.less_than(right)?),
+        BinaryOp::GtEq => Const::Bool(!left.less_than(right)?),
+        BinaryOp::LtEq => Const::Bool(left.loosely_equals(right)? || left.less_than(right)?),
+        BinaryOp::Gt => Const::Bool(!(left.loosely_equals(right)? || left.less_than(right)?)),
+        _ => return None,
+    })
+}
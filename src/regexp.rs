@@ -0,0 +1,1190 @@
+//! Ahead-of-time compilation of regular expression literals.
+//!
+//! Every literal becomes C++ code specialized to its pattern: a backtracking
+//! matcher with one state per position in the pattern, used by `exec`,
+//! `match` and `replace`, and, for patterns that allow it, a DFA used by
+//! `test`. Like the rest of the runtime, matching works on bytes.
+
+use std::collections::HashMap;
+use std::fmt::Write;
+
+use anyhow::{anyhow, Result};
+
+/// Upper bounds that keep the generated code small. Patterns that exceed
+/// them only get the backtracking matcher.
+const MAX_NFA_STATES: usize = 2048;
+const MAX_DFA_STATES: usize = 256;
+
+/// Returns the C++ definitions for the literal `/pattern/flags`, ending in a
+/// `JSRegExpPattern` named `js_re_<id>`.
+pub fn compile(id: usize, pattern: &str, flags: &str) -> Result<String> {
+    let flags = Flags::parse(flags)?;
+    let mut parser = Parser {
+        chars: pattern.chars().collect(),
+        pos: 0,
+        groups: 0,
+        flags: &flags,
+    };
+    let node = parser.parse()?;
+    let group_count = parser.groups + 1;
+    let prefix = format!("js_re_{}", id);
+
+    let mut backtracker = Backtracker {
+        prefix: prefix.clone(),
+        multiline: flags.multiline,
+        bodies: vec![],
+        tables: vec![],
+        loops: 0,
+    };
+    let accept = backtracker.add("st.captures[1] = pos;\nreturn true;".into());
+    let entry = backtracker.compile(&node, accept);
+
+    let mut code = String::new();
+    for table in &backtracker.tables {
+        code += table;
+    }
+    let mut cases = String::new();
+    for (state, body) in backtracker.bodies.iter().enumerate() {
+        writeln!(cases, "case {}: {{\n{}\n}}", state, body)?;
+    }
+    writeln!(
+        code,
+        "static bool {prefix}_match(JSRegExpState &st, size_t pos) {{\n\
+         size_t state = {entry}, aux = 0;\n\
+         while (true) {{\n\
+         switch (state) {{\n\
+         {cases}\
+         }}\n\
+         state = js_regexp_backtrack(st, pos, aux);\n\
+         if (state == std::string_view::npos) return false;\n\
+         }}\n\
+         }}",
+        prefix = prefix,
+        entry = entry,
+        cases = cases
+    )?;
+
+    // Patterns anchored at the start, and sticky ones, are only tried at one
+    // position. Others skip ahead to their first byte if it is fixed.
+    let single_position = flags.sticky || (starts_with_start(&node) && !flags.multiline);
+    let skip = match first_byte(&node) {
+        Some(byte) if !single_position => format!(
+            "const void *next = memchr(input.data() + pos, {}, input.size() - pos);\n\
+             if (next == nullptr) return false;\n\
+             pos = static_cast<const char *>(next) - input.data();\n",
+            byte
+        ),
+        _ => "".into(),
+    };
+    let loop_state = match backtracker.loops {
+        0 => "size_t *counts = nullptr, *starts = nullptr;".into(),
+        loops => format!("size_t counts[{0}], starts[{0}];", loops),
+    };
+    writeln!(
+        code,
+        "static bool {prefix}_exec(std::string_view input, size_t from, size_t *captures) {{\n\
+         {loop_state}\n\
+         JSRegExpState st{{input, captures, counts, starts, {{}}}};\n\
+         for (size_t pos = from; pos <= input.size(); pos++) {{\n\
+         {skip}\
+         std::fill(captures, captures + {captures}, std::string_view::npos);\n\
+         captures[0] = pos;\n\
+         if ({prefix}_match(st, pos)) return true;\n\
+         {stop}\
+         }}\n\
+         return false;\n\
+         }}",
+        prefix = prefix,
+        loop_state = loop_state,
+        skip = skip,
+        captures = 2 * group_count,
+        stop = if single_position { "break;\n" } else { "" },
+    )?;
+
+    let test = match (flags.global || flags.sticky, Dfa::build(&node, &flags)) {
+        (false, Some(dfa)) => {
+            code += &dfa.to_cpp(&prefix);
+            format!("&{}_test", prefix)
+        }
+        _ => "nullptr".into(),
+    };
+    writeln!(
+        code,
+        "static const JSRegExpPattern {prefix}{{{source}, {flags}, {group_count}, &{prefix}_exec, {test}}};",
+        prefix = prefix,
+        source = cpp_string(pattern.as_bytes()),
+        flags = cpp_string(flags.source.as_bytes()),
+        group_count = group_count,
+        test = test
+    )?;
+    Ok(code)
+}
+
+struct Flags {
+    source: String,
+    global: bool,
+    ignore_case: bool,
+    multiline: bool,
+    dot_all: bool,
+    sticky: bool,
+}
+
+impl Flags {
+    fn parse(flags: &str) -> Result<Flags> {
+        let mut result = Flags {
+            source: flags.to_string(),
+            global: false,
+            ignore_case: false,
+            multiline: false,
+            dot_all: false,
+            sticky: false,
+        };
+        for flag in flags.chars() {
+            let field = match flag {
+                'g' => &mut result.global,
+                'i' => &mut result.ignore_case,
+                'm' => &mut result.multiline,
+                's' => &mut result.dot_all,
+                'y' => &mut result.sticky,
+                _ => return Err(anyhow!("Unsupported regular expression flag {}", flag)),
+            };
+            *field = true;
+        }
+        Ok(result)
+    }
+}
+
+#[derive(Clone, Copy, PartialEq, Eq, Hash)]
+struct ByteSet([u64; 4]);
+
+impl ByteSet {
+    fn empty() -> ByteSet {
+        ByteSet([0; 4])
+    }
+
+    fn byte(byte: u8) -> ByteSet {
+        ByteSet::range(byte, byte)
+    }
+
+    fn range(lo: u8, hi: u8) -> ByteSet {
+        let mut set = ByteSet::empty();
+        for byte in lo..=hi {
+            set.0[(byte >> 6) as usize] |= 1 << (byte & 63);
+        }
+        set
+    }
+
+    fn contains(&self, byte: u8) -> bool {
+        self.0[(byte >> 6) as usize] & (1 << (byte & 63)) != 0
+    }
+
+    fn union(&self, other: &ByteSet) -> ByteSet {
+        let mut set = *self;
+        for (word, other) in set.0.iter_mut().zip(other.0) {
+            *word |= other;
+        }
+        set
+    }
+
+    fn negate(&self) -> ByteSet {
+        ByteSet(self.0.map(|word| !word))
+    }
+
+    /// Adds the other case of every ASCII letter.
+    fn fold_case(&self) -> ByteSet {
+        let mut set = *self;
+        for byte in b'A'..=b'Z' {
+            if self.contains(byte) || self.contains(byte.to_ascii_lowercase()) {
+                set = set
+                    .union(&ByteSet::byte(byte))
+                    .union(&ByteSet::byte(byte.to_ascii_lowercase()));
+            }
+        }
+        set
+    }
+
+    fn single(&self) -> Option<u8> {
+        let ranges = self.ranges();
+        match ranges[..] {
+            [(lo, hi)] if lo == hi => Some(lo),
+            _ => None,
+        }
+    }
+
+    /// The set as inclusive ranges, in ascending order.
+    fn ranges(&self) -> Vec<(u8, u8)> {
+        let mut ranges: Vec<(u8, u8)> = vec![];
+        for byte in 0..=255u8 {
+            if !self.contains(byte) {
+                continue;
+            }
+            match ranges.last_mut() {
+                Some((_, hi)) if *hi as u16 + 1 == byte as u16 => *hi = byte,
+                _ => ranges.push((byte, byte)),
+            }
+        }
+        ranges
+    }
+}
+
+fn digits() -> ByteSet {
+    ByteSet::range(b'0', b'9')
+}
+
+fn word_chars() -> ByteSet {
+    digits()
+        .union(&ByteSet::range(b'a', b'z'))
+        .union(&ByteSet::range(b'A', b'Z'))
+        .union(&ByteSet::byte(b'_'))
+}
+
+fn whitespace() -> ByteSet {
+    ByteSet::range(b'\t', b'\r').union(&ByteSet::byte(b' '))
+}
+
+#[derive(Clone, Copy, PartialEq)]
+enum Assertion {
+    Start,
+    End,
+    WordBoundary,
+    NotWordBoundary,
+}
+
+enum Node {
+    /// One byte out of a set.
+    Set(ByteSet),
+    Literal(Vec<u8>),
+    Seq(Vec<Node>),
+    Alt(Vec<Node>),
+    /// A group, with its capture index if it is capturing.
+    Group(Option<usize>, Box<Node>),
+    Repeat {
+        node: Box<Node>,
+        min: u32,
+        max: Option<u32>,
+        greedy: bool,
+    },
+    Assert(Assertion),
+}
+
+/// What an escape sequence stands for.
+enum Escape {
+    Char(char),
+    Set(ByteSet),
+}
+
+struct Parser<'a> {
+    chars: Vec<char>,
+    pos: usize,
+    groups: usize,
+    flags: &'a Flags,
+}
+
+impl<'a> Parser<'a> {
+    fn parse(&mut self) -> Result<Node> {
+        let node = self.parse_alt()?;
+        match self.peek() {
+            None => Ok(node),
+            Some(_) => Err(anyhow!("Unmatched ')' in regular expression")),
+        }
+    }
+
+    fn peek(&self) -> Option<char> {
+        self.chars.get(self.pos).copied()
+    }
+
+    fn next(&mut self) -> Result<char> {
+        let c = self
+            .peek()
+            .ok_or(anyhow!("Unexpected end of regular expression"))?;
+        self.pos += 1;
+        Ok(c)
+    }
+
+    fn eat(&mut self, c: char) -> bool {
+        if self.peek() == Some(c) {
+            self.pos += 1;
+            return true;
+        }
+        false
+    }
+
+    fn parse_alt(&mut self) -> Result<Node> {
+        let mut alternatives = vec![self.parse_seq()?];
+        while self.eat('|') {
+            alternatives.push(self.parse_seq()?);
+        }
+        Ok(match alternatives.len() {
+            1 => alternatives.pop().unwrap(),
+            _ => Node::Alt(alternatives),
+        })
+    }
+
+    fn parse_seq(&mut self) -> Result<Node> {
+        let mut items: Vec<Node> = vec![];
+        while !matches!(self.peek(), None | Some('|') | Some(')')) {
+            let atom = self.parse_atom()?;
+            let item = self.parse_quantifier(atom)?;
+            // Runs of single bytes are compared as one string.
+            match (items.last_mut(), &item) {
+                (Some(Node::Literal(bytes)), Node::Set(set)) if set.single().is_some() => {
+                    bytes.push(set.single().unwrap())
+                }
+                (Some(Node::Set(prev)), Node::Set(set))
+                    if prev.single().is_some() && set.single().is_some() =>
+                {
+                    let bytes = vec![prev.single().unwrap(), set.single().unwrap()];
+                    *items.last_mut().unwrap() = Node::Literal(bytes);
+                }
+                _ => items.push(item),
+            }
+        }
+        Ok(match items.len() {
+            1 => items.pop().unwrap(),
+            _ => Node::Seq(items),
+        })
+    }
+
+    fn parse_atom(&mut self) -> Result<Node> {
+        Ok(match self.next()? {
+            '(' => {
+                let index = if self.eat('?') {
+                    if !self.eat(':') {
+                        return Err(anyhow!(
+                            "Lookaround and named groups are not supported in regular expressions"
+                        ));
+                    }
+                    None
+                } else {
+                    self.groups += 1;
+                    Some(self.groups)
+                };
+                let inner = self.parse_alt()?;
+                if !self.eat(')') {
+                    return Err(anyhow!("Unterminated group in regular expression"));
+                }
+                Node::Group(index, Box::new(inner))
+            }
+            '[' => Node::Set(self.parse_class()?),
+            '.' => Node::Set(if self.flags.dot_all {
+                ByteSet::range(0, 255)
+            } else {
+                ByteSet::byte(b'\n').union(&ByteSet::byte(b'\r')).negate()
+            }),
+            '^' => Node::Assert(Assertion::Start),
+            '$' => Node::Assert(Assertion::End),
+            '\\' => match self.next()? {
+                'b' => Node::Assert(Assertion::WordBoundary),
+                'B' => Node::Assert(Assertion::NotWordBoundary),
+                '1'..='9' => {
+                    return Err(anyhow!(
+                        "Backreferences are not supported in regular expressions"
+                    ))
+                }
+                c => match self.parse_escape(c)? {
+                    Escape::Char(c) => self.char_node(c),
+                    Escape::Set(set) => Node::Set(set),
+                },
+            },
+            '*' | '+' | '?' => return Err(anyhow!("Nothing to repeat in regular expression")),
+            c => self.char_node(c),
+        })
+    }
+
+    fn char_node(&self, c: char) -> Node {
+        if !c.is_ascii() {
+            let mut bytes = [0; 4];
+            return Node::Literal(c.encode_utf8(&mut bytes).as_bytes().to_vec());
+        }
+        let set = ByteSet::byte(c as u8);
+        Node::Set(if self.flags.ignore_case {
+            set.fold_case()
+        } else {
+            set
+        })
+    }
+
+    /// Parses the escape sequence after `\c`.
+    fn parse_escape(&mut self, c: char) -> Result<Escape> {
+        Ok(match c {
+            'd' => Escape::Set(digits()),
+            'D' => Escape::Set(digits().negate()),
+            'w' => Escape::Set(word_chars()),
+            'W' => Escape::Set(word_chars().negate()),
+            's' => Escape::Set(whitespace()),
+            'S' => Escape::Set(whitespace().negate()),
+            'n' => Escape::Char('\n'),
+            'r' => Escape::Char('\r'),
+            't' => Escape::Char('\t'),
+            'v' => Escape::Char('\x0b'),
+            'f' => Escape::Char('\x0c'),
+            '0' => Escape::Char('\0'),
+            'x' => Escape::Char(self.parse_hex(2)?),
+            'u' => Escape::Char(self.parse_hex(4)?),
+            'c' => match self.next()? {
+                letter if letter.is_ascii_alphabetic() => {
+                    Escape::Char(char::from(letter as u8 % 32))
+                }
+                _ => return Err(anyhow!("Invalid control escape in regular expression")),
+            },
+            c => Escape::Char(c),
+        })
+    }
+
+    fn parse_hex(&mut self, digits: usize) -> Result<char> {
+        let mut value = 0;
+        for _ in 0..digits {
+            let digit = self
+                .next()?
+                .to_digit(16)
+                .ok_or(anyhow!("Invalid hex escape in regular expression"))?;
+            value = value * 16 + digit;
+        }
+        char::from_u32(value).ok_or(anyhow!("Invalid hex escape in regular expression"))
+    }
+
+    fn parse_class(&mut self) -> Result<ByteSet> {
+        let negate = self.eat('^');
+        let mut set = ByteSet::empty();
+        loop {
+            let c = self.next()?;
+            if c == ']' {
+                break;
+            }
+            let lo = self.parse_class_atom(c)?;
+            let is_range = self.peek() == Some('-')
+                && !matches!(self.chars.get(self.pos + 1), None | Some(']'));
+            set = match lo {
+                Escape::Char(lo) if is_range => {
+                    self.pos += 1;
+                    let c = self.next()?;
+                    match self.parse_class_atom(c)? {
+                        Escape::Char(hi) if lo <= hi => {
+                            set.union(&ByteSet::range(class_byte(lo)?, class_byte(hi)?))
+                        }
+                        _ => return Err(anyhow!("Invalid range in regular expression class")),
+                    }
+                }
+                Escape::Char(c) => set.union(&ByteSet::byte(class_byte(c)?)),
+                Escape::Set(other) => set.union(&other),
+            };
+        }
+        if self.flags.ignore_case {
+            set = set.fold_case();
+        }
+        Ok(if negate { set.negate() } else { set })
+    }
+
+    fn parse_class_atom(&mut self, c: char) -> Result<Escape> {
+        if c != '\\' {
+            return Ok(Escape::Char(c));
+        }
+        match self.next()? {
+            'b' => Ok(Escape::Char('\x08')),
+            c => self.parse_escape(c),
+        }
+    }
+
+    fn parse_quantifier(&mut self, atom: Node) -> Result<Node> {
+        let (min, max) = match self.peek() {
+            Some('{') => match self.parse_braces() {
+                Some(bounds) => bounds,
+                None => return Ok(atom),
+            },
+            Some(c @ ('*' | '+' | '?')) => {
+                self.pos += 1;
+                match c {
+                    '*' => (0, None),
+                    '+' => (1, None),
+                    _ => (0, Some(1)),
+                }
+            }
+            _ => return Ok(atom),
+        };
+        if let Node::Assert(_) = atom {
+            return Err(anyhow!("Nothing to repeat in regular expression"));
+        }
+        if max.map_or(false, |max| max < min) {
+            return Err(anyhow!(
+                "Numbers out of order in regular expression quantifier"
+            ));
+        }
+        let greedy = !self.eat('?');
+        Ok(Node::Repeat {
+            node: Box::new(atom),
+            min,
+            max,
+            greedy,
+        })
+    }
+
+    /// Parses `{n}`, `{n,}` or `{n,m}`. Anything else leaves the `{` to be
+    /// matched literally.
+    fn parse_braces(&mut self) -> Option<(u32, Option<u32>)> {
+        let rest: String = self.chars[self.pos..].iter().collect();
+        let end = rest.find('}')?;
+        let (min, max) = match rest[1..end].split_once(',') {
+            None => {
+                let n = rest[1..end].parse().ok()?;
+                (n, Some(n))
+            }
+            Some((min, "")) => (min.parse().ok()?, None),
+            Some((min, max)) => (min.parse().ok()?, Some(max.parse().ok()?)),
+        };
+        self.pos += rest[..=end].chars().count();
+        Some((min, max))
+    }
+}
+
+fn class_byte(c: char) -> Result<u8> {
+    if !c.is_ascii() {
+        return Err(anyhow!(
+            "Non-ASCII characters in regular expression classes are not supported"
+        ));
+    }
+    Ok(c as u8)
+}
+
+/// Generates the matcher as a single C++ function, with one `case` of a
+/// `switch` per state. A state matches its part of the pattern at `pos` and
+/// moves on with `continue`, or fails with `break`. Choices that may have to
+/// be tried later, and the changes to undo before trying them, go on
+/// `st.stack`, so long inputs don’t nest C++ calls.
+struct Backtracker {
+    prefix: String,
+    multiline: bool,
+    bodies: Vec<String>,
+    tables: Vec<String>,
+    /// Number of quantified subpatterns that need an iteration counter.
+    loops: usize,
+}
+
+impl Backtracker {
+    fn add(&mut self, body: String) -> usize {
+        self.bodies.push(body);
+        self.bodies.len() - 1
+    }
+
+    /// Returns the entry state of a matcher for `node` followed by `next`.
+    fn compile(&mut self, node: &Node, next: usize) -> usize {
+        match node {
+            Node::Set(set) => {
+                let condition = self.condition(set);
+                self.add(format!(
+                    "if (pos >= st.input.size()) break;\n\
+                     unsigned char c = st.input[pos];\n\
+                     if (!({})) break;\n\
+                     {}",
+                    condition,
+                    jump(next, "pos + 1")
+                ))
+            }
+            Node::Literal(bytes) => self.add(format!(
+                "if (st.input.substr(pos, {len}) != std::string_view{{{lit}, {len}}}) break;\n\
+                 {next}",
+                len = bytes.len(),
+                lit = cpp_string(bytes),
+                next = jump(next, &format!("pos + {}", bytes.len()))
+            )),
+            Node::Seq(items) => {
+                let mut next = next;
+                for item in items.iter().rev() {
+                    next = self.compile(item, next);
+                }
+                next
+            }
+            Node::Alt(alternatives) => {
+                let entries: Vec<usize> = alternatives
+                    .iter()
+                    .map(|alternative| self.compile(alternative, next))
+                    .collect();
+                let mut body = String::new();
+                for entry in entries[1..].iter().rev() {
+                    body += &resume(*entry, "pos", "0");
+                }
+                self.add(body + &jump(entries[0], "pos"))
+            }
+            Node::Group(None, inner) => self.compile(inner, next),
+            Node::Group(Some(index), inner) => {
+                let close = self.capture(2 * index + 1, next);
+                let entry = self.compile(inner, close);
+                self.capture(2 * index, entry)
+            }
+            Node::Assert(assertion) => {
+                let condition = match assertion {
+                    Assertion::Start if self.multiline => {
+                        "pos == 0 || st.input[pos - 1] == '\\n' || st.input[pos - 1] == '\\r'"
+                    }
+                    Assertion::Start => "pos == 0",
+                    Assertion::End if self.multiline => {
+                        "pos == st.input.size() || st.input[pos] == '\\n' || st.input[pos] == '\\r'"
+                    }
+                    Assertion::End => "pos == st.input.size()",
+                    Assertion::WordBoundary => "js_regexp_word_boundary(st.input, pos)",
+                    Assertion::NotWordBoundary => "!js_regexp_word_boundary(st.input, pos)",
+                };
+                self.add(format!(
+                    "if (!({})) break;\n{}",
+                    condition,
+                    jump(next, "pos")
+                ))
+            }
+            Node::Repeat {
+                node,
+                min,
+                max,
+                greedy,
+            } => match node.as_ref() {
+                Node::Set(set) => self.compile_byte_repeat(set, *min, *max, *greedy, next),
+                _ if *max == Some(0) => next,
+                _ => self.compile_repeat(node, *min, *max, *greedy, next),
+            },
+        }
+    }
+
+    fn capture(&mut self, slot: usize, next: usize) -> usize {
+        self.add(format!(
+            "{}st.captures[{}] = pos;\n{}",
+            save_capture(slot),
+            slot,
+            jump(next, "pos")
+        ))
+    }
+
+    /// Repeats a single byte with a loop. A greedy repeat takes as many bytes
+    /// as it can and leaves a single frame for backing off one byte at a
+    /// time. A lazy one takes one more byte each time it is backtracked into,
+    /// up to the end position it keeps in `aux`.
+    fn compile_byte_repeat(
+        &mut self,
+        set: &ByteSet,
+        min: u32,
+        max: Option<u32>,
+        greedy: bool,
+        next: usize,
+    ) -> usize {
+        let condition = self.condition(set);
+        let limit = match max {
+            Some(max) => format!("std::min<size_t>(st.input.size() - pos, {})", max),
+            None => "st.input.size() - pos".into(),
+        };
+        let scan = |bound: &str| {
+            format!(
+                "size_t n = 0;\n\
+                 while (n < {bound}) {{\n\
+                 unsigned char c = st.input[pos + n];\n\
+                 if (!({condition})) break;\n\
+                 n++;\n\
+                 }}\n\
+                 {too_few}",
+                bound = bound,
+                condition = condition,
+                too_few = match min {
+                    0 => "".into(),
+                    min => format!("if (n < {}) break;\n", min),
+                },
+            )
+        };
+        if greedy {
+            let body = format!(
+                "size_t limit = {limit};\n\
+                 {scan}\
+                 if (n > {min}) {{\n\
+                 st.stack.push_back({{JSRegExpFrame::BYTES, {next}, pos + {min}, pos + n - 1}});\n\
+                 }}\n\
+                 {jump}",
+                limit = limit,
+                scan = scan("limit"),
+                min = min,
+                next = next,
+                jump = jump(next, "pos + n")
+            );
+            return self.add(body);
+        }
+        let more = self.add(String::new());
+        let tried = self.add(String::new());
+        self.bodies[tried] = format!(
+            "if (pos < aux) {{\n{}}}\n{}",
+            resume(more, "pos", "aux"),
+            jump(next, "pos")
+        );
+        self.bodies[more] = format!(
+            "unsigned char c = st.input[pos];\n\
+             if (!({})) break;\n\
+             {}",
+            condition,
+            jump(tried, "pos + 1")
+        );
+        let scan = match min {
+            0 => "".into(),
+            min => scan(&format!("std::min<size_t>(limit, {})", min)),
+        };
+        self.add(format!(
+            "size_t limit = {};\n{}aux = pos + limit;\n{}",
+            limit,
+            scan,
+            jump(tried, &format!("pos + {}", min))
+        ))
+    }
+
+    /// Repeats an arbitrary subpattern. The iteration count lives in
+    /// `st.counts`, and an optional iteration that matched nothing ends the
+    /// loop, as the spec requires. Each iteration starts with the captures
+    /// inside the subpattern unset.
+    fn compile_repeat(
+        &mut self,
+        node: &Node,
+        min: u32,
+        max: Option<u32>,
+        greedy: bool,
+        next: usize,
+    ) -> usize {
+        let index = self.loops;
+        self.loops += 1;
+        let iteration = self.add(String::new());
+        let body = self.compile(node, iteration);
+
+        let mut slots = vec![];
+        capture_slots(node, &mut slots);
+        let mut again = format!(
+            "st.stack.push_back({{JSRegExpFrame::LOOP, {index}, count, st.starts[{index}]}});\n\
+             st.counts[{index}] = count + 1;\n\
+             st.starts[{index}] = pos;\n",
+            index = index
+        );
+        for slot in slots {
+            again += &format!(
+                "{}st.captures[{}] = std::string_view::npos;\n",
+                save_capture(slot),
+                slot
+            );
+        }
+        again += &jump(body, "pos");
+        let below_max = match max {
+            Some(max) => format!("count < {}", max),
+            None => "true".into(),
+        };
+        let check = format!(
+            "size_t count = st.counts[{index}];\n\
+             if (count > {min} && st.starts[{index}] == pos) break;\n",
+            index = index,
+            min = min
+        );
+        // Only iterations beyond `min` are optional.
+        let when_optional = |code: String| match min {
+            0 => code,
+            min => format!("if (count >= {}) {{\n{}}}\n", min, code),
+        };
+        let when_required = |code: String| match min {
+            0 => "".into(),
+            min => format!("if (count < {}) {{\n{}\n}}\n", min, code),
+        };
+        self.bodies[iteration] = if greedy {
+            format!(
+                "{check}\
+                 if ({below_max}) {{\n\
+                 {exit}\
+                 {again}\n\
+                 }}\n\
+                 {too_few}\
+                 {next}",
+                check = check,
+                below_max = below_max,
+                exit = when_optional(resume(next, "pos", "0")),
+                again = again,
+                too_few = when_required("break;".into()),
+                next = jump(next, "pos")
+            )
+        } else {
+            let more = self.add(format!("size_t count = st.counts[{}];\n{}", index, again));
+            format!(
+                "{check}\
+                 {required}\
+                 if ({below_max}) {{\n{resume}}}\n\
+                 {next}",
+                check = check,
+                required = when_required(jump(more, "pos")),
+                below_max = below_max,
+                resume = resume(more, "pos", "0"),
+                next = jump(next, "pos")
+            )
+        };
+        self.add(format!(
+            "st.stack.push_back({{JSRegExpFrame::LOOP, {index}, st.counts[{index}], st.starts[{index}]}});\n\
+             st.counts[{index}] = 0;\n\
+             st.starts[{index}] = std::string_view::npos;\n\
+             {iteration}",
+            index = index,
+            iteration = jump(iteration, "pos")
+        ))
+    }
+
+    /// A C++ condition on the byte `c` that holds for the members of `set`.
+    fn condition(&mut self, set: &ByteSet) -> String {
+        let ranges = set.ranges();
+        let complement = set.negate().ranges();
+        let (ranges, negate) = if complement.len() < ranges.len() {
+            (complement, true)
+        } else {
+            (ranges, false)
+        };
+        if ranges.is_empty() {
+            return (if negate { "true" } else { "false" }).into();
+        }
+        if ranges.len() > 4 {
+            let name = format!("{}_set_{}", self.prefix, self.tables.len());
+            let entries = (0..=255u8)
+                .map(|byte| if set.contains(byte) { "1" } else { "0" })
+                .collect::<Vec<_>>()
+                .join(",");
+            self.tables.push(format!(
+                "static const bool {}[256] = {{{}}};\n",
+                name, entries
+            ));
+            return format!("{}[c]", name);
+        }
+        let tests = ranges
+            .iter()
+            .map(|(lo, hi)| match hi - lo {
+                0 => format!("c == {}", lo),
+                _ if *lo == 0 => format!("c <= {}", hi),
+                _ if *hi == 255 => format!("c >= {}", lo),
+                _ => format!("(c >= {} && c <= {})", lo, hi),
+            })
+            .collect::<Vec<_>>()
+            .join(" || ");
+        if negate {
+            format!("!({})", tests)
+        } else {
+            tests
+        }
+    }
+}
+
+/// Continues with `state` at `pos`.
+fn jump(state: usize, pos: &str) -> String {
+    match pos {
+        "pos" => format!("state = {};\ncontinue;", state),
+        pos => format!("pos = {};\nstate = {};\ncontinue;", pos, state),
+    }
+}
+
+/// Leaves a choice to continue with `state` at `pos` on backtracking.
+fn resume(state: usize, pos: &str, aux: &str) -> String {
+    format!(
+        "st.stack.push_back({{JSRegExpFrame::RESUME, {}, {}, {}}});\n",
+        state, pos, aux
+    )
+}
+
+/// Records the value of a capture slot, to be restored on backtracking.
+fn save_capture(slot: usize) -> String {
+    format!(
+        "st.stack.push_back({{JSRegExpFrame::CAPTURE, {0}, st.captures[{0}], 0}});\n",
+        slot
+    )
+}
+
+/// The capture slots of all groups in `node`.
+fn capture_slots(node: &Node, slots: &mut Vec<usize>) {
+    match node {
+        Node::Seq(items) | Node::Alt(items) => {
+            for item in items {
+                capture_slots(item, slots);
+            }
+        }
+        Node::Group(index, inner) => {
+            if let Some(index) = index {
+                slots.extend([2 * index, 2 * index + 1]);
+            }
+            capture_slots(inner, slots);
+        }
+        Node::Repeat { node, .. } => capture_slots(node, slots),
+        Node::Set(_) | Node::Literal(_) | Node::Assert(_) => {}
+    }
+}
+
+/// Whether the pattern can only match at the start of a line.
+fn starts_with_start(node: &Node) -> bool {
+    match node {
+        Node::Assert(Assertion::Start) => true,
+        Node::Seq(items) => items.first().map_or(false, starts_with_start),
+        Node::Group(_, inner) => starts_with_start(inner),
+        _ => false,
+    }
+}
+
+/// The byte every match starts with, if there is one.
+fn first_byte(node: &Node) -> Option<u8> {
+    match node {
+        Node::Set(set) => set.single(),
+        Node::Literal(bytes) => bytes.first().copied(),
+        Node::Seq(items) => items.first().and_then(first_byte),
+        Node::Group(_, inner) => first_byte(inner),
+        Node::Repeat { node, min, .. } if *min > 0 => first_byte(node),
+        _ => None,
+    }
+}
+
+/// A C++ string literal for arbitrary bytes.
+fn cpp_string(bytes: &[u8]) -> String {
+    let mut literal = String::from("\"");
+    for byte in bytes {
+        match byte {
+            b'"' | b'\\' => write!(literal, "\\{}", *byte as char).unwrap(),
+            b' '..=b'~' => literal.push(*byte as char),
+            _ => write!(literal, "\\{:03o}", byte).unwrap(),
+        }
+    }
+    literal + "\""
+}
+
+enum NfaState {
+    Byte(ByteSet, usize),
+    Split(Vec<usize>),
+    Match,
+}
+
+/// A DFA deciding whether a pattern matches anywhere in the input.
+struct Dfa {
+    /// Maps each byte to its equivalence class.
+    classes: Vec<usize>,
+    class_count: usize,
+    transitions: Vec<Vec<usize>>,
+    accepting: Vec<bool>,
+    /// A state that never leads to a match, if there is one.
+    dead: Option<usize>,
+    /// Whether a match has to extend to the end of the input.
+    anchored_end: bool,
+}
+
+impl Dfa {
+    /// Builds the DFA through an NFA and the subset construction. Returns
+    /// `None` for patterns with assertions other than a leading `^` or a
+    /// trailing `$`, and for patterns that need too many states.
+    fn build(node: &Node, flags: &Flags) -> Option<Dfa> {
+        let mut items: Vec<&Node> = match node {
+            Node::Seq(items) => items.iter().collect(),
+            node => vec![node],
+        };
+        let anchored_start = matches!(items.first(), Some(Node::Assert(Assertion::Start)));
+        if anchored_start {
+            items.remove(0);
+        }
+        let anchored_end = matches!(items.last(), Some(Node::Assert(Assertion::End)));
+        if anchored_end {
+            items.pop();
+        }
+        if flags.multiline && (anchored_start || anchored_end) {
+            return None;
+        }
+
+        let mut nfa = vec![NfaState::Match];
+        let mut start = 0;
+        for item in items.iter().rev() {
+            start = build_nfa(&mut nfa, item, start)?;
+        }
+
+        // Bytes that no set tells apart share a column of the table.
+        let sets: Vec<ByteSet> = nfa
+            .iter()
+            .filter_map(|state| match state {
+                NfaState::Byte(set, _) => Some(*set),
+                _ => None,
+            })
+            .collect();
+        let mut signatures: HashMap<Vec<bool>, usize> = HashMap::new();
+        let mut representatives = vec![];
+        let classes: Vec<usize> = (0..=255u8)
+            .map(|byte| {
+                let signature: Vec<bool> = sets.iter().map(|set| set.contains(byte)).collect();
+                let next_class = signatures.len();
+                *signatures.entry(signature).or_insert_with(|| {
+                    representatives.push(byte);
+                    next_class
+                })
+            })
+            .collect();
+
+        // Unanchored patterns may start matching at every byte, so the NFA’s
+        // start state is part of every DFA state.
+        let restart: Vec<usize> = if anchored_start { vec![] } else { vec![start] };
+        let initial = nfa_closure(&nfa, &[start]);
+        let mut ids: HashMap<Vec<usize>, usize> = HashMap::from([(initial.clone(), 0)]);
+        let mut subsets = vec![initial];
+        let mut transitions: Vec<Vec<usize>> = vec![];
+        while transitions.len() < subsets.len() {
+            let subset = subsets[transitions.len()].clone();
+            let mut row = vec![];
+            for byte in &representatives {
+                let mut targets = restart.clone();
+                for state in &subset {
+                    if let NfaState::Byte(set, next) = &nfa[*state] {
+                        if set.contains(*byte) {
+                            targets.push(*next);
+                        }
+                    }
+                }
+                let target = nfa_closure(&nfa, &targets);
+                let id = match ids.get(&target) {
+                    Some(id) => *id,
+                    None => {
+                        if subsets.len() == MAX_DFA_STATES {
+                            return None;
+                        }
+                        ids.insert(target.clone(), subsets.len());
+                        subsets.push(target);
+                        subsets.len() - 1
+                    }
+                };
+                row.push(id);
+            }
+            transitions.push(row);
+        }
+
+        Some(Dfa {
+            classes,
+            class_count: representatives.len(),
+            accepting: subsets.iter().map(|subset| subset.contains(&0)).collect(),
+            dead: subsets.iter().position(|subset| subset.is_empty()),
+            transitions,
+            anchored_end,
+        })
+    }
+
+    fn to_cpp(&self, prefix: &str) -> String {
+        let join = |values: &mut dyn Iterator<Item = String>| values.collect::<Vec<_>>().join(",");
+        let rows = join(
+            &mut self
+                .transitions
+                .iter()
+                .map(|row| format!("{{{}}}", join(&mut row.iter().map(|id| id.to_string())))),
+        );
+        let mut code = String::new();
+        writeln!(
+            code,
+            "static const unsigned char {}_classes[256] = {{{}}};",
+            prefix,
+            join(&mut self.classes.iter().map(|class| class.to_string()))
+        )
+        .unwrap();
+        writeln!(
+            code,
+            "static const unsigned char {}_transitions[{}][{}] = {{{}}};",
+            prefix,
+            self.transitions.len(),
+            self.class_count,
+            rows
+        )
+        .unwrap();
+        writeln!(
+            code,
+            "static const bool {}_accepting[{}] = {{{}}};",
+            prefix,
+            self.accepting.len(),
+            join(&mut self.accepting.iter().map(|a| (*a as u8).to_string()))
+        )
+        .unwrap();
+        writeln!(
+            code,
+            "static bool {prefix}_test(std::string_view input) {{\n\
+             unsigned char state = 0;\n\
+             for (unsigned char c : input) {{\n\
+             {early_accept}{early_reject}\
+             state = {prefix}_transitions[state][{prefix}_classes[c]];\n\
+             }}\n\
+             return {prefix}_accepting[state];\n\
+             }}",
+            prefix = prefix,
+            early_accept = if self.anchored_end {
+                "".into()
+            } else {
+                format!("if ({}_accepting[state]) return true;\n", prefix)
+            },
+            early_reject = match self.dead {
+                Some(dead) => format!("if (state == {}) return false;\n", dead),
+                None => "".into(),
+            },
+        )
+        .unwrap();
+        code
+    }
+}
+
+/// Adds NFA states matching `node` and then continuing with `next`, and
+/// returns the first of them. Counted repetitions are unrolled.
+fn build_nfa(nfa: &mut Vec<NfaState>, node: &Node, next: usize) -> Option<usize> {
+    if nfa.len() > MAX_NFA_STATES {
+        return None;
+    }
+    let push = |nfa: &mut Vec<NfaState>, state| {
+        nfa.push(state);
+        nfa.len() - 1
+    };
+    Some(match node {
+        Node::Set(set) => push(nfa, NfaState::Byte(*set, next)),
+        Node::Literal(bytes) => {
+            let mut next = next;
+            for byte in bytes.iter().rev() {
+                next = push(nfa, NfaState::Byte(ByteSet::byte(*byte), next));
+            }
+            next
+        }
+        Node::Seq(items) => {
+            let mut next = next;
+            for item in items.iter().rev() {
+                next = build_nfa(nfa, item, next)?;
+            }
+            next
+        }
+        Node::Alt(alternatives) => {
+            let entries = alternatives
+                .iter()
+                .map(|alternative| build_nfa(nfa, alternative, next))
+                .collect::<Option<Vec<usize>>>()?;
+            push(nfa, NfaState::Split(entries))
+        }
+        Node::Group(_, inner) => build_nfa(nfa, inner, next)?,
+        Node::Repeat { node, min, max, .. } => {
+            let mut next = next;
+            match max {
+                None => {
+                    let split = push(nfa, NfaState::Split(vec![]));
+                    let body = build_nfa(nfa, node, split)?;
+                    nfa[split] = NfaState::Split(vec![body, next]);
+                    next = split;
+                }
+                Some(max) => {
+                    for _ in *min..*max {
+                        let body = build_nfa(nfa, node, next)?;
+                        next = push(nfa, NfaState::Split(vec![body, next]));
+                    }
+                }
+            }
+            for _ in 0..*min {
+                next = build_nfa(nfa, node, next)?;
+            }
+            next
+        }
+        Node::Assert(_) => return None,
+    })
+}
+
+/// The states reachable from `roots` without consuming input, leaving out
+/// the splits, in ascending order.
+fn nfa_closure(nfa: &[NfaState], roots: &[usize]) -> Vec<usize> {
+    let mut seen = vec![false; nfa.len()];
+    let mut stack = roots.to_vec();
+    let mut closure = vec![];
+    while let Some(state) = stack.pop() {
+        if std::mem::replace(&mut seen[state], true) {
+            continue;
+        }
+        match &nfa[state] {
+            NfaState::Split(targets) => stack.extend(targets),
+            _ => closure.push(state),
+        }
+    }
+    closure.sort_unstable();
+    closure
+}
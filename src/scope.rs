@@ -0,0 +1,516 @@
+use std::collections::{HashMap, HashSet};
+
+use swc_ecma_ast::*;
+use swc_ecma_visit::{Visit, VisitWith};
+
+/// The names a piece of code declares, references and assigns to.
+///
+/// Scopes are flattened: a name counts as declared if it is declared anywhere
+/// inside the node.
+#[derive(Default)]
+pub struct Usage {
+    /// Number of declarations per name.
+    pub declared: HashMap<String, usize>,
+    pub referenced: HashSet<String>,
+    pub assigned: HashSet<String>,
+    pub uses_this: bool,
+}
+
+impl Usage {
+    pub fn of<T: VisitWith<Usage>>(node: &T) -> Usage {
+        let mut usage = Usage::default();
+        node.visit_with(&mut usage);
+        usage
+    }
+
+    fn declare(&mut self, ident: &Ident) {
+        *self.declared.entry(ident.sym.to_string()).or_insert(0) += 1;
+    }
+
+    fn assign(&mut self, ident: &Ident) {
+        self.referenced.insert(ident.sym.to_string());
+        self.assigned.insert(ident.sym.to_string());
+    }
+
+    fn visit_assign_target(&mut self, expr: &Expr) {
+        match expr {
+            Expr::Ident(ident) => self.assign(ident),
+            expr => expr.visit_with(self),
+        }
+    }
+}
+
+impl Visit for Usage {
+    fn visit_ident(&mut self, ident: &Ident) {
+        self.referenced.insert(ident.sym.to_string());
+    }
+
+    fn visit_binding_ident(&mut self, ident: &BindingIdent) {
+        self.declare(&ident.id);
+    }
+
+    fn visit_fn_decl(&mut self, fn_decl: &FnDecl) {
+        self.declare(&fn_decl.ident);
+        fn_decl.function.visit_with(self);
+    }
+
+    fn visit_fn_expr(&mut self, fn_expr: &FnExpr) {
+        if let Some(ident) = &fn_expr.ident {
+            self.declare(ident);
+        }
+        fn_expr.function.visit_with(self);
+    }
+
+    fn visit_member_prop(&mut self, prop: &MemberProp) {
+        if let MemberProp::Computed(computed) = prop {
+            computed.expr.visit_with(self);
+        }
+    }
+
+    fn visit_prop_name(&mut self, name: &PropName) {
+        if let PropName::Computed(computed) = name {
+            computed.expr.visit_with(self);
+        }
+    }
+
+    fn visit_this_expr(&mut self, _this_expr: &ThisExpr) {
+        self.uses_this = true;
+    }
+
+    fn visit_assign_expr(&mut self, assign_expr: &AssignExpr) {
+        match &assign_expr.left {
+            PatOrExpr::Expr(expr) => self.visit_assign_target(expr),
+            PatOrExpr::Pat(pat) => match pat.as_ref() {
+                Pat::Ident(ident) => self.assign(&ident.id),
+                Pat::Expr(expr) => self.visit_assign_target(expr),
+                pat => pat.visit_with(self),
+            },
+        }
+        assign_expr.right.visit_with(self);
+    }
+
+    fn visit_update_expr(&mut self, update_expr: &UpdateExpr) {
+        self.visit_assign_target(&update_expr.arg);
+    }
+}
+
+/// Collects the names a pattern declares, without looking into default values.
+struct Bindings(Vec<String>);
+
+impl Visit for Bindings {
+    fn visit_binding_ident(&mut self, ident: &BindingIdent) {
+        self.0.push(ident.id.sym.to_string());
+    }
+
+    fn visit_expr(&mut self, _expr: &Expr) {}
+}
+
+fn bindings<T: VisitWith<Bindings>>(node: &T) -> Vec<String> {
+    let mut bindings = Bindings(vec![]);
+    node.visit_with(&mut bindings);
+    bindings.0
+}
+
+/// The names declared directly in a block. Like in the generated C++, `var`
+/// is scoped to its block.
+fn block_declarations(stmts: &[Stmt]) -> Vec<String> {
+    let mut names = vec![];
+    for stmt in stmts {
+        match stmt {
+            Stmt::Decl(Decl::Var(var_decl)) => names.extend(bindings(var_decl.as_ref())),
+            Stmt::Decl(Decl::Fn(fn_decl)) => names.push(fn_decl.ident.sym.to_string()),
+            Stmt::Decl(Decl::Class(class_decl)) => names.push(class_decl.ident.sym.to_string()),
+            _ => {}
+        }
+    }
+    names
+}
+
+/// Resolves references against the scopes around them. Declarations in
+/// constructs it doesn’t open a scope for are not seen, so their uses
+/// count as free.
+#[derive(Default)]
+struct FreeNames {
+    scopes: Vec<HashSet<String>>,
+    free: HashSet<String>,
+}
+
+impl FreeNames {
+    fn scoped<F: FnOnce(&mut FreeNames)>(&mut self, names: Vec<String>, visit: F) {
+        self.scopes.push(names.into_iter().collect());
+        visit(self);
+        self.scopes.pop();
+    }
+
+    fn reference(&mut self, ident: &Ident) {
+        let name = &*ident.sym;
+        if !self.scopes.iter().any(|scope| scope.contains(name)) {
+            self.free.insert(name.to_string());
+        }
+    }
+}
+
+impl Visit for FreeNames {
+    fn visit_ident(&mut self, ident: &Ident) {
+        self.reference(ident);
+    }
+
+    // Declarations were added to their scope up front, so this only finds
+    // assignment targets.
+    fn visit_binding_ident(&mut self, ident: &BindingIdent) {
+        self.reference(&ident.id);
+    }
+
+    fn visit_function(&mut self, function: &Function) {
+        self.scoped(bindings(&function.params), |free| {
+            function.params.visit_with(free);
+            function.body.visit_with(free);
+        });
+    }
+
+    fn visit_fn_expr(&mut self, fn_expr: &FnExpr) {
+        let names = fn_expr
+            .ident
+            .iter()
+            .map(|ident| ident.sym.to_string())
+            .collect();
+        self.scoped(names, |free| fn_expr.function.visit_with(free));
+    }
+
+    fn visit_fn_decl(&mut self, fn_decl: &FnDecl) {
+        fn_decl.function.visit_with(self);
+    }
+
+    fn visit_arrow_expr(&mut self, arrow_expr: &ArrowExpr) {
+        self.scoped(bindings(&arrow_expr.params), |free| {
+            arrow_expr.params.visit_with(free);
+            arrow_expr.body.visit_with(free);
+        });
+    }
+
+    fn visit_block_stmt(&mut self, block: &BlockStmt) {
+        self.scoped(block_declarations(&block.stmts), |free| {
+            block.stmts.visit_with(free);
+        });
+    }
+
+    fn visit_for_stmt(&mut self, for_stmt: &ForStmt) {
+        let names = match &for_stmt.init {
+            Some(VarDeclOrExpr::VarDecl(var_decl)) => bindings(var_decl.as_ref()),
+            _ => vec![],
+        };
+        self.scoped(names, |free| for_stmt.visit_children_with(free));
+    }
+
+    fn visit_for_of_stmt(&mut self, for_of_stmt: &ForOfStmt) {
+        let names = match &for_of_stmt.left {
+            VarDeclOrPat::VarDecl(var_decl) => bindings(var_decl.as_ref()),
+            _ => vec![],
+        };
+        self.scoped(names, |free| for_of_stmt.visit_children_with(free));
+    }
+
+    fn visit_catch_clause(&mut self, catch_clause: &CatchClause) {
+        self.scoped(bindings(&catch_clause.param), |free| {
+            catch_clause.visit_children_with(free);
+        });
+    }
+
+    fn visit_member_prop(&mut self, prop: &MemberProp) {
+        if let MemberProp::Computed(computed) = prop {
+            computed.expr.visit_with(self);
+        }
+    }
+
+    fn visit_prop_name(&mut self, name: &PropName) {
+        if let PropName::Computed(computed) = name {
+            computed.expr.visit_with(self);
+        }
+    }
+}
+
+/// Names that `function` refers to without a declaration in scope. Unlike
+/// `Usage`, this respects nested scopes: a local declared in one block
+/// doesn’t hide uses of a global with the same name elsewhere.
+pub fn free_names(function: &Function) -> HashSet<String> {
+    let mut free_names = FreeNames::default();
+    function.visit_with(&mut free_names);
+    free_names.free
+}
+
+/// Finds the top-level function declarations that can be emitted as native
+/// C++ functions and called directly: plain functions with identifier
+/// parameters whose name is never reassigned or shadowed, that don’t use
+/// `this` and only refer to their own locals and to other such functions.
+///
+/// Returns the parameter names of each of them, by function name.
+pub fn native_functions(module: &Module) -> HashMap<String, Vec<String>> {
+    let module_usage = Usage::of(module);
+    let mut candidates: HashMap<String, (Vec<String>, HashSet<String>)> = module
+        .body
+        .iter()
+        .filter_map(|item| match item {
+            ModuleItem::Stmt(Stmt::Decl(Decl::Fn(fn_decl))) => Some(fn_decl),
+            _ => None,
+        })
+        .filter(|fn_decl| {
+            let name = fn_decl.ident.sym.to_string();
+            !fn_decl.function.is_generator
+                && !fn_decl.function.is_async
+                && fn_decl
+                    .function
+                    .params
+                    .iter()
+                    .all(|param| param.pat.is_ident())
+                && module_usage.declared.get(&name) == Some(&1)
+                && !module_usage.assigned.contains(&name)
+        })
+        .filter_map(|fn_decl| {
+            if Usage::of(&fn_decl.function).uses_this {
+                return None;
+            }
+            let params = fn_decl
+                .function
+                .params
+                .iter()
+                .filter_map(|param| param.pat.as_ident())
+                .map(|ident| ident.sym.to_string())
+                .collect();
+            let free = free_names(&fn_decl.function);
+            Some((fn_decl.ident.sym.to_string(), (params, free)))
+        })
+        .collect();
+
+    // Functions that refer to anything but other native functions have to
+    // stay closures. Dropping one can disqualify its callers, so iterate.
+    loop {
+        let closed: HashSet<String> = candidates
+            .iter()
+            .filter(|(_, (_, free))| free.iter().all(|name| candidates.contains_key(name)))
+            .map(|(name, _)| name.clone())
+            .collect();
+        if closed.len() == candidates.len() {
+            break;
+        }
+        candidates.retain(|name, _| closed.contains(name));
+    }
+    candidates
+        .into_iter()
+        .map(|(name, (params, _))| (name, params))
+        .collect()
+}
+
+struct SideEffects(bool);
+
+impl Visit for SideEffects {
+    fn visit_call_expr(&mut self, _call_expr: &CallExpr) {
+        self.0 = true;
+    }
+
+    fn visit_new_expr(&mut self, _new_expr: &NewExpr) {
+        self.0 = true;
+    }
+
+    fn visit_assign_expr(&mut self, _assign_expr: &AssignExpr) {
+        self.0 = true;
+    }
+
+    fn visit_update_expr(&mut self, _update_expr: &UpdateExpr) {
+        self.0 = true;
+    }
+
+    fn visit_yield_expr(&mut self, _yield_expr: &YieldExpr) {
+        self.0 = true;
+    }
+
+    fn visit_await_expr(&mut self, _await_expr: &AwaitExpr) {
+        self.0 = true;
+    }
+
+    fn visit_tagged_tpl(&mut self, _tagged_tpl: &TaggedTpl) {
+        self.0 = true;
+    }
+
+    // Creating a function has no side effects, whatever its body does.
+    fn visit_arrow_expr(&mut self, _arrow_expr: &ArrowExpr) {}
+
+    fn visit_fn_expr(&mut self, _fn_expr: &FnExpr) {}
+}
+
+/// Whether evaluating `expr` may have side effects, ignoring getters.
+pub fn has_side_effects(expr: &Expr) -> bool {
+    let mut side_effects = SideEffects(false);
+    expr.visit_with(&mut side_effects);
+    side_effects.0
+}
+
+/// Whether `expr` is a function literal whose calls have no side effects, so
+/// they can be reordered with calls to other such functions. Calls inside the
+/// body count as side effects.
+pub fn is_pure_callback(expr: &Expr) -> bool {
+    let mut side_effects = SideEffects(false);
+    match expr {
+        Expr::Paren(paren) => return is_pure_callback(&paren.expr),
+        Expr::Arrow(arrow) if !arrow.is_async && !arrow.is_generator => {
+            arrow.params.visit_with(&mut side_effects);
+            arrow.body.visit_with(&mut side_effects);
+        }
+        Expr::Fn(fn_expr) if !fn_expr.function.is_async && !fn_expr.function.is_generator => {
+            fn_expr.function.params.visit_with(&mut side_effects);
+            fn_expr.function.body.visit_with(&mut side_effects);
+        }
+        _ => return false,
+    }
+    !side_effects.0
+}
+
+struct Suspension(bool);
+
+impl Visit for Suspension {
+    fn visit_yield_expr(&mut self, _yield_expr: &YieldExpr) {
+        self.0 = true;
+    }
+
+    fn visit_await_expr(&mut self, _await_expr: &AwaitExpr) {
+        self.0 = true;
+    }
+
+    fn visit_arrow_expr(&mut self, _arrow_expr: &ArrowExpr) {}
+
+    fn visit_function(&mut self, _function: &Function) {}
+}
+
+/// Whether `expr` contains a `yield` or `await` of the enclosing function.
+pub fn contains_suspension(expr: &Expr) -> bool {
+    let mut suspension = Suspension(false);
+    expr.visit_with(&mut suspension);
+    suspension.0
+}
+
+struct Resize<'a> {
+    /// The array being looped over.
+    array: &'a str,
+    resize: bool,
+}
+
+impl Visit for Resize<'_> {
+    fn visit_call_expr(&mut self, _call_expr: &CallExpr) {
+        self.resize = true;
+    }
+
+    fn visit_new_expr(&mut self, _new_expr: &NewExpr) {
+        self.resize = true;
+    }
+
+    fn visit_tagged_tpl(&mut self, _tagged_tpl: &TaggedTpl) {
+        self.resize = true;
+    }
+
+    // Other code may run while the function is suspended.
+    fn visit_yield_expr(&mut self, _yield_expr: &YieldExpr) {
+        self.resize = true;
+    }
+
+    fn visit_await_expr(&mut self, _await_expr: &AwaitExpr) {
+        self.resize = true;
+    }
+
+    fn visit_assign_expr(&mut self, assign_expr: &AssignExpr) {
+        let target = match &assign_expr.left {
+            PatOrExpr::Expr(expr) => Some(expr.as_ref()),
+            PatOrExpr::Pat(pat) => match pat.as_ref() {
+                Pat::Expr(expr) => Some(expr.as_ref()),
+                _ => None,
+            },
+        };
+        if target.map_or(false, is_length) {
+            self.resize = true;
+        }
+        assign_expr.visit_children_with(self);
+    }
+
+    fn visit_update_expr(&mut self, update_expr: &UpdateExpr) {
+        if is_length(&update_expr.arg) {
+            self.resize = true;
+        }
+        update_expr.visit_children_with(self);
+    }
+
+    // Getters and setters of other objects are calls in disguise.
+    fn visit_member_expr(&mut self, member_expr: &MemberExpr) {
+        if !matches!(&*member_expr.obj, Expr::Ident(ident) if *ident.sym == *self.array) {
+            self.resize = true;
+        }
+        member_expr.visit_children_with(self);
+    }
+
+    fn visit_arrow_expr(&mut self, _arrow_expr: &ArrowExpr) {}
+
+    fn visit_fn_expr(&mut self, _fn_expr: &FnExpr) {}
+}
+
+fn is_length(expr: &Expr) -> bool {
+    match expr {
+        Expr::Member(member_expr) => {
+            matches!(&member_expr.prop, MemberProp::Ident(ident) if &*ident.sym == "length")
+        }
+        _ => false,
+    }
+}
+
+/// Whether running `stmt` may change the length of `array`: it calls code,
+/// suspends, assigns to a `length` property or accesses properties of other
+/// values, which may run getters or setters.
+pub fn may_resize_arrays(stmt: &Stmt, array: &str) -> bool {
+    let mut resize = Resize {
+        array,
+        resize: false,
+    };
+    stmt.visit_with(&mut resize);
+    resize.resize
+}
+
+struct Throwing(bool);
+
+impl Visit for Throwing {
+    fn visit_call_expr(&mut self, _call_expr: &CallExpr) {
+        self.0 = true;
+    }
+
+    fn visit_new_expr(&mut self, _new_expr: &NewExpr) {
+        self.0 = true;
+    }
+
+    // Reading a property of `undefined` throws.
+    fn visit_member_expr(&mut self, _member_expr: &MemberExpr) {
+        self.0 = true;
+    }
+
+    fn visit_update_expr(&mut self, _update_expr: &UpdateExpr) {
+        self.0 = true;
+    }
+
+    fn visit_tagged_tpl(&mut self, _tagged_tpl: &TaggedTpl) {
+        self.0 = true;
+    }
+
+    fn visit_yield_expr(&mut self, _yield_expr: &YieldExpr) {
+        self.0 = true;
+    }
+
+    fn visit_await_expr(&mut self, _await_expr: &AwaitExpr) {
+        self.0 = true;
+    }
+
+    fn visit_arrow_expr(&mut self, _arrow_expr: &ArrowExpr) {}
+
+    fn visit_fn_expr(&mut self, _fn_expr: &FnExpr) {}
+}
+
+/// Whether evaluating `expr` may throw, not counting the bodies of functions
+/// it creates.
+pub fn may_throw(expr: &Expr) -> bool {
+    let mut throwing = Throwing(false);
+    expr.visit_with(&mut throwing);
+    throwing.0
+}
@@ -17,6 +17,65 @@ fn increment_postfix() -> Result<()> {
     Ok(())
 }
 
+#[test]
+fn status_exceptions() -> Result<()> {
+    let mut transpiler = Transpiler::new();
+    transpiler.status_exceptions = true;
+    let output = compile_and_run_with(
+        &mut transpiler,
+        r#"
+            let log = [];
+            function fail(msg) {
+                throw msg;
+                log.push("unreachable");
+            }
+            function* gen() {
+                yield "a";
+                throw "gen";
+            }
+            let x = "kept";
+            try {
+                x = fail("native");
+            } catch(e) {
+                log.push(e + " " + x);
+            }
+            try {
+                try {
+                    let missing;
+                    log.push(missing.prop);
+                } catch(e) {
+                    log.push("inner");
+                    fail("rethrown");
+                }
+            } catch(e) {
+                log.push(e);
+            }
+            try {
+                for (let v of gen()) {
+                    log.push(v);
+                }
+            } catch(e) {
+                log.push(e);
+            }
+            let boom = async () => {
+                await 1;
+                throw "async";
+            };
+            async function main() {
+                try {
+                    await boom();
+                } catch(e) {
+                    log.push(e);
+                }
+                IO.write_to_stdout(log.join(","));
+            }
+            main();
+        "#,
+    )?;
+    assert_eq!(output, "native kept,inner,rethrown,a,gen,async");
+    Ok(())
+}
+
 #[test]
 fn increment_prefix() -> Result<()> {
     let output = compile_and_run(
@@ -361,6 +420,47 @@ fn array_length() -> Result<()> {
     Ok(())
 }
 
+#[test]
+fn array_parallel_map() -> Result<()> {
+    let output = compile_and_run(
+        r#"
+            let v = [];
+            for(let i = 0; i < 10000; i++) {
+                v.push(i);
+            }
+            let doubled = v.parallelMap(v => v * 2);
+            let evens = doubled.parallelFilter(v => v % 4 == 0);
+            let sum = doubled.parallelReduce((a, b) => a + b, 0);
+            IO.write_to_stdout(doubled[9999] == 19998 && evens.length == 5000 && sum == 99990000 ? "y" : "n");
+        "#,
+    )?;
+    assert_eq!(output, "y");
+    Ok(())
+}
+
+#[test]
+fn worker_messages() -> Result<()> {
+    let output = compile_and_run(
+        r#"
+            let worker = Worker.spawn(port => {
+                for(let msg of port) {
+                    port.postMessage(msg.map(v => v * 2));
+                }
+            });
+            let data = [1, 2, 3];
+            worker.postMessage(data);
+            worker.postMessage(data, [data]);
+            worker.close();
+            let first = worker.receive();
+            let second = worker.receive();
+            worker.join();
+            IO.write_to_stdout(first.length + second.length == 6 && first[2] == 6 && data.length == 0 ? "y" : "n");
+        "#,
+    )?;
+    assert_eq!(output, "y");
+    Ok(())
+}
+
 #[test]
 fn object_lit() -> Result<()> {
     let output = compile_and_run(
@@ -562,6 +662,26 @@ fn json_parse_string_escapes() -> Result<()> {
     Ok(())
 }
 
+#[test]
+fn cbor() -> Result<()> {
+    let output = compile_and_run(
+        r#"
+            let v = {a: [1, -2, 0.5, 4294967296], b: "x y", c: [true, "z"]};
+            let copy = CBOR.decode(CBOR.encode(v));
+            IO.write_to_stdout(JSON.stringify(copy) + "|");
+            IO.write_to_stdout(CBOR.encode(1).length + "|");
+            for (let item of CBOR.decodeSequence(CBOR.encode(1) + CBOR.encode("two"))) {
+                IO.write_to_stdout(item + ";");
+            }
+        "#,
+    )?;
+    assert_eq!(
+        output,
+        r#"{"a":[1.000000,-2.000000,0.500000,4294967296.000000],"b":"x y","c":[true,"z"]}|1.000000|1.000000;two;"#
+    );
+    Ok(())
+}
+
 #[test]
 fn for_loop() -> Result<()> {
     let output = compile_and_run(
@@ -714,6 +834,34 @@ fn generator() -> Result<()> {
     Ok(())
 }
 
+#[test]
+fn generator_early_exit() -> Result<()> {
+    let output = compile_and_run(
+        r#"
+            function* count(n) {
+                for (let i = 0; i < n; i++) {
+                    yield i;
+                }
+            }
+            let sum = 0;
+            for (let round = 0; round < 100; round++) {
+                for (let v of count(10)) {
+                    if (v > 2) {
+                        break;
+                    }
+                    sum = sum + v;
+                }
+            }
+            let it = count(1);
+            it.next();
+            it.next();
+            IO.write_to_stdout(sum + " " + it.next().done);
+        "#,
+    )?;
+    assert_eq!(output, "300.000000 true");
+    Ok(())
+}
+
 #[test]
 fn generator_delegate_builtin() -> Result<()> {
     let output = compile_and_run(
@@ -793,15 +941,541 @@ fn exceptions() -> Result<()> {
     Ok(())
 }
 
+#[test]
+fn profile_symbols() -> Result<()> {
+    let mut transpiler = Transpiler::new();
+    transpiler.profile = true;
+    let output = compile_and_run_with(
+        &mut transpiler,
+        r#"
+            function greet() {
+                return "hi";
+            }
+            let shout = (v) => v + "!";
+            IO.write_to_stdout(shout(greet()));
+        "#,
+    )?;
+    assert_eq!(output, "hi!");
+    let symbol_map = transpiler.symbol_map();
+    assert!(symbol_map.contains("js_fn_greet\tgreet\tinput.js:2:"));
+    assert!(symbol_map.contains("js_shout_L5\tshout\tinput.js:5:"));
+    Ok(())
+}
+
+#[test]
+fn logical_short_circuit() -> Result<()> {
+    let output = compile_and_run(
+        r#"
+            let calls = [];
+            function mark(v) {
+                calls.push(v);
+                return v;
+            }
+            let a = 0 && mark(1);
+            let b = mark("x") || mark(2);
+            if (!(a > 1) && (b == "x" || mark(3))) {
+                calls.push("if");
+            }
+            IO.write_to_stdout(calls.join(",") + " " + a + " " + b);
+        "#,
+    )?;
+    assert_eq!(output, "x,if 0.000000 x");
+    Ok(())
+}
+
+#[test]
+fn native_function_calls() -> Result<()> {
+    let output = compile_and_run(
+        r#"
+            function depth(node) {
+                if (node.children.length == 0) {
+                    return 1;
+                }
+                return 1 + node.children.map(depth).reduce((a, b) => (a > b ? a : b), 0);
+            }
+            let tree = { children: [{ children: [] }, { children: [{ children: [] }] }] };
+            let total = 5;
+            function shadowed(v) {
+                if (v) {
+                    let total = 1;
+                }
+                return total + v;
+            }
+            IO.write_to_stdout(depth(tree) + " " + shadowed(2));
+        "#,
+    )?;
+    assert_eq!(output, "3.000000 7.000000");
+    Ok(())
+}
+
+#[test]
+fn async_await() -> Result<()> {
+    let output = compile_and_run(
+        r#"
+            let log = [];
+            async function double(v) {
+                let x = await Promise.resolve(v);
+                return x * 2;
+            }
+            let fail = async () => {
+                await 1;
+                throw "boom";
+            };
+            async function main() {
+                let a = await double(2);
+                let b = await double(a);
+                try {
+                    await fail();
+                } catch (e) {
+                    log.push(e);
+                }
+                log.push("end");
+                IO.write_to_stdout(log.join(",") + " " + b);
+            }
+            main();
+            log.push("start");
+            setTimeout(() => IO.write_to_stdout(" timer"), 1);
+        "#,
+    )?;
+    assert_eq!(output, "start,boom,end 8.000000 timer");
+    Ok(())
+}
+
+#[test]
+fn optimize() -> Result<()> {
+    let code = r#"
+        let seconds = 24 * 60 * 60;
+        let total = 0;
+        for (let i = 0; i < 3; i++) {
+            total = total + 2 * 5 - 1;
+        }
+        while (false) {
+            total = 0;
+        }
+        function suffix() {
+            return "a" + "b";
+            IO.write_to_stdout("unreachable");
+        }
+        if (!true) {
+            IO.write_to_stdout("dead");
+        }
+        IO.write_to_stdout(suffix() + (10 / 4) + " " + total + " " + seconds);
+        let big = 1e10 * 1e10;
+        IO.write_to_stdout(" " + big);
+    "#;
+    let mut transpiler = Transpiler::new();
+    transpiler.optimize = true;
+    let output = compile_and_run_with(&mut transpiler, code)?;
+    assert_eq!(
+        output,
+        "ab2.500000 27.000000 86400.000000 100000000000000000000.000000"
+    );
+    let cpp = js_to_cpp(&mut transpiler, code)?;
+    assert!(cpp.contains("static_cast<double>(86400)"));
+    assert!(cpp.contains("static_cast<double>(1e20)"));
+    assert!(cpp.contains("static JSValue js_lit_"));
+    assert!(!cpp.contains("unreachable") && !cpp.contains("dead"));
+    Ok(())
+}
+
+#[test]
+fn constant_literals() -> Result<()> {
+    let code = r#"
+        function table() {
+            return [1, 2, 3];
+        }
+        function config() {
+            return { name: "a", size: 2 };
+        }
+        let a = table();
+        a.push(4);
+        a[0] = 10;
+        let c = config();
+        c.name = "b";
+        c.size++;
+        let words = ["x", "y"].map((w) => {
+            w = w + "!";
+            return w;
+        });
+        let seen = [];
+        for (let i = 0; i < 2; i++) {
+            for (let s of ["p", "q"]) {
+                s = s + "?";
+                seen.push(s);
+            }
+        }
+        let d = config();
+        IO.write_to_stdout([
+            a.join(","),
+            table().join(","),
+            c.name + c.size,
+            d.name + d.size,
+            words.join(","),
+            ["x", "y"].join(","),
+            seen.join(","),
+            table() == table(),
+        ].join(" "));
+    "#;
+    let mut transpiler = Transpiler::new();
+    transpiler.optimize = true;
+    let output = compile_and_run_with(&mut transpiler, code)?;
+    assert_eq!(
+        output,
+        "10.000000,2.000000,3.000000,4.000000 1.000000,2.000000,3.000000 b3.000000 a2.000000 x!,y! x,y p?,q?,p?,q? false"
+    );
+    let cpp = js_to_cpp(&mut transpiler, code)?;
+    assert!(cpp.contains("JSValue::from_literal(js_const_"));
+    Ok(())
+}
+
+#[test]
+fn counted_loops() -> Result<()> {
+    let code = r#"
+        let data = [1, 2, 3, 4];
+        let sum = 0;
+        for (let i = 0; i < data.length; i++) {
+            sum = sum + data[i];
+        }
+        let grow = [1];
+        for (let i = 0; i < grow.length; i = i + 1) {
+            if (grow.length < 4) {
+                grow.push(grow[i] * 2);
+            }
+        }
+        let fake = { length: 2 };
+        let count = 0;
+        for (let i = 0; i < fake.length; i++) {
+            count = count + 1;
+        }
+        let callbacks = [];
+        for (let i = 0; i < data.length; i++) {
+            data[i] = data[i] * 10;
+            callbacks.push(() => i);
+        }
+        IO.write_to_stdout([sum, grow.join(","), count, data.join(","), callbacks[3]()].join(" "));
+    "#;
+    let mut transpiler = Transpiler::new();
+    transpiler.optimize = true;
+    let output = compile_and_run_with(&mut transpiler, code)?;
+    assert_eq!(
+        output,
+        "10.000000 1.000000,2.000000,4.000000,8.000000 2.000000 10.000000,20.000000,30.000000,40.000000 3.000000"
+    );
+    let cpp = js_to_cpp(&mut transpiler, code)?;
+    assert!(cpp.contains("js_view_0[js_idx_0]"));
+    assert!(cpp.contains("js_view_1.at(js_idx_1)"));
+    Ok(())
+}
+
+#[test]
+fn array_element_writes() -> Result<()> {
+    let output = compile_and_run(
+        r#"
+            let values = [1, 2, 3];
+            values[0] = 10;
+            values[1]++;
+            values[4] = "end";
+            let doubled = values.filter((v, i) => i < 3).map((v) => v * 2);
+            doubled.length = 2;
+            let errors = 0;
+            for (let index of [-1, 0.5, 1e18]) {
+                try {
+                    values[index] = 0;
+                } catch (e) {
+                    errors++;
+                }
+            }
+            IO.write_to_stdout(values.join(",") + " " + doubled.join(",") + " " + errors);
+        "#,
+    )?;
+    assert_eq!(
+        output,
+        "10.000000,3.000000,3.000000,undefined,end 20.000000,6.000000 3.000000"
+    );
+    Ok(())
+}
+
+#[test]
+fn fused_pipelines() -> Result<()> {
+    let code = r#"
+        let data = [1, 2, 3, 4, 5];
+        let sum = data.map((v) => v * v).filter((v, i) => i < 3).reduce((acc, v) => acc + v, 0);
+        let indices = data.filter((v) => v > 2).map((v, i) => i).reduce((acc, v) => acc + v);
+        let kept = data.map((v) => v + 1).filter((v) => v < 5);
+        let inner = { filter: (g) => "wrapped" };
+        let wrapper = { map: (f) => inner };
+        let wrapped = wrapper.map((v) => v).filter((v) => v);
+        IO.write_to_stdout([sum, indices, kept.join(","), wrapped].join(" "));
+    "#;
+    let mut transpiler = Transpiler::new();
+    transpiler.optimize = true;
+    let output = compile_and_run_with(&mut transpiler, code)?;
+    assert_eq!(
+        output,
+        "14.000000 3.000000 2.000000,3.000000,4.000000 wrapped"
+    );
+    let cpp = js_to_cpp(&mut transpiler, code)?;
+    assert!(cpp.contains("js_pipeline_reduce("));
+    assert!(cpp.contains("js_pipeline_collect("));
+    Ok(())
+}
+
+#[test]
+fn unfused_side_effects() -> Result<()> {
+    let code = r#"
+        let log = [];
+        let data = [1, 2];
+        let kept = data
+            .map((v) => {
+                log.push(v);
+                return v;
+            })
+            .filter(function (v) {
+                log.push(-v);
+                return true;
+            });
+        IO.write_to_stdout(log.join(",") + " " + kept.join(","));
+    "#;
+    let expected = "1.000000,2.000000,-1.000000,-2.000000 1.000000,2.000000";
+    assert_eq!(compile_and_run(code)?, expected);
+    let mut transpiler = Transpiler::new();
+    transpiler.optimize = true;
+    assert_eq!(compile_and_run_with(&mut transpiler, code)?, expected);
+    assert!(!js_to_cpp(&mut transpiler, code)?.contains("js_pipeline_"));
+    Ok(())
+}
+
+#[test]
+fn array_builtins() -> Result<()> {
+    let code = r#"
+        let values = [10, 9, 1, 3];
+        let sorted = values.slice().sort();
+        let ascending = values.slice().sort((a, b) => a - b);
+        let descending = values.slice().sort((a, b) => {
+            return b - a;
+        });
+        let words = [
+            { name: "pear", size: 4 },
+            { name: "apple", size: 5 },
+            { name: "fig", size: 3 },
+            { name: "kiwi", size: 4 }
+        ].sort((a, b) => a.size - b.size);
+        let spliced = values.slice();
+        let removed = spliced.splice(1, 2, 7, 8, "x");
+        IO.write_to_stdout([
+            sorted.join(","),
+            ascending.join(","),
+            descending.join(","),
+            words.map((w) => w.name).join(","),
+            values.slice(1, -1).concat([5], "y").join(","),
+            removed.join(","),
+            spliced.join(","),
+            values.indexOf(1),
+            values.indexOf(4),
+            spliced.includes("x")
+        ].join(" "));
+    "#;
+    let mut transpiler = Transpiler::new();
+    transpiler.optimize = true;
+    let output = compile_and_run_with(&mut transpiler, code)?;
+    assert_eq!(
+        output,
+        "1.000000,10.000000,3.000000,9.000000 1.000000,3.000000,9.000000,10.000000 10.000000,9.000000,3.000000,1.000000 fig,pear,kiwi,apple 9.000000,1.000000,5.000000,y 9.000000,1.000000 10.000000,7.000000,8.000000,x,3.000000 2.000000 -1.000000 true"
+    );
+    let cpp = js_to_cpp(&mut transpiler, code)?;
+    assert!(cpp.contains("numeric_ascending_impl"));
+    assert!(cpp.contains("numeric_descending_impl"));
+    Ok(())
+}
+
+#[test]
+fn string_builtins() -> Result<()> {
+    let output = compile_and_run(
+        r#"
+            let line = "  2024-01-01 INFO user=alice  ".trim();
+            let fields = line.split(" ");
+            IO.write_to_stdout([
+                fields.join("|"),
+                line.length,
+                line.indexOf("user="),
+                line.indexOf("bob"),
+                line.includes("INFO"),
+                line.startsWith("2024"),
+                line.slice(-5),
+                line.replace("alice", "[$&]"),
+                "a,b,c".split(",", 2).join("|")
+            ].join(" "));
+        "#,
+    )?;
+    assert_eq!(
+        output,
+        "2024-01-01|INFO|user=alice 26.000000 16.000000 -1.000000 true true alice 2024-01-01 INFO user=[alice] a|b"
+    );
+    Ok(())
+}
+
+#[test]
+fn regular_expressions() -> Result<()> {
+    let output = compile_and_run(
+        r#"
+            let range = /(\d+)-(\d+)/g;
+            let m = /(a|ab)(c|bcd)(d*)/.exec("xabcd");
+            let parts = [];
+            for (let i = 0; i < 200000; i++) {
+                parts.push("ab");
+            }
+            let long = /(?:ab)+/.exec(parts.join(""));
+            IO.write_to_stdout([
+                /^\w+@\w+\.com$/i.test("Bob@Example.COM"),
+                /colou?r/.test("colouur"),
+                m.join("|"),
+                m.index,
+                "10-20 and 3-4".match(range).join("|"),
+                "10-20 and 3-4".replace(range, "$2:$1"),
+                "foo food foo.".replace(/\bfoo\b/g, (match) => "[" + match + "]"),
+                "Hello World".match(/[^aeiou\s]+/gi).join("|"),
+                long[0].length,
+                "" + /(?:(a)|b)+/.exec("ab")[1]
+            ].join(" "));
+        "#,
+    )?;
+    assert_eq!(
+        output,
+        "true false abcd|a|bcd| 1.000000 10-20|3-4 20:10 and 4:3 [foo] food [foo]. H|ll|W|rld 400000.000000 undefined"
+    );
+    Ok(())
+}
+
+#[test]
+fn template_literals() -> Result<()> {
+    let output = compile_and_run(
+        r#"
+            let user = { name: "alice", visits: 3 };
+            let ratio = -0.125;
+            IO.write_to_stdout(`${user.name} said "hi" ${user.visits} times (${ratio}, ${[1].length > 0}, ${user.missing})
+\`done\` at $${100}`);
+            IO.write_to_stdout(` say "hi"
+\x41B \u{1F600}\a`);
+        "#,
+    )?;
+    assert_eq!(
+        output,
+        "alice said \"hi\" 3.000000 times (-0.125000, true, undefined)\n`done` at $100.000000 say \"hi\"\nAB \u{1F600}a"
+    );
+    Ok(())
+}
+
+#[test]
+fn heap_profile() -> Result<()> {
+    let snapshot = format!("{}.heap", Uuid::new_v4());
+    let mut transpiler = Transpiler::new();
+    transpiler.heap_profile = true;
+    let output = compile_and_run_with(
+        &mut transpiler,
+        format!(
+            r#"
+            function leak() {{
+                let a = {{ name: "a" }};
+                let b = {{ other: a }};
+                a.other = b;
+            }}
+            leak();
+            let kept = [1, 2, 3];
+            Runtime.heapSnapshot("{}");
+            IO.write_to_stdout("" + kept.length);
+        "#,
+            snapshot
+        ),
+    )?;
+    assert_eq!(output, "3.000000");
+    let summary = heap_summary::summarize(&std::fs::read_to_string(&snapshot)?)?;
+    std::fs::remove_file(&snapshot)?;
+    let (live, leaked) = summary
+        .split_once("Leaked in reference cycles")
+        .ok_or(anyhow!("No leaks found: {}", summary))?;
+    assert!(live.contains("array elements") && live.contains("input.js:8"));
+    assert!(leaked.contains("input.js:3") && leaked.contains("input.js:4"));
+    Ok(())
+}
+
+#[test]
+fn es_modules() -> Result<()> {
+    let dir = std::path::PathBuf::from(Uuid::new_v4().to_string());
+    std::fs::create_dir_all(dir.join("lib"))?;
+    std::fs::write(
+        dir.join("main.js"),
+        r#"
+            import { counter, bump, greet } from "./lib/greet.js";
+            import twice from "./util.js";
+            import * as util from "./util.js";
+            bump();
+            IO.write_to_stdout(greet("x") + " " + counter + " " + twice(util.base));
+        "#,
+    )?;
+    std::fs::write(
+        dir.join("lib/greet.js"),
+        r#"
+            export let counter = 1;
+            export function bump() {
+                counter = counter + 1;
+            }
+            export function greet(name) {
+                return "hi " + name;
+            }
+        "#,
+    )?;
+    let util = r#"
+        let base = 21;
+        export { base };
+        export default function (v) {
+            return v * 2;
+        }
+    "#;
+    std::fs::write(dir.join("util.js"), util)?;
+
+    let build = || -> Result<(usize, String)> {
+        let mut transpiler = Transpiler::new();
+        let program = modules::transpile_program(&mut transpiler, &dir.join("main.js"))?;
+        let output = dir.join("output").display().to_string();
+        let compiled = modules::build(
+            &program,
+            &dir.join(modules::BUILD_DIR),
+            &output,
+            "clang++",
+            &native_flags(false, false),
+        )?;
+        let output = Command::new(&output).output()?;
+        Ok((compiled, String::from_utf8(output.stdout)?))
+    };
+    let (_, output) = build()?;
+    assert_eq!(output, "hi x 2.000000 42.000000");
+    let (compiled, _) = build()?;
+    assert_eq!(compiled, 0);
+    std::fs::write(dir.join("util.js"), util.replace("21", "20 + 1"))?;
+    let (compiled, output) = build()?;
+    assert_eq!(compiled, 1);
+    assert_eq!(output, "hi x 2.000000 42.000000");
+    std::fs::remove_dir_all(&dir)?;
+    Ok(())
+}
+
 fn compile_and_run<T: AsRef<str>>(code: T) -> Result<String> {
+    compile_and_run_with(&mut Transpiler::new(), code)
+}
+
+fn compile_and_run_with<T: AsRef<str>>(transpiler: &mut Transpiler, code: T) -> Result<String> {
     let name = Uuid::new_v4().to_string();
-    let transpiler = Transpiler::new();
     let cpp = js_to_cpp(transpiler, code)?;
+    let mut flags = native_flags(transpiler.status_exceptions, false);
+    if transpiler.heap_profile {
+        flags.push("-DFEATURE_HEAP_PROFILE".to_string());
+    }
     cpp_to_binary(
         cpp,
         name.clone(),
         "clang++".to_string(),
-        &Vec::<String>::new(),
+        &flags,
+        &transpiler.global_sources(),
     )?;
     let child = Command::new(format!("./{}", &name))
         .stdout(Stdio::piped())
@@ -1,25 +1,495 @@
-use std::collections::HashSet;
+use std::collections::{BTreeMap, BTreeSet, HashMap, HashSet};
 
 use anyhow::{anyhow, Result};
+use swc_common::{Span, Spanned};
 use swc_ecma_ast::*;
 
+use crate::{regexp, scope};
+
+/// A generated function symbol and the JS source location it came from.
+pub struct ProfileSymbol {
+    pub symbol: String,
+    pub js_name: String,
+    pub line: usize,
+    pub column: usize,
+}
+
+const RUNTIME_INCLUDES: &str = r#"
+    #include <experimental/coroutine>
+    #include "runtime/js_value.hpp"
+    #include "runtime/exceptions.hpp"
+    #include "runtime/js_generator.hpp"
+    #include "runtime/js_promise.hpp"
+    #include "runtime/event_loop.hpp"
+    #include "runtime/js_array_view.hpp"
+    #include "runtime/js_pipeline.hpp"
+    #include "runtime/js_regexp.hpp"
+    #include "runtime/js_template.hpp"
+"#;
+
+/// What other modules see of a transpiled ES module.
+#[derive(Clone)]
+pub struct ModuleInterface {
+    /// The C++ namespace holding the module’s `init()` and exports.
+    pub namespace: String,
+    pub exports: Vec<String>,
+}
+
+impl ModuleInterface {
+    /// The C++ expression for the export `name`.
+    fn export(&self, name: &str) -> Result<String> {
+        if !self.exports.iter().any(|export| export == name) {
+            return Err(anyhow!(
+                "Module {} has no export {:?}",
+                self.namespace,
+                name
+            ));
+        }
+        Ok(format!("{}::{}", self.namespace, export_variable(name)))
+    }
+}
+
+/// The C++ variable holding the export `name`.
+fn export_variable(name: &str) -> String {
+    match name {
+        "default" => "js_default".into(),
+        name => name.into(),
+    }
+}
+
+/// Imports and exports of the ES module being transpiled.
+struct ModuleContext {
+    /// The modules that the import specifiers refer to.
+    imports: BTreeMap<String, ModuleInterface>,
+    exports: Vec<String>,
+    /// Exports of bindings declared elsewhere, as (export, value) pairs.
+    export_aliases: Vec<(String, String)>,
+}
+
+/// The pieces of a transpiled module, before they are arranged into a
+/// program or a module translation unit.
+struct ModuleParts {
+    includes: String,
+    /// Code that goes ahead of the module’s top-level code.
+    definitions: String,
+    /// Creates the globals the module uses.
+    setup: String,
+    program: String,
+}
+
+/// A `for (let index = start; index < array.length; index++)` loop whose body
+/// is being transpiled with a native induction variable.
+struct CountedLoop {
+    index: String,
+    array: String,
+    id: usize,
+    function_depth: usize,
+    /// Whether the body may resize the array, so that element accesses need
+    /// their own bounds check.
+    checked: bool,
+    /// Whether the body needs `index` as a `JSValue`.
+    index_used: bool,
+}
+
+/// The kind of function whose body is currently being transpiled.
+#[derive(Clone, Copy, PartialEq)]
+enum FunctionKind {
+    Plain,
+    Generator,
+    Async,
+}
+
 pub struct Transpiler {
     pub globals: Vec<crate::globals::Global>,
     pub feature_exceptions: bool,
-    is_generator: bool,
+    /// Propagate exceptions through a pending-exception slot that generated
+    /// code checks after each statement that can throw, instead of C++
+    /// exceptions. Works without `-fexceptions`, e.g. in wasm.
+    pub status_exceptions: bool,
+    /// Emit `#line` directives and named function symbols for profilers.
+    pub profile: bool,
+    /// Record the source line of each statement as the allocation site of the
+    /// values it creates, for heap snapshots.
+    pub heap_profile: bool,
+    /// File name that `#line` directives and allocation sites refer to.
+    pub source_name: String,
+    pub symbols: Vec<ProfileSymbol>,
+    function_kind: FunctionKind,
+    line_starts: Vec<usize>,
+    fn_name_hint: Option<String>,
+    /// Top-level functions emitted as native C++ functions, with their
+    /// parameter names.
+    native_functions: HashMap<String, Vec<String>>,
+    /// Hoist literals out of loops (`-O`).
+    pub optimize: bool,
+    /// Literals hoisted out of each enclosing loop of the current function,
+    /// as (name, initializer) pairs.
+    literal_pools: Vec<Vec<(String, String)>>,
+    literal_count: usize,
+    /// Names that are assigned to anywhere in the module.
+    assigned_names: HashSet<String>,
+    counted_loops: Vec<CountedLoop>,
+    counted_loop_count: usize,
+    function_depth: usize,
+    /// Set while transpiling the generic fallback of a counted loop, so that
+    /// nested loops don’t get duplicated again.
+    in_loop_fallback: bool,
+    /// Matchers generated for the regular expression literals so far.
+    regexps: Vec<String>,
+    /// Constant array and object literals so far, as (name, initializer)
+    /// pairs.
+    constant_literals: Vec<(String, String)>,
+    /// Labels of the `catch` blocks enclosing the current statement in
+    /// status mode, innermost last.
+    catch_labels: Vec<String>,
+    try_count: usize,
+    /// Set while transpiling an ES module with `transpile_es_module`.
+    module_context: Option<ModuleContext>,
 }
 
 impl Transpiler {
     pub fn new() -> Transpiler {
         Transpiler {
             globals: vec![],
-            is_generator: false,
+            function_kind: FunctionKind::Plain,
             feature_exceptions: true,
+            status_exceptions: false,
+            profile: false,
+            heap_profile: false,
+            source_name: "input.js".into(),
+            symbols: vec![],
+            line_starts: vec![0],
+            fn_name_hint: None,
+            native_functions: HashMap::new(),
+            optimize: false,
+            literal_pools: vec![],
+            literal_count: 0,
+            assigned_names: HashSet::new(),
+            counted_loops: vec![],
+            counted_loop_count: 0,
+            function_depth: 0,
+            in_loop_fallback: false,
+            regexps: vec![],
+            constant_literals: vec![],
+            catch_labels: vec![],
+            try_count: 0,
+            module_context: None,
+        }
+    }
+
+    pub fn set_source<T: AsRef<str>>(&mut self, source: T) {
+        self.line_starts = std::iter::once(0)
+            .chain(
+                source
+                    .as_ref()
+                    .bytes()
+                    .enumerate()
+                    .filter(|(_, b)| *b == b'\n')
+                    .map(|(idx, _)| idx + 1),
+            )
+            .collect();
+    }
+
+    /// Maps a span to a 1-based (line, column) pair in the source.
+    fn location(&self, span: Span) -> (usize, usize) {
+        let pos = span.lo.0 as usize;
+        let line = match self.line_starts.binary_search(&pos) {
+            Ok(idx) => idx,
+            Err(idx) => idx - 1,
+        };
+        (line + 1, pos - self.line_starts[line] + 1)
+    }
+
+    /// Renders the symbol map written next to `--profile` builds.
+    pub fn symbol_map(&self) -> String {
+        self.symbols
+            .iter()
+            .map(|sym| {
+                format!(
+                    "{}\t{}\t{}:{}:{}\n",
+                    sym.symbol, sym.js_name, self.source_name, sym.line, sym.column
+                )
+            })
+            .collect()
+    }
+
+    /// In profile mode, wraps a generated lambda so that it shows up as
+    /// `JSNamedFunction<js_<name>_L<line>, ...>` in symbolized stack traces.
+    fn named_function(&mut self, span: Span, lambda: String) -> String {
+        let js_name = self.fn_name_hint.take();
+        if !self.profile {
+            return lambda;
+        }
+        let js_name = js_name.unwrap_or("anonymous".into());
+        let (line, _) = self.location(span);
+        let symbol = format!(
+            "js_{}_L{}",
+            js_name
+                .chars()
+                .map(|c| if c.is_ascii_alphanumeric() { c } else { '_' })
+                .collect::<String>(),
+            line
+        );
+        self.add_symbol(symbol.clone(), js_name, span);
+        format!("js_named_function<struct {}>({})", symbol, lambda)
+    }
+
+    fn add_symbol(&mut self, symbol: String, js_name: String, span: Span) {
+        let (line, column) = self.location(span);
+        if !self.symbols.iter().any(|sym| sym.symbol == symbol) {
+            self.symbols.push(ProfileSymbol {
+                symbol,
+                js_name,
+                line,
+                column,
+            });
+        }
+    }
+
+    /// Runs `f` with `kind` as the kind of the enclosing function.
+    fn in_function<T>(
+        &mut self,
+        kind: FunctionKind,
+        f: impl FnOnce(&mut Self) -> Result<T>,
+    ) -> Result<T> {
+        let outer = std::mem::replace(&mut self.function_kind, kind);
+        let outer_pools = std::mem::take(&mut self.literal_pools);
+        let outer_catch_labels = std::mem::take(&mut self.catch_labels);
+        self.function_depth += 1;
+        let result = f(self);
+        self.function_depth -= 1;
+        self.function_kind = outer;
+        self.literal_pools = outer_pools;
+        self.catch_labels = outer_catch_labels;
+        result
+    }
+
+    /// Transpiles a loop with `f`. In optimized builds, literals used inside
+    /// the loop are created once, in `static` variables declared in front of
+    /// it.
+    fn in_loop(&mut self, f: impl FnOnce(&mut Self) -> Result<String>) -> Result<String> {
+        if !self.optimize {
+            return f(self);
+        }
+        self.literal_pools.push(vec![]);
+        let result = f(self);
+        let pool = self.literal_pools.pop().unwrap_or_default();
+        let decls: String = pool
+            .into_iter()
+            .map(|(name, init)| format!("static JSValue {} = {};\n", name, init))
+            .collect();
+        Ok(format!("{}{}", decls, result?))
+    }
+
+    /// Replaces the C++ expression `init` of a literal with a variable
+    /// hoisted out of the innermost loop, if there is one.
+    fn hoist_literal(&mut self, init: String) -> String {
+        let pool = match self.literal_pools.last_mut() {
+            Some(pool) => pool,
+            None => return init,
+        };
+        if let Some((name, _)) = pool.iter().find(|(_, existing)| *existing == init) {
+            return name.clone();
+        }
+        let name = format!("js_lit_{}", self.literal_count);
+        self.literal_count += 1;
+        pool.push((name.clone(), init));
+        name
+    }
+
+    /// Transpiles an expression whose value is only read, never stored or
+    /// mutated, so that a literal can be shared between loop iterations.
+    fn transpile_operand(&mut self, expr: &Expr) -> Result<String> {
+        match expr {
+            Expr::Lit(lit @ (Lit::Num(_) | Lit::Str(_) | Lit::Bool(_))) => {
+                let init = self.transpile_literal(lit)?;
+                Ok(self.hoist_literal(init))
+            }
+            _ => self.transpile_expr(expr),
         }
     }
 
     pub fn transpile_module(&mut self, module: &Module) -> Result<String> {
-        let additional_headers: HashSet<String> = self
+        let parts = self.transpile_parts(module)?;
+        Ok(format!(
+            r#"
+                {includes}
+
+                {definitions}
+
+                int prog() {{
+                    {setup}
+                    {program}
+                    return 0;
+                }}
+
+                int main() {{
+                    {main}
+                }}
+            "#,
+            includes = parts.includes,
+            definitions = parts.definitions,
+            setup = parts.setup,
+            program = parts.program,
+            main = self.main_body("prog()")
+        ))
+    }
+
+    /// Transpiles one module of a multi-file program. Its code runs in
+    /// `<namespace>::init()`, which initializes the modules it imports first,
+    /// and its exports become variables in that namespace. `imports` maps
+    /// import specifiers to the modules they refer to.
+    ///
+    /// Returns the module’s interface, its header and its translation unit.
+    pub fn transpile_es_module(
+        &mut self,
+        module: &Module,
+        namespace: &str,
+        imports: BTreeMap<String, ModuleInterface>,
+    ) -> Result<(ModuleInterface, String, String)> {
+        self.module_context = Some(ModuleContext {
+            imports,
+            exports: vec![],
+            export_aliases: vec![],
+        });
+        let parts = self.transpile_parts(module);
+        let context = self.module_context.take().unwrap();
+        let parts = parts?;
+        let interface = ModuleInterface {
+            namespace: namespace.to_string(),
+            exports: context.exports,
+        };
+        let export_decls = |prefix: &str| {
+            interface
+                .exports
+                .iter()
+                .map(|name| format!("{}JSValue {};", prefix, export_variable(name)))
+                .collect::<Vec<String>>()
+                .join("\n")
+        };
+        let header = format!(
+            "#pragma once\n#include \"runtime/js_value.hpp\"\n\nnamespace {} {{\n{}\nint init();\n}}\n",
+            namespace,
+            export_decls("extern ")
+        );
+        let import_includes = context
+            .imports
+            .values()
+            .map(|import| import.namespace.clone())
+            .collect::<BTreeSet<String>>()
+            .into_iter()
+            .map(|namespace| format!(r#"#include "{}.hpp""#, namespace))
+            .collect::<Vec<String>>()
+            .join("\n");
+        let export_aliases = context
+            .export_aliases
+            .iter()
+            // Qualified, as module-level bindings are locals of `init()` and
+            // may shadow the export.
+            .map(|(name, value)| format!("{}::{} = {};", namespace, export_variable(name), value))
+            .collect::<Vec<String>>()
+            .join("\n");
+        let cpp = format!(
+            r#"
+                {includes}
+                {import_includes}
+                #include "{namespace}.hpp"
+
+                namespace {namespace} {{
+                {exports}
+
+                {definitions}
+
+                int init() {{
+                    static bool initialized = false;
+                    if (initialized) {{
+                        return 0;
+                    }}
+                    initialized = true;
+                    {setup}
+                    {program}
+                    {export_aliases}
+                    return 0;
+                }}
+                }}
+            "#,
+            includes = parts.includes,
+            import_includes = import_includes,
+            namespace = namespace,
+            exports = export_decls(""),
+            definitions = parts.definitions,
+            setup = parts.setup,
+            program = parts.program,
+            export_aliases = export_aliases
+        );
+        Ok((interface, header, cpp))
+    }
+
+    /// The translation unit with `main()` for a program whose entry module is
+    /// `entry`.
+    pub fn transpile_entry_main(&self, entry: &ModuleInterface) -> String {
+        format!(
+            r#"
+                {includes}
+                #include "{namespace}.hpp"
+
+                int main() {{
+                    {main}
+                }}
+            "#,
+            includes = RUNTIME_INCLUDES,
+            namespace = entry.namespace,
+            main = self.main_body(&format!("{}::init()", entry.namespace))
+        )
+    }
+
+    /// Runs the top-level code by calling `run`, then the event loop, and
+    /// reports uncaught exceptions.
+    fn main_body(&self, run: &str) -> String {
+        if self.status_exceptions {
+            format!(
+                r#"
+                    {run};
+                    if (!js_has_pending_exception()) {{
+                        js_run_event_loop();
+                    }}
+                    if (js_has_pending_exception()) {{
+                        printf("EXCEPTION: %s\n", js_take_pending_exception().coerce_to_string().c_str());
+                    }}
+                "#,
+                run = run
+            )
+        } else if self.feature_exceptions {
+            format!(
+                r#"
+                    try {{
+                        {run};
+                        js_run_event_loop();
+                    }} catch(JSValue e) {{
+                        printf("EXCEPTION: %s\n", e.coerce_to_string().c_str());
+                    }}
+                "#,
+                run = run
+            )
+        } else {
+            format!(
+                r#"
+                    {run};
+                    js_run_event_loop();
+                "#,
+                run = run
+            )
+        }
+    }
+
+    fn transpile_parts(&mut self, module: &Module) -> Result<ModuleParts> {
+        let usage = scope::Usage::of(module);
+        // Globals the program never mentions aren’t created, included or
+        // linked.
+        self.globals
+            .retain(|global| usage.referenced.contains(&global.name));
+        // Sorted, so the generated code is the same from build to build.
+        let additional_headers: BTreeSet<String> = self
             .globals
             .iter()
             .flat_map(|global| {
@@ -32,6 +502,16 @@ impl Transpiler {
             .collect();
         let additional_includes: String = additional_headers
             .into_iter()
+            .chain(
+                self.profile
+                    .then(|| "runtime/js_profiling.hpp".to_string())
+                    .into_iter(),
+            )
+            .chain(
+                self.heap_profile
+                    .then(|| "runtime/heap_profile.hpp".to_string())
+                    .into_iter(),
+            )
             .map(|include| format!(r#"#include "{}""#, include))
             .collect::<Vec<String>>()
             .join("\n");
@@ -49,65 +529,283 @@ impl Transpiler {
             .collect::<Vec<String>>()
             .join("\n");
 
+        self.native_functions = scope::native_functions(module);
+        self.assigned_names = usage.assigned;
+        self.literal_count = 0;
+        self.counted_loop_count = 0;
+        self.regexps.clear();
+        self.constant_literals.clear();
+        self.try_count = 0;
+        let native_fn_decls: Vec<&FnDecl> = module
+            .body
+            .iter()
+            .filter_map(|item| match item {
+                ModuleItem::Stmt(Stmt::Decl(Decl::Fn(fn_decl)))
+                    if self.native_functions.contains_key(&*fn_decl.ident.sym) =>
+                {
+                    Some(fn_decl)
+                }
+                _ => None,
+            })
+            .collect();
+        let native_fn_forward_decls = native_fn_decls
+            .iter()
+            .map(|fn_decl| self.native_function_signatures(fn_decl))
+            .collect::<Vec<String>>()
+            .join("\n");
+        let transpiled_native_fns: Vec<Result<String>> = native_fn_decls
+            .iter()
+            .map(|fn_decl| self.transpile_native_function(fn_decl))
+            .collect();
+
+        // Imports are hoisted above the rest of the module.
+        let transpiled_imports: Vec<Result<String>> = module
+            .body
+            .iter()
+            .filter_map(|item| match item {
+                ModuleItem::ModuleDecl(ModuleDecl::Import(import_decl)) => Some(import_decl),
+                _ => None,
+            })
+            .map(|import_decl| self.transpile_import_decl(import_decl))
+            .collect();
         let transpiled_items: Vec<Result<String>> = module
             .body
             .iter()
             .map(|item| -> Result<String> {
                 match item {
-                    ModuleItem::ModuleDecl(_decl) => {
-                        return Err(anyhow!("Module imports/exports are not support"))
-                    }
+                    ModuleItem::ModuleDecl(decl) => self.transpile_module_decl(decl),
                     ModuleItem::Stmt(stmt) => self.transpile_stmt(stmt),
                 }
             })
             .collect();
 
-        let main = if self.feature_exceptions {
-            r#"
-                try {{
-                    prog();
-                }} catch(std::string e) {{
-                    printf("EXCEPTION: %s\n", e.c_str());
-                }}
-            "#
-        } else {
-            r#"
-                {{
-                    prog();
-                }}
-            "#
-        };
+        let constant_literals = self
+            .constant_literals
+            .iter()
+            .map(|(name, init)| {
+                format!(
+                    r#"
+                        static const JSValue &{name}() {{
+                            static const JSValue literal = {init};
+                            return literal;
+                        }}
+                    "#,
+                    name = name,
+                    init = init
+                )
+            })
+            .collect::<Vec<String>>()
+            .join("\n");
+        Ok(ModuleParts {
+            includes: format!("{}\n{}", additional_includes, RUNTIME_INCLUDES),
+            definitions: format!(
+                "{}\n{}\n{}\n{}",
+                self.regexps.join("\n"),
+                constant_literals,
+                native_fn_forward_decls,
+                Result::<Vec<String>>::from_iter(transpiled_native_fns)?.join("\n")
+            ),
+            setup: format!("{}\n{}", inits, global_exprs),
+            program: Result::<Vec<String>>::from_iter(
+                transpiled_imports.into_iter().chain(transpiled_items),
+            )?
+            .join(";\n"),
+        })
+    }
 
-        Ok(format!(
-            r#"
-                {additional_includes}
-                #include <experimental/coroutine>
-                #include "runtime/js_value.hpp"
-                #include "runtime/exceptions.hpp"
+    fn module_context(&mut self) -> Result<&mut ModuleContext> {
+        self.module_context.as_mut().ok_or(anyhow!(
+            "Module imports/exports are only supported when building from an entry module"
+        ))
+    }
 
-                int prog() {{
-                    {inits}
-                    {global_exprs}
-                    {program}
-                    return 0;
-                }}
+    fn import_source(&mut self, src: &Str) -> Result<ModuleInterface> {
+        let specifier = src.value.to_string();
+        self.module_context()?
+            .imports
+            .get(&specifier)
+            .cloned()
+            .ok_or(anyhow!("Unresolved import {:?}", specifier))
+    }
 
-                int main() {{
-                    {main}
-                }}
-            "#,
-            additional_includes = additional_includes,
-            inits = inits,
-            global_exprs = global_exprs,
-            program = Result::<Vec<String>>::from_iter(transpiled_items)?.join(";\n"),
-            main = main
+    fn transpile_import_decl(&mut self, import_decl: &ImportDecl) -> Result<String> {
+        let import = self.import_source(&import_decl.src)?;
+        let mut code = format!("{}::init(); {}", import.namespace, self.exception_check());
+        for specifier in &import_decl.specifiers {
+            let (local, value) = match specifier {
+                ImportSpecifier::Named(named) => {
+                    let imported = match &named.imported {
+                        Some(ModuleExportName::Ident(ident)) => ident.sym.to_string(),
+                        Some(ModuleExportName::Str(str)) => str.value.to_string(),
+                        None => named.local.sym.to_string(),
+                    };
+                    (&named.local, import.export(&imported)?)
+                }
+                ImportSpecifier::Default(default) => (&default.local, import.export("default")?),
+                ImportSpecifier::Namespace(namespace) => {
+                    let properties = import
+                        .exports
+                        .iter()
+                        .map(|name| {
+                            Ok(format!(
+                                r#"{{JSValue{{"{}"}}, {}}}"#,
+                                name,
+                                import.export(name)?
+                            ))
+                        })
+                        .collect::<Result<Vec<String>>>()?;
+                    (
+                        &namespace.local,
+                        format!("JSValue::new_object({{{}}})", properties.join(", ")),
+                    )
+                }
+            };
+            // Copies share the exported value’s box, so later assignments in
+            // the exporting module show through.
+            code += &format!("JSValue {} = {};", local.sym, value);
+        }
+        Ok(code)
+    }
+
+    fn transpile_module_decl(&mut self, decl: &ModuleDecl) -> Result<String> {
+        self.module_context()?;
+        let code = match decl {
+            // Hoisted, see `transpile_parts`.
+            ModuleDecl::Import(_) => return Ok("".into()),
+            ModuleDecl::ExportDecl(export_decl) => match &export_decl.decl {
+                Decl::Var(var_decl) => {
+                    if var_decl.kind != VarDeclKind::Let || var_decl.decls.len() > 1 {
+                        return Err(anyhow!("Only single-variable `let` exports are supported"));
+                    }
+                    let declarator = &var_decl.decls[0];
+                    let ident = declarator.name.as_ident().ok_or(anyhow!(
+                        "Only straight-up identifiers are supported for exports for now."
+                    ))?;
+                    if let Some(Expr::Fn(_) | Expr::Arrow(_)) = declarator.init.as_deref() {
+                        self.fn_name_hint = Some(ident.sym.to_string());
+                    }
+                    let init = declarator
+                        .init
+                        .as_ref()
+                        .map(|init| self.transpile_operand(init))
+                        .transpose()?
+                        .unwrap_or("JSValue::undefined()".into());
+                    self.export_assignment(&ident.sym, init)?
+                }
+                Decl::Fn(fn_decl) => {
+                    self.fn_name_hint = Some(fn_decl.ident.sym.to_string());
+                    let func = self.transpile_function(&fn_decl.function)?;
+                    self.export_assignment(&fn_decl.ident.sym, func)?
+                }
+                decl => return Err(anyhow!("Unsupported export: {:?}", decl)),
+            },
+            ModuleDecl::ExportDefaultExpr(export_default_expr) => {
+                let value = self.transpile_operand(&export_default_expr.expr)?;
+                self.export_assignment("default", value)?
+            }
+            ModuleDecl::ExportDefaultDecl(export_default_decl) => match &export_default_decl.decl {
+                DefaultDecl::Fn(fn_expr) => {
+                    let func = self.transpile_fn_expr(fn_expr)?;
+                    let assignment = self.export_assignment("default", func)?;
+                    match &fn_expr.ident {
+                        Some(ident) => format!(
+                            "{} JSValue {} = {};",
+                            assignment,
+                            ident.sym,
+                            export_variable("default")
+                        ),
+                        None => assignment,
+                    }
+                }
+                decl => return Err(anyhow!("Unsupported default export: {:?}", decl)),
+            },
+            ModuleDecl::ExportNamed(named_export) => {
+                let source = named_export
+                    .src
+                    .as_ref()
+                    .map(|src| self.import_source(src))
+                    .transpose()?;
+                let code = source
+                    .as_ref()
+                    .map(|source| {
+                        format!("{}::init(); {}", source.namespace, self.exception_check())
+                    })
+                    .unwrap_or_default();
+                for specifier in &named_export.specifiers {
+                    let named = match specifier {
+                        ExportSpecifier::Named(named) => named,
+                        specifier => {
+                            return Err(anyhow!("Unsupported export specifier: {:?}", specifier))
+                        }
+                    };
+                    let export_name = |name: &ModuleExportName| match name {
+                        ModuleExportName::Ident(ident) => ident.sym.to_string(),
+                        ModuleExportName::Str(str) => str.value.to_string(),
+                    };
+                    let orig = export_name(&named.orig);
+                    let exported = named
+                        .exported
+                        .as_ref()
+                        .map(export_name)
+                        .unwrap_or(orig.clone());
+                    let value = match &source {
+                        Some(source) => source.export(&orig)?,
+                        None => match &named.orig {
+                            ModuleExportName::Ident(ident) => self.transpile_ident(ident)?,
+                            _ => return Err(anyhow!("Can’t export a string name locally")),
+                        },
+                    };
+                    // Local bindings may be declared after the export, so
+                    // these are assigned once the module has run.
+                    self.add_export(&exported)?;
+                    self.module_context()?
+                        .export_aliases
+                        .push((exported, value));
+                }
+                code
+            }
+            decl => return Err(anyhow!("Unsupported module declaration: {:?}", decl)),
+        };
+        Ok(code)
+    }
+
+    fn add_export(&mut self, name: &str) -> Result<()> {
+        let context = self.module_context()?;
+        if context.exports.iter().any(|export| export == name) {
+            return Err(anyhow!("Duplicate export {:?}", name));
+        }
+        context.exports.push(name.to_string());
+        Ok(())
+    }
+
+    /// Declares the export `name` and assigns it `value`.
+    fn export_assignment(&mut self, name: &str, value: String) -> Result<String> {
+        self.add_export(name)?;
+        Ok(format!(
+            "{} = ({}).boxed_value(); {}",
+            export_variable(name),
+            value,
+            self.exception_check()
         ))
     }
 
+    /// The runtime files the globals of the last transpiled module need.
+    pub fn global_sources(&self) -> Vec<String> {
+        self.globals
+            .iter()
+            .flat_map(|global| global.additional_sources.clone().unwrap_or(vec![]))
+            .collect()
+    }
+
     fn transpile_stmt(&mut self, stmt: &Stmt) -> Result<String> {
         let transpiled_stmt = match stmt {
             Stmt::Decl(decl) => self.transpile_decl(decl)?,
-            Stmt::Expr(expr_stmt) => self.transpile_expr(&expr_stmt.expr)?,
+            Stmt::Expr(expr_stmt) => match checked_assignment(expr_stmt) {
+                Some((ident, right)) if self.status_exceptions => {
+                    self.transpile_checked_assignment(ident, right)?
+                }
+                _ => self.transpile_expr(&expr_stmt.expr)?,
+            },
             Stmt::Block(block_stmt) => self.transpile_block_stmt(block_stmt)?,
             Stmt::Return(return_stmt) => self.transpile_return_stmt(return_stmt)?,
             Stmt::If(if_stmt) => self.transpile_if_stmt(if_stmt)?,
@@ -117,17 +815,83 @@ impl Transpiler {
             Stmt::Break(break_stmt) => self.transpile_break_stmt(break_stmt)?,
             Stmt::Try(try_stmt) => self.transpile_try_stmt(try_stmt)?,
             Stmt::Throw(throw_stmt) => self.transpile_throw_stmt(throw_stmt)?,
+            Stmt::Empty(_) => "".to_string(),
             _ => return Err(anyhow!("Unsupported statemt: {:?}", stmt)),
         };
+        let transpiled_stmt = if self.status_exceptions && head_may_throw(stmt) {
+            format!("{}; {}", transpiled_stmt, self.exception_check())
+        } else {
+            transpiled_stmt
+        };
+        let transpiled_stmt =
+            if self.heap_profile && !matches!(stmt, Stmt::Block(_) | Stmt::Empty(_)) {
+                let (line, _) = self.location(stmt.span());
+                format!(
+                    "js_heap_site = \"{}:{}\"; {}",
+                    self.source_name, line, transpiled_stmt
+                )
+            } else {
+                transpiled_stmt
+            };
+        if self.profile {
+            let (line, _) = self.location(stmt.span());
+            return Ok(format!(
+                "\n#line {} \"{}\"\n{};",
+                line, self.source_name, transpiled_stmt
+            ));
+        }
         Ok(format!("{};", transpiled_stmt))
     }
 
     fn transpile_throw_stmt(&mut self, throw_stmt: &ThrowStmt) -> Result<String> {
         let expr = self.transpile_expr(&throw_stmt.arg)?;
+        if self.status_exceptions {
+            return Ok(format!("js_throw({}); {}", expr, self.exception_exit()));
+        }
         Ok(format!("js_throw({})", expr))
     }
 
-    fn transpile_catch_clause(&mut self, catch_clause: &CatchClause) -> Result<String> {
+    /// In status mode, a statement that leaves the current function, or
+    /// jumps to the innermost `catch`, if an exception is pending.
+    fn exception_check(&self) -> String {
+        if !self.status_exceptions {
+            return "".into();
+        }
+        format!(
+            "if (js_has_pending_exception()) {{ {} }}",
+            self.exception_exit()
+        )
+    }
+
+    fn exception_exit(&self) -> String {
+        if let Some(label) = self.catch_labels.last() {
+            return format!("goto {};", label);
+        }
+        if self.function_depth == 0 {
+            // `main` reports the exception once `prog()` returns.
+            return "return 0;".into();
+        }
+        match self.function_kind {
+            FunctionKind::Plain => "return JSValue::undefined();",
+            FunctionKind::Generator => "co_return;",
+            FunctionKind::Async => "co_return JSValue::undefined();",
+        }
+        .into()
+    }
+
+    /// `x = f()` in status mode: if `f` throws, `x` keeps its old value.
+    fn transpile_checked_assignment(&mut self, ident: &Ident, right: &Expr) -> Result<String> {
+        let right = self.transpile_operand(right)?;
+        Ok(format!(
+            "{{ JSValue js_assigned = {}; {} {} = js_assigned.boxed_value(); }}",
+            right,
+            self.exception_check(),
+            ident.sym
+        ))
+    }
+
+    /// Returns the name of the caught exception and the catch block.
+    fn transpile_catch_clause(&mut self, catch_clause: &CatchClause) -> Result<(String, String)> {
         let ident = catch_clause
             .param
             .as_ref()
@@ -141,38 +905,60 @@ impl Transpiler {
             .transpose()?
             .unwrap_or(format!("__unused"));
         let body = self.transpile_block_stmt(&catch_clause.body)?;
-
-        Ok(format!(
-            r#"
-                catch(JSValue {}) {{
-                    {}
-                }}
-            "#,
-            ident, body
-        ))
+        Ok((ident, body))
     }
 
     fn transpile_try_stmt(&mut self, try_stmt: &TryStmt) -> Result<String> {
         if try_stmt.finalizer.is_some() {
             return Err(anyhow!("`finally` not supported yet"));
         }
-        let block = self.transpile_block_stmt(&try_stmt.block)?;
-        let handler = self.transpile_catch_clause(
-            try_stmt
-                .handler
-                .as_ref()
-                .ok_or(anyhow!("Missing catch handler"))?,
-        )?;
+        let catch_clause = try_stmt
+            .handler
+            .as_ref()
+            .ok_or(anyhow!("Missing catch handler"))?;
+
+        if self.status_exceptions {
+            // Checks inside the block jump to the handler, which takes the
+            // pending exception.
+            let id = self.try_count;
+            self.try_count += 1;
+            self.catch_labels.push(format!("js_catch_{}", id));
+            let block = self.transpile_block_stmt(&try_stmt.block);
+            self.catch_labels.pop();
+            let block = block?;
+            let (ident, body) = self.transpile_catch_clause(catch_clause)?;
+            return Ok(format!(
+                r#"
+                    {{
+                        {block}
+                    }}
+                    goto js_try_end_{id};
+                    js_catch_{id}: {{
+                        JSValue {ident} = js_take_pending_exception();
+                        {body}
+                    }}
+                    js_try_end_{id}:
+                "#,
+                block = block,
+                id = id,
+                ident = ident,
+                body = body
+            ));
+        }
 
+        let block = self.transpile_block_stmt(&try_stmt.block)?;
+        let (ident, body) = self.transpile_catch_clause(catch_clause)?;
         if self.feature_exceptions {
             Ok(format!(
                 r#"
                     try {{
                         {}
                     }}
-                    {}
+                    catch(JSValue {}) {{
+                        {}
+                    }}
                 "#,
-                block, handler
+                block, ident, body
             ))
         } else {
             Ok(format!(
@@ -187,37 +973,246 @@ impl Transpiler {
     }
 
     fn transpile_for_of_stmt(&mut self, for_of_stmt: &ForOfStmt) -> Result<String> {
-        let left = match &for_of_stmt.left {
-            VarDeclOrPat::VarDecl(var_decl) => self.transpile_var_decl(&var_decl)?,
+        let (left, copy) = match &for_of_stmt.left {
+            VarDeclOrPat::VarDecl(var_decl) => {
+                let left = self.transpile_var_decl(&var_decl)?;
+                match var_decl.decls[0].name.as_ident() {
+                    // Elements share their box with the array, so a variable
+                    // that is assigned to gets a copy.
+                    Some(ident) if self.assigned_names.contains(&*ident.sym) => (
+                        format!("JSValue js_elem_{}", ident.sym),
+                        format!("{} = js_elem_{}.boxed_value();", left, ident.sym),
+                    ),
+                    _ => (left, "".to_string()),
+                }
+            }
             _ => return Err(anyhow!("Only simple variables are supported in for-of")),
         };
 
         let right = self.transpile_expr(&for_of_stmt.right)?;
-        let body = self.transpile_stmt(&for_of_stmt.body)?;
+        self.in_loop(|this| {
+            let body = this.transpile_stmt(&for_of_stmt.body)?;
+            // Advancing the iterator may throw.
+            let check = this.exception_check();
+            Ok(format!(
+                r#"
+                    for({left} : {right}) {{
+                        {check}
+                        {copy}
+                        {body}
+                    }}
+                "#,
+                left = left,
+                right = right,
+                check = check,
+                copy = copy,
+                body = body,
+            ))
+        })
+    }
+
+    fn transpile_break_stmt(&mut self, _break_stmt: &BreakStmt) -> Result<String> {
+        Ok(format!("break"))
+    }
+
+    fn transpile_while_stmt(&mut self, while_stmt: &WhileStmt) -> Result<String> {
+        self.in_loop(|this| {
+            let test = this.transpile_condition(&while_stmt.test)?;
+            let body = this.transpile_stmt(&while_stmt.body)?;
+            let check = if scope::may_throw(&while_stmt.test) {
+                this.exception_check()
+            } else {
+                "".into()
+            };
+            Ok(format!("while({}) {{ {} {} }}", test, check, body))
+        })
+    }
+
+    /// Recognizes `for (let i = <n>; i < arr.length; i++)` where neither `i`
+    /// nor `arr` is reassigned. Returns `i`, `arr` and `n`.
+    fn counted_loop(&self, for_stmt: &ForStmt) -> Option<(String, String, u32)> {
+        let var_decl = match for_stmt.init.as_ref()? {
+            VarDeclOrExpr::VarDecl(var_decl) if var_decl.decls.len() == 1 => var_decl,
+            _ => return None,
+        };
+        let index = var_decl.decls[0].name.as_ident()?.sym.to_string();
+        let start = match var_decl.decls[0].init.as_deref()? {
+            Expr::Lit(Lit::Num(num))
+                if num.value >= 0.0 && num.value.fract() == 0.0 && num.value <= u32::MAX as f64 =>
+            {
+                num.value as u32
+            }
+            _ => return None,
+        };
+        let is_index = |expr: &Expr| matches!(expr, Expr::Ident(ident) if *ident.sym == *index);
+        let array = match for_stmt.test.as_deref()? {
+            Expr::Bin(BinExpr {
+                op: BinaryOp::Lt,
+                left,
+                right,
+                ..
+            }) if is_index(left) => match right.as_ref() {
+                Expr::Member(MemberExpr {
+                    obj,
+                    prop: MemberProp::Ident(prop),
+                    ..
+                }) if &*prop.sym == "length" => obj.as_ident()?.sym.to_string(),
+                _ => return None,
+            },
+            _ => return None,
+        };
+        let is_increment = match for_stmt.update.as_deref()? {
+            Expr::Update(update_expr) => {
+                update_expr.op == UpdateOp::PlusPlus && is_index(&update_expr.arg)
+            }
+            Expr::Assign(AssignExpr {
+                op: AssignOp::Assign,
+                left: PatOrExpr::Pat(pat),
+                right,
+                ..
+            }) => {
+                let is_one =
+                    |expr: &Expr| matches!(expr, Expr::Lit(Lit::Num(num)) if num.value == 1.0);
+                pat.as_ident()
+                    .map_or(false, |ident| *ident.id.sym == *index)
+                    && matches!(right.as_ref(), Expr::Bin(BinExpr { op: BinaryOp::Add, left, right, .. })
+                        if (is_index(left) && is_one(right)) || (is_one(left) && is_index(right)))
+            }
+            _ => false,
+        };
+        let body_usage = scope::Usage::of(for_stmt.body.as_ref());
+        if !is_increment
+            || index == array
+            || self.assigned_names.contains(&array)
+            || self.native_functions.contains_key(&array)
+            || body_usage.assigned.contains(&index)
+            || body_usage.declared.contains_key(&index)
+            || body_usage.declared.contains_key(&array)
+        {
+            return None;
+        }
+        Some((index, array, start))
+    }
+
+    /// Emits a counted loop with a `size_t` induction variable for arrays,
+    /// falling back to the generic loop for anything else.
+    fn transpile_counted_loop(
+        &mut self,
+        for_stmt: &ForStmt,
+        index: String,
+        array: String,
+        start: u32,
+    ) -> Result<String> {
+        let id = self.counted_loop_count;
+        self.counted_loop_count += 1;
+        let checked = scope::may_resize_arrays(&for_stmt.body, &array);
+        self.counted_loops.push(CountedLoop {
+            index: index.clone(),
+            array: array.clone(),
+            id,
+            function_depth: self.function_depth,
+            checked,
+            index_used: false,
+        });
+        let fast = self.in_loop(|this| {
+            let body = this.transpile_stmt(for_stmt.body.as_ref())?;
+            let index_decl = if this.counted_loops.last().map_or(false, |l| l.index_used) {
+                format!("JSValue {}{{static_cast<double>(js_idx_{})}};", index, id)
+            } else {
+                "".to_string()
+            };
+            // Without calls or other property accesses in the body the length
+            // can’t change, so it is read once and the loop condition is the
+            // only bounds check.
+            let header = if checked {
+                format!(
+                    "size_t js_idx_{id} = {start}; js_idx_{id} < js_view_{id}.size(); ++js_idx_{id}",
+                    id = id,
+                    start = start
+                )
+            } else {
+                format!(
+                    "size_t js_idx_{id} = {start}, js_len_{id} = js_view_{id}.size(); js_idx_{id} < js_len_{id}; ++js_idx_{id}",
+                    id = id,
+                    start = start
+                )
+            };
+            Ok(format!(
+                r#"
+                    for({header}) {{
+                        {index_decl}
+                        {body}
+                    }}
+                "#,
+                header = header,
+                index_decl = index_decl,
+                body = body
+            ))
+        });
+        self.counted_loops.pop();
+        let fast = fast?;
+
+        let outer_fallback = std::mem::replace(&mut self.in_loop_fallback, true);
+        let generic = self.transpile_generic_for_stmt(for_stmt);
+        self.in_loop_fallback = outer_fallback;
 
         Ok(format!(
             r#"
-                for({left} : {right}) {{
-                    {body}
+                {{
+                    JSArrayView js_view_{id}{{{array}}};
+                    if (js_view_{id}.is_array()) {{
+                        {fast}
+                    }} else {{
+                        {generic}
+                    }}
                 }}
             "#,
-            left = left,
-            right = right,
-            body = body,
+            id = id,
+            array = array,
+            fast = fast,
+            generic = generic?
         ))
     }
 
-    fn transpile_break_stmt(&mut self, _break_stmt: &BreakStmt) -> Result<String> {
-        Ok(format!("break"))
+    /// `array[index]` inside a counted loop over `array` becomes a direct
+    /// element access.
+    fn counted_loop_element(&self, member_expr: &MemberExpr) -> Option<String> {
+        let counted_loop = self.counted_loop_of(member_expr)?;
+        Some(if counted_loop.checked {
+            format!("js_view_{id}.at(js_idx_{id})", id = counted_loop.id)
+        } else {
+            format!("js_view_{id}[js_idx_{id}]", id = counted_loop.id)
+        })
+    }
+
+    /// The counted loop whose array and index `member_expr` refers to.
+    fn counted_loop_of(&self, member_expr: &MemberExpr) -> Option<&CountedLoop> {
+        let array = member_expr.obj.as_ident()?;
+        let index = match &member_expr.prop {
+            MemberProp::Computed(computed) => computed.expr.as_ident()?,
+            _ => return None,
+        };
+        let counted_loop = self
+            .counted_loops
+            .iter()
+            .rev()
+            .find(|counted_loop| counted_loop.index == &*index.sym)?;
+        if counted_loop.array != &*array.sym || counted_loop.function_depth != self.function_depth {
+            return None;
+        }
+        Some(counted_loop)
     }
 
-    fn transpile_while_stmt(&mut self, while_stmt: &WhileStmt) -> Result<String> {
-        let test = self.transpile_expr(&while_stmt.test)?;
-        let body = self.transpile_stmt(&while_stmt.body)?;
-        Ok(format!("while(({}).coerce_to_bool()) {{ {} }}", test, body))
+    fn transpile_for_stmt(&mut self, for_stmt: &ForStmt) -> Result<String> {
+        if self.optimize && !self.in_loop_fallback {
+            if let Some((index, array, start)) = self.counted_loop(for_stmt) {
+                return self.transpile_counted_loop(for_stmt, index, array, start);
+            }
+        }
+        self.transpile_generic_for_stmt(for_stmt)
     }
 
-    fn transpile_for_stmt(&mut self, for_stmt: &ForStmt) -> Result<String> {
+    fn transpile_generic_for_stmt(&mut self, for_stmt: &ForStmt) -> Result<String> {
         let init = for_stmt
             .init
             .as_ref()
@@ -228,37 +1223,46 @@ impl Transpiler {
             .transpose()?
             .unwrap_or("".to_string());
 
-        let test = for_stmt
-            .test
-            .as_ref()
-            .map(|expr| self.transpile_expr(expr))
-            .transpose()?
-            .unwrap_or("".to_string());
+        self.in_loop(|this| {
+            let test = for_stmt
+                .test
+                .as_ref()
+                .map(|expr| this.transpile_condition(expr))
+                .transpose()?
+                .unwrap_or("true".to_string());
 
-        let update = for_stmt
-            .update
-            .as_ref()
-            .map(|expr| self.transpile_expr(expr))
-            .transpose()?
-            .unwrap_or("".to_string());
+            let update = for_stmt
+                .update
+                .as_ref()
+                .map(|expr| this.transpile_expr(expr))
+                .transpose()?
+                .unwrap_or("".to_string());
 
-        let body = self.transpile_stmt(for_stmt.body.as_ref())?;
+            let body = this.transpile_stmt(for_stmt.body.as_ref())?;
+            let check = if for_head_may_throw(for_stmt) {
+                this.exception_check()
+            } else {
+                "".into()
+            };
 
-        Ok(format!(
-            r#"
-                for({init};({test}).coerce_to_bool();{update}) {{
-                    {body}
-                }}
-            "#,
-            init = init,
-            test = test,
-            update = update,
-            body = body,
-        ))
+            Ok(format!(
+                r#"
+                    for({init};{test};{update}) {{
+                        {check}
+                        {body}
+                    }}
+                "#,
+                init = init,
+                test = test,
+                update = update,
+                check = check,
+                body = body,
+            ))
+        })
     }
 
     fn transpile_if_stmt(&mut self, if_stmt: &IfStmt) -> Result<String> {
-        let test = self.transpile_expr(&if_stmt.test)?;
+        let test = self.transpile_condition(&if_stmt.test)?;
         let cons = self.transpile_stmt(&if_stmt.cons)?;
         let alt = if_stmt
             .alt
@@ -266,27 +1270,38 @@ impl Transpiler {
             .map(|alt| self.transpile_stmt(alt.as_ref()))
             .transpose()?
             .unwrap_or("".into());
+        // A test that threw must not run either branch.
+        let check = if scope::may_throw(&if_stmt.test) {
+            self.exception_check()
+        } else {
+            "".into()
+        };
         Ok(format!(
             r#"
-                if(({}).coerce_to_bool()) {{
-                    {}
+                if({test}) {{
+                    {check}
+                    {cons}
                 }} else {{
-                    {}
+                    {check}
+                    {alt}
                 }}
             "#,
-            test, cons, alt
+            test = test,
+            check = check,
+            cons = cons,
+            alt = alt
         ))
     }
 
     fn transpile_return_stmt(&mut self, return_stmt: &ReturnStmt) -> Result<String> {
         let arg = match &return_stmt.arg {
-            None => "".to_string(),
+            None if self.function_kind == FunctionKind::Generator => "".to_string(),
+            None => "JSValue::undefined()".to_string(),
             Some(expr) => self.transpile_expr(expr)?,
         };
-        let ret_style = if self.is_generator {
-            "co_return"
-        } else {
-            "return"
+        let ret_style = match self.function_kind {
+            FunctionKind::Plain => "return",
+            FunctionKind::Generator | FunctionKind::Async => "co_return",
         };
         Ok(format!("{} {};", ret_style, arg))
     }
@@ -299,8 +1314,82 @@ impl Transpiler {
         }
     }
 
+    /// Declarations of the native function for `fn_decl` and of the accessor
+    /// for its (lazily created) `JSValue` wrapper.
+    fn native_function_signatures(&self, fn_decl: &FnDecl) -> String {
+        let name = &fn_decl.ident.sym;
+        let params = self.native_functions[&*fn_decl.ident.sym]
+            .iter()
+            .map(|param| format!("JSValue {}", param))
+            .collect::<Vec<String>>()
+            .join(", ");
+        format!(
+            "static JSValue js_fn_{name}({params});\nstatic JSValue js_fn_{name}_value();",
+            name = name,
+            params = params
+        )
+    }
+
+    fn transpile_native_function(&mut self, fn_decl: &FnDecl) -> Result<String> {
+        let name = format!("{}", fn_decl.ident.sym);
+        let param_count = self.native_functions[&name].len();
+        let body = self.in_function(FunctionKind::Plain, |this| match &fn_decl.function.body {
+            Some(block_stmt) => this.transpile_block_stmt(block_stmt),
+            _ => Err(anyhow!("Function lacks a body")),
+        })?;
+        if self.profile {
+            self.add_symbol(
+                format!("js_fn_{}", name),
+                name.clone(),
+                fn_decl.function.span,
+            );
+        }
+        let params = self.native_functions[&name]
+            .iter()
+            .map(|param| format!("JSValue {}", param))
+            .collect::<Vec<String>>()
+            .join(", ");
+        let forwarded_args = (0..param_count)
+            .map(|idx| format!("args.size() > {0} ? args[{0}] : JSValue::undefined()", idx))
+            .collect::<Vec<String>>()
+            .join(", ");
+        // Direct calls bypass `JSFunction::call`, which does the same.
+        let entry_check = if self.status_exceptions {
+            "if (js_has_pending_exception()) return JSValue::undefined();"
+        } else {
+            ""
+        };
+        Ok(format!(
+            r#"
+                static JSValue js_fn_{name}({params}) {{
+                    {entry_check}
+                    {body}
+                    return JSValue::undefined();
+                }}
+
+                static JSValue js_fn_{name}_value() {{
+                    static JSValue value = JSValue::new_function(
+                        [](JSValue thisArg, std::vector<JSValue>& args) -> JSValue {{
+                            return js_fn_{name}({forwarded_args});
+                        }});
+                    return value;
+                }}
+            "#,
+            name = name,
+            params = params,
+            entry_check = entry_check,
+            body = body,
+            forwarded_args = forwarded_args
+        ))
+    }
+
     fn transpile_fn_decl(&mut self, fn_decl: &FnDecl) -> Result<String> {
         let name = format!("{}", fn_decl.ident.sym);
+        if self.native_functions.contains_key(&name) {
+            // Emitted as a native function ahead of `prog()`.
+            return Ok("".into());
+        }
+        self.fn_name_hint = Some(name.clone());
         let func = self.transpile_function(&fn_decl.function)?;
         Ok(format!("JSValue {} = {};", name, func))
     }
@@ -319,13 +1408,16 @@ impl Transpiler {
         let ident = var_decl.name.as_ident().ok_or(anyhow!(
             "Only straight-up identifiers are supported for variable declarations for now."
         ))?;
+        if let Some(Expr::Fn(_) | Expr::Arrow(_)) = var_decl.init.as_deref() {
+            self.fn_name_hint = Some(format!("{}", ident.sym));
+        }
         let init = var_decl
             .init
             .as_ref()
             .map(|init| -> Result<String> {
                 Ok(format!(
                     " = ({}).boxed_value()",
-                    self.transpile_expr(&init)?
+                    self.transpile_operand(&init)?
                 ))
             })
             .unwrap_or(Ok("".to_string()))?;
@@ -334,7 +1426,7 @@ impl Transpiler {
 
     fn transpile_expr(&mut self, expr: &Expr) -> Result<String> {
         match expr {
-            Expr::Ident(ident) => Ok(format!("{}", ident.sym)),
+            Expr::Ident(ident) => self.transpile_ident(ident),
             Expr::Lit(literal) => self.transpile_literal(literal),
             Expr::Array(array_lit) => self.transpile_array_literal(array_lit),
             Expr::Call(call_expr) => self.transpile_call_expr(call_expr),
@@ -351,6 +1443,8 @@ impl Transpiler {
             Expr::Cond(cond_expr) => self.transpile_cond_expr(cond_expr),
             Expr::Update(update_expr) => self.transpile_update_expr(update_expr),
             Expr::Yield(yield_expr) => self.transpile_yield_expr(yield_expr),
+            Expr::Await(await_expr) => self.transpile_await_expr(await_expr),
+            Expr::Unary(unary_expr) => self.transpile_unary_expr(unary_expr),
             _ => Err(anyhow!("Unsupported expression {:?}", expr)),
         }
     }
@@ -377,7 +1471,29 @@ impl Transpiler {
         }
     }
 
+    fn transpile_await_expr(&mut self, await_expr: &AwaitExpr) -> Result<String> {
+        if self.function_kind != FunctionKind::Async {
+            return Err(anyhow!("`await` is only supported inside async functions"));
+        }
+        Ok(format!(
+            "co_await ({})",
+            self.transpile_expr(&await_expr.arg)?
+        ))
+    }
+
     fn transpile_update_expr(&mut self, update_expr: &UpdateExpr) -> Result<String> {
+        if let Expr::Member(member_expr) = update_expr.arg.as_ref() {
+            let obj = self.transpile_expr(&member_expr.obj)?;
+            let prop = self.transpile_member_prop(&member_expr.prop)?;
+            let delta = match update_expr.op {
+                UpdateOp::MinusMinus => "-1.0",
+                UpdateOp::PlusPlus => "1.0",
+            };
+            return Ok(format!(
+                "({}).update_property({}, {}, {})",
+                obj, prop, delta, update_expr.prefix
+            ));
+        }
         let expr = self.transpile_expr(update_expr.arg.as_ref())?;
         let op = match update_expr.op {
             UpdateOp::MinusMinus => "--",
@@ -390,18 +1506,24 @@ impl Transpiler {
     }
 
     fn transpile_cond_expr(&mut self, cond_expr: &CondExpr) -> Result<String> {
-        let test = self.transpile_expr(&cond_expr.test)?;
+        let test = self.transpile_condition(&cond_expr.test)?;
         let cons = self.transpile_expr(&cond_expr.cons)?;
         let alt = self.transpile_expr(&cond_expr.alt)?;
-        Ok(format!("({}).coerce_to_bool()?({}):({})", test, cons, alt))
+        Ok(format!("({})?({}):({})", test, cons, alt))
     }
 
     fn transpile_assign_expr(&mut self, assign_expr: &AssignExpr) -> Result<String> {
-        let left = match &assign_expr.left {
-            PatOrExpr::Expr(expr) => self.transpile_expr(expr)?,
+        if assign_expr.op != AssignOp::Assign {
+            return Err(anyhow!("Unsupported assign operation {:?}", assign_expr.op));
+        }
+        let target = match &assign_expr.left {
+            PatOrExpr::Expr(expr) => expr.as_ref(),
             PatOrExpr::Pat(pat) => match pat.as_ref() {
-                Pat::Expr(expr) => self.transpile_expr(expr)?,
-                Pat::Ident(ident) => format!("{}", ident.sym),
+                Pat::Expr(expr) => expr.as_ref(),
+                Pat::Ident(ident) => {
+                    let right = self.transpile_operand(&assign_expr.right)?;
+                    return Ok(format!("{} = ({}).boxed_value()", ident.sym, right));
+                }
                 _ => {
                     return Err(anyhow!(
                         "Unsupported assignment pattern {:?}",
@@ -410,12 +1532,39 @@ impl Transpiler {
                 }
             },
         };
-        let right = self.transpile_expr(&assign_expr.right)?;
-        let op = match assign_expr.op {
-            AssignOp::Assign => "=",
-            _ => return Err(anyhow!("Unsupported assign operation {:?}", assign_expr.op)),
-        };
-        Ok(format!("{} {} ({}).boxed_value()", left, op, right))
+        if let Expr::Member(member_expr) = target {
+            return self.transpile_member_assign(member_expr, &assign_expr.right);
+        }
+        let left = self.transpile_expr(target)?;
+        let right = self.transpile_operand(&assign_expr.right)?;
+        Ok(format!("{} = ({}).boxed_value()", left, right))
+    }
+
+    /// Property assignments go through `set_property`, which lets arrays
+    /// store numbers unboxed.
+    fn transpile_member_assign(
+        &mut self,
+        member_expr: &MemberExpr,
+        right: &Expr,
+    ) -> Result<String> {
+        if let Some(id) = self
+            .counted_loop_of(member_expr)
+            .map(|counted_loop| counted_loop.id)
+        {
+            let value = self.transpile_operand(right)?;
+            return Ok(format!(
+                "js_view_{id}.set(js_idx_{id}, JSValue{{({value}).boxed_value()}})",
+                id = id,
+                value = value
+            ));
+        }
+        let obj = self.transpile_expr(&member_expr.obj)?;
+        let prop = self.transpile_member_prop(&member_expr.prop)?;
+        let value = self.transpile_operand(right)?;
+        Ok(format!(
+            "({}).set_property({}, JSValue{{({}).boxed_value()}})",
+            obj, prop, value
+        ))
     }
 
     fn transpile_this_expr(&mut self, _this_expr: &ThisExpr) -> Result<String> {
@@ -423,8 +1572,11 @@ impl Transpiler {
     }
 
     fn transpile_function(&mut self, function: &Function) -> Result<String> {
+        if function.is_async && function.is_generator {
+            return Err(anyhow!("Async generators are not supported"));
+        }
         if function.is_async {
-            return Err(anyhow!("Async functions not supported yet"));
+            return self.transpile_async_function(function);
         }
         if function.is_generator {
             return self.transpile_generator_function(function);
@@ -434,42 +1586,80 @@ impl Transpiler {
 
     fn transpile_generator_function(&mut self, function: &Function) -> Result<String> {
         assert!(function.is_generator);
-        self.is_generator = true;
-        let param_destructure =
-            self.transpile_param_destructure(function.params.iter().map(|param| &param.pat))?;
-        let body = match &function.body {
-            Some(block_stmt) => self.transpile_block_stmt(block_stmt)?,
-            _ => return Err(anyhow!("Function lacks a body")),
-        };
-        self.is_generator = false;
-        Ok(format!(
-            "JSValue::new_generator_function([=](JSValue thisArg, std::vector<JSValue>& args) mutable -> JSGeneratorAdapter {{
+        let name_hint = self.fn_name_hint.take();
+        let (param_destructure, body) = self.in_function(FunctionKind::Generator, |this| {
+            this.transpile_function_body(function)
+        })?;
+        self.fn_name_hint = name_hint;
+        let lambda = format!(
+            "[=](JSValue thisArg, std::vector<JSValue>& args) mutable -> JSGeneratorAdapter {{
                     {}
                     {}
                     co_return;
-                }})",
+                }}",
+            param_destructure, body
+        );
+        Ok(format!(
+            "JSValue::new_generator_function({})",
+            self.named_function(function.span, lambda)
+        ))
+    }
+
+    fn transpile_async_function(&mut self, function: &Function) -> Result<String> {
+        let name_hint = self.fn_name_hint.take();
+        let (param_destructure, body) = self.in_function(FunctionKind::Async, |this| {
+            this.transpile_function_body(function)
+        })?;
+        self.fn_name_hint = name_hint;
+        let lambda = format!(
+            "[=](JSValue thisArg, std::vector<JSValue>& args) mutable -> JSAsyncAdapter {{
+                    {}
+                    {}
+                    co_return JSValue::undefined();
+                }}",
             param_destructure, body
+        );
+        Ok(format!(
+            "JSValue::new_async_function({})",
+            self.named_function(function.span, lambda)
         ))
     }
 
     fn transpile_plain_function(&mut self, function: &Function) -> Result<String> {
+        let name_hint = self.fn_name_hint.take();
+        let (param_destructure, body) = self.in_function(FunctionKind::Plain, |this| {
+            this.transpile_function_body(function)
+        })?;
+        self.fn_name_hint = name_hint;
+        let lambda = format!(
+            "[=](JSValue thisArg, std::vector<JSValue>& args) mutable -> JSValue {{
+                    {}
+                    {}
+                    return JSValue::undefined();
+                }}",
+            param_destructure, body
+        );
+        Ok(format!(
+            "JSValue::new_function({})",
+            self.named_function(function.span, lambda)
+        ))
+    }
+
+    /// Returns the parameter destructuring and the body of `function`.
+    fn transpile_function_body(&mut self, function: &Function) -> Result<(String, String)> {
         let param_destructure =
             self.transpile_param_destructure(function.params.iter().map(|param| &param.pat))?;
         let body = match &function.body {
             Some(block_stmt) => self.transpile_block_stmt(block_stmt)?,
             _ => return Err(anyhow!("Function lacks a body")),
         };
-        Ok(format!(
-            "JSValue::new_function([=](JSValue thisArg, std::vector<JSValue>& args) mutable -> JSValue {{
-                    {}
-                    {}
-                    return JSValue::undefined();
-                }})",
-            param_destructure, body
-        ))
+        Ok((param_destructure, body))
     }
 
     fn transpile_fn_expr(&mut self, fn_expr: &FnExpr) -> Result<String> {
+        if let Some(ident) = &fn_expr.ident {
+            self.fn_name_hint = Some(format!("{}", ident.sym));
+        }
         self.transpile_function(&fn_expr.function)
     }
 
@@ -494,13 +1684,38 @@ impl Transpiler {
             })
             .collect();
         let prop_defs = Result::<Vec<String>>::from_iter(transpiled_props)?.join(",\n");
-        Ok(format!("JSValue::new_object({{ {} }})", prop_defs))
+        let init = format!("JSValue::new_object({{ {} }})", prop_defs);
+        if self.optimize && is_constant_object(object_lit) {
+            return Ok(self.share_constant_literal(init));
+        }
+        Ok(init)
+    }
+
+    /// Creates the constant array or object literal `init` once, in a
+    /// `static` variable. Evaluating the literal creates a value that shares
+    /// its elements until it is written to.
+    fn share_constant_literal(&mut self, init: String) -> String {
+        let name = match self
+            .constant_literals
+            .iter()
+            .find(|(_, existing)| *existing == init)
+        {
+            Some((name, _)) => name.clone(),
+            None => {
+                let name = format!("js_const_{}", self.constant_literals.len());
+                self.constant_literals.push((name.clone(), init));
+                name
+            }
+        };
+        format!("JSValue::from_literal({}())", name)
     }
 
     fn transpile_prop_method(&mut self, method: &MethodProp) -> Result<String> {
+        let key = self.transpile_prop_name(&method.key)?;
+        self.fn_name_hint = prop_name_hint(&method.key);
         Ok(format!(
             "{{ {}, {} }}",
-            self.transpile_prop_name(&method.key)?,
+            key,
             self.transpile_function(&method.function)?
         ))
     }
@@ -510,51 +1725,76 @@ impl Transpiler {
             .param
             .as_ident()
             .ok_or(anyhow!("Setter parameter must be an ident"))?;
+        let key = self.transpile_prop_name(&setter.key)?;
+        let body = self.in_function(FunctionKind::Plain, |this| {
+            this.transpile_block_stmt(setter.body.as_ref().ok_or(anyhow!("Getter needs a body"))?)
+        })?;
+        let lambda = format!(
+            r#"[=](JSValue thisArg, std::vector<JSValue>& args) mutable -> JSValue {{
+                JSValue {} = args[0];
+                {}
+                return JSValue::undefined();
+            }}"#,
+            ident.sym, body
+        );
+        self.fn_name_hint = prop_name_hint(&setter.key).map(|name| format!("set_{}", name));
         Ok(format!(
             r#"{{
                 {},
                 JSValue::with_getter_setter(
                     JSValue::undefined(),
-                    JSValue::new_function([=](JSValue thisArg, std::vector<JSValue>& args) mutable -> JSValue {{
-                        JSValue {} = args[0];
-                        {}
-                        return JSValue::undefined();
-                    }})
+                    JSValue::new_function({})
                 )
             }}"#,
-            self.transpile_prop_name(&setter.key)?,
-            ident.sym,
-            self.transpile_block_stmt(setter.body.as_ref().ok_or(anyhow!("Getter needs a body"))?)?
+            key,
+            self.named_function(setter.span, lambda)
         ))
     }
 
     fn transpile_prop_getter(&mut self, getter: &GetterProp) -> Result<String> {
+        let key = self.transpile_prop_name(&getter.key)?;
+        let body = self.in_function(FunctionKind::Plain, |this| {
+            this.transpile_block_stmt(getter.body.as_ref().ok_or(anyhow!("Getter needs a body"))?)
+        })?;
+        let lambda = format!(
+            r#"[=](JSValue thisArg, std::vector<JSValue>& args) mutable -> JSValue {{
+                {}
+                return JSValue::undefined();
+            }}"#,
+            body
+        );
+        self.fn_name_hint = prop_name_hint(&getter.key).map(|name| format!("get_{}", name));
         Ok(format!(
             r#"{{
                 {},
                 JSValue::with_getter_setter(
-                    JSValue::new_function([=](JSValue thisArg, std::vector<JSValue>& args) mutable -> JSValue {{
-                        {}
-                        return JSValue::undefined();
-                    }}),
+                    JSValue::new_function({}),
                     JSValue::undefined()
                 )
             }}"#,
-            self.transpile_prop_name(&getter.key)?,
-            self.transpile_block_stmt(getter.body.as_ref().ok_or(anyhow!("Getter needs a body"))?)?
+            key,
+            self.named_function(getter.span, lambda)
         ))
     }
 
     fn transpile_prop_keyvalue(&mut self, key_value: &KeyValueProp) -> Result<String> {
+        let key = self.transpile_prop_name(&key_value.key)?;
+        if let Expr::Fn(_) | Expr::Arrow(_) = key_value.value.as_ref() {
+            self.fn_name_hint = prop_name_hint(&key_value.key);
+        }
         Ok(format!(
             "{{{}, {}}}",
-            self.transpile_prop_name(&key_value.key)?,
+            key,
             self.transpile_expr(&key_value.value)?
         ))
     }
 
     fn transpile_prop_shorthand(&mut self, ident: &Ident) -> Result<String> {
-        Ok(format!(r#"{{JSValue{{"{0}"}}, {0}}}"#, ident.sym))
+        Ok(format!(
+            r#"{{JSValue{{"{}"}}, {}}}"#,
+            ident.sym,
+            self.transpile_ident(ident)?
+        ))
     }
 
     fn transpile_prop_name(&mut self, prop_name: &PropName) -> Result<String> {
@@ -573,28 +1813,156 @@ impl Transpiler {
         }
     }
 
+    /// Templates with holes build their string in a single runtime call.
     fn transpile_tpl_expr(&mut self, tpl_expr: &Tpl) -> Result<String> {
-        if tpl_expr.quasis.len() > 1 {
-            return Err(anyhow!("No support for template string interpolation yet"));
+        let quasis = tpl_expr
+            .quasis
+            .iter()
+            .map(|quasi| {
+                let cooked = quasi
+                    .cooked
+                    .as_ref()
+                    .ok_or(anyhow!("Invalid escape in template {:?}", quasi.raw))?;
+                Ok(cpp_string_text(cooked))
+            })
+            .collect::<Result<Vec<String>>>()?;
+        if tpl_expr.exprs.is_empty() {
+            return Ok(format!(r#"JSValue{{"{}"}}"#, quasis[0]));
         }
-        Ok(format!(r#"JSValue{{"{}"}}"#, tpl_expr.quasis[0].raw))
+        let quasis: Vec<String> = quasis
+            .iter()
+            .map(|quasi| format!(r#"std::string_view{{"{}"}}"#, quasi))
+            .collect();
+        let holes = tpl_expr
+            .exprs
+            .iter()
+            .map(|expr| self.transpile_expr(expr))
+            .collect::<Result<Vec<String>>>()?;
+        Ok(format!(
+            "js_template_literal({{{}}}, {{{}}})",
+            quasis.join(", "),
+            holes.join(", ")
+        ))
     }
 
     fn transpile_tagged_tpl_expr(&mut self, tagged_tpl_expr: &TaggedTpl) -> Result<String> {
         let tag = self.transpile_expr(&tagged_tpl_expr.tag)?;
-        let tpl = self.transpile_tpl_expr(&tagged_tpl_expr.tpl)?;
         if tag == "raw_cpp" {
-            return Ok(tpl[1..tpl.len() - 1].to_string());
+            let tpl = &tagged_tpl_expr.tpl;
+            if !tpl.exprs.is_empty() {
+                return Err(anyhow!("raw_cpp templates can’t have holes"));
+            }
+            return Ok(tpl.quasis[0].raw.to_string());
         }
         Err(anyhow!("No support for tagged template expressions"))
     }
 
-    fn transpile_bin_expr(&mut self, bin_expr: &BinExpr) -> Result<String> {
+    /// Transpiles `expr` in test position to a C++ `bool` expression.
+    /// Comparisons and logical operators don’t box their results, and `&&`
+    /// and `||` short-circuit.
+    fn transpile_condition(&mut self, expr: &Expr) -> Result<String> {
+        match expr {
+            Expr::Paren(paren_expr) => self.transpile_condition(&paren_expr.expr),
+            Expr::Lit(Lit::Bool(b)) => Ok(format!("{}", b.value)),
+            Expr::Unary(unary_expr) if unary_expr.op == UnaryOp::Bang => {
+                Ok(format!("!({})", self.transpile_condition(&unary_expr.arg)?))
+            }
+            Expr::Bin(bin_expr) => {
+                let (negate, method) = match bin_expr.op {
+                    BinaryOp::LogicalAnd | BinaryOp::LogicalOr => {
+                        let left = self.transpile_condition(&bin_expr.left)?;
+                        let right = self.transpile_condition(&bin_expr.right)?;
+                        let op = if bin_expr.op == BinaryOp::LogicalAnd {
+                            "&&"
+                        } else {
+                            "||"
+                        };
+                        return Ok(format!("({}) {} ({})", left, op, right));
+                    }
+                    BinaryOp::EqEq | BinaryOp::EqEqEq => (false, "loosely_equals"),
+                    BinaryOp::NotEq | BinaryOp::NotEqEq => (true, "loosely_equals"),
+                    BinaryOp::Lt => (false, "less_than"),
+                    BinaryOp::GtEq => (true, "less_than"),
+                    BinaryOp::LtEq => (false, "less_than_or_equal"),
+                    BinaryOp::Gt => (true, "less_than_or_equal"),
+                    _ => return Ok(format!("({}).coerce_to_bool()", self.transpile_expr(expr)?)),
+                };
+                let left = self.transpile_operand(&bin_expr.left)?;
+                let right = self.transpile_operand(&bin_expr.right)?;
+                Ok(format!(
+                    "{}({}).{}({})",
+                    if negate { "!" } else { "" },
+                    left,
+                    method,
+                    right
+                ))
+            }
+            _ => Ok(format!("({}).coerce_to_bool()", self.transpile_expr(expr)?)),
+        }
+    }
+
+    fn transpile_unary_expr(&mut self, unary_expr: &UnaryExpr) -> Result<String> {
+        match unary_expr.op {
+            UnaryOp::Bang => Ok(format!(
+                "JSValue{{!({})}}",
+                self.transpile_condition(&unary_expr.arg)?
+            )),
+            UnaryOp::Minus => Ok(format!("-({})", self.transpile_operand(&unary_expr.arg)?)),
+            _ => Err(anyhow!("Unsupported unary operation {:?}", unary_expr.op)),
+        }
+    }
+
+    /// `a && b` and `a || b` in value position. They evaluate to one of their
+    /// operands, and `b` is only evaluated if needed.
+    fn transpile_logical_expr(&mut self, bin_expr: &BinExpr) -> Result<String> {
+        let is_and = bin_expr.op == BinaryOp::LogicalAnd;
         let left = self.transpile_expr(&bin_expr.left)?;
         let right = self.transpile_expr(&bin_expr.right)?;
+        if is_trivial(&bin_expr.left) {
+            // Evaluating `left` twice is harmless.
+            let (cons, alt) = if is_and {
+                (&right, &left)
+            } else {
+                (&left, &right)
+            };
+            return Ok(format!(
+                "(({}).coerce_to_bool()?({}):({}))",
+                left, cons, alt
+            ));
+        }
+        if scope::contains_suspension(&bin_expr.left) || scope::contains_suspension(&bin_expr.right)
+        {
+            // `co_await`/`co_yield` can’t appear inside a lambda. The operator
+            // picks the right operand but evaluates both.
+            return Ok(format!(
+                "({}){}({})",
+                left,
+                if is_and { "&&" } else { "||" },
+                right
+            ));
+        }
+        let (cons, alt) = if is_and {
+            (format!("({})", right), "js_lhs".to_string())
+        } else {
+            ("js_lhs".to_string(), format!("({})", right))
+        };
+        Ok(format!(
+            "[&]() -> JSValue {{ JSValue js_lhs = {}; return js_lhs.coerce_to_bool() ? {} : {}; }}()",
+            left, cons, alt
+        ))
+    }
+
+    fn transpile_bin_expr(&mut self, bin_expr: &BinExpr) -> Result<String> {
+        if let BinaryOp::LogicalAnd | BinaryOp::LogicalOr = bin_expr.op {
+            return self.transpile_logical_expr(bin_expr);
+        }
+        let left = self.transpile_operand(&bin_expr.left)?;
+        let right = self.transpile_operand(&bin_expr.right)?;
         let op = match bin_expr.op {
             BinaryOp::Add => "+",
+            BinaryOp::Sub => "-",
             BinaryOp::Mul => "*",
+            BinaryOp::Div => "/",
             BinaryOp::Gt => ">",
             BinaryOp::GtEq => ">=",
             BinaryOp::EqEq => "==",
@@ -603,8 +1971,6 @@ impl Transpiler {
             BinaryOp::LtEq => "<=",
             BinaryOp::NotEq => "!=",
             BinaryOp::NotEqEq => "!=",
-            BinaryOp::LogicalAnd => "&&",
-            BinaryOp::LogicalOr => "||",
             BinaryOp::Mod => "%",
             _ => return Err(anyhow!("Unsupported binary operation {:?}", bin_expr.op)),
         };
@@ -620,7 +1986,16 @@ impl Transpiler {
             .map(|(idx, param)| {
                 param
                     .as_ident()
-                    .map(|ident| format!("JSValue {} = args[{}];", ident.sym, idx))
+                    .map(|ident| {
+                        // Arguments can share their box with an array
+                        // element, so a parameter that is assigned to gets a
+                        // copy.
+                        if self.assigned_names.contains(&*ident.sym) {
+                            format!("JSValue {} = args[{}].boxed_value();", ident.sym, idx)
+                        } else {
+                            format!("JSValue {} = args[{}];", ident.sym, idx)
+                        }
+                    })
                     .ok_or(anyhow!(
                         "Only straight-up identifiers are supported as function parameters"
                     ))
@@ -640,47 +2015,225 @@ impl Transpiler {
     }
 
     fn transpile_arrow_expr(&mut self, arrow_expr: &ArrowExpr) -> Result<String> {
-        let param_destructure = self.transpile_param_destructure(arrow_expr.params.iter())?;
-        let body = match &arrow_expr.body {
-            BlockStmtOrExpr::Expr(expr) => format!("return {};", self.transpile_expr(expr)?),
-            BlockStmtOrExpr::BlockStmt(block_stmt) => self.transpile_block_stmt(block_stmt)?,
+        let name_hint = self.fn_name_hint.take();
+        let kind = if arrow_expr.is_async {
+            FunctionKind::Async
+        } else {
+            FunctionKind::Plain
         };
-        Ok(format!(
-            "JSValue::new_function([=](JSValue thisArg, std::vector<JSValue>& args) mutable {{
+        let (param_destructure, body) = self.in_function(kind, |this| {
+            let param_destructure = this.transpile_param_destructure(arrow_expr.params.iter())?;
+            let body = match &arrow_expr.body {
+                BlockStmtOrExpr::Expr(expr) => match kind {
+                    FunctionKind::Async => format!("co_return {};", this.transpile_expr(expr)?),
+                    _ => format!("return {};", this.transpile_expr(expr)?),
+                },
+                BlockStmtOrExpr::BlockStmt(block_stmt) => this.transpile_block_stmt(block_stmt)?,
+            };
+            Ok((param_destructure, body))
+        })?;
+        self.fn_name_hint = name_hint;
+        let (return_type, tail, constructor) = match kind {
+            FunctionKind::Async => (
+                " -> JSAsyncAdapter",
+                "co_return JSValue::undefined();",
+                "new_async_function",
+            ),
+            _ => ("", "return JSValue::undefined();", "new_function"),
+        };
+        let lambda = format!(
+            "[=](JSValue thisArg, std::vector<JSValue>& args) mutable{} {{
                 {}
                 {}
-                return JSValue::undefined();
-            }})",
-            param_destructure, body
+                {}
+            }}",
+            return_type, param_destructure, body, tail
+        );
+        Ok(format!(
+            "JSValue::{}({})",
+            constructor,
+            self.named_function(arrow_expr.span, lambda)
         ))
     }
 
     fn transpile_member_expr(&mut self, member_expr: &MemberExpr) -> Result<String> {
+        if let Some(element) = self.counted_loop_element(member_expr) {
+            return Ok(element);
+        }
         let obj = self.transpile_expr(&member_expr.obj)?;
-        let prop = match &member_expr.prop {
-            MemberProp::Ident(ident) => format!(r#"JSValue{{"{}"}}"#, ident.sym),
+        let prop = self.transpile_member_prop(&member_expr.prop)?;
+        Ok(format!(r#"{}[{}]"#, obj, prop))
+    }
+
+    fn transpile_member_prop(&mut self, prop: &MemberProp) -> Result<String> {
+        match prop {
+            MemberProp::Ident(ident) => {
+                Ok(self.hoist_literal(format!(r#"JSValue{{"{}"}}"#, ident.sym)))
+            }
             MemberProp::Computed(computed_prop_name) => {
-                self.transpile_expr(&computed_prop_name.expr)?
+                self.transpile_operand(&computed_prop_name.expr)
             }
-            _ => return Err(anyhow!("Unsupported member prop {:?}", member_expr.prop)),
+            _ => Err(anyhow!("Unsupported member prop {:?}", prop)),
+        }
+    }
+
+    fn transpile_ident(&mut self, ident: &Ident) -> Result<String> {
+        if let Some(counted_loop) = self
+            .counted_loops
+            .iter_mut()
+            .rev()
+            .find(|counted_loop| counted_loop.index == &*ident.sym)
+        {
+            counted_loop.index_used = true;
+        }
+        if self.native_functions.contains_key(&*ident.sym) {
+            return Ok(format!("js_fn_{}_value()", ident.sym));
+        }
+        Ok(format!("{}", ident.sym))
+    }
+
+    /// Calls a native function directly, if `call_expr` allows it. Arguments
+    /// of a C++ call are evaluated in unspecified order, so at most one of
+    /// them may have side effects.
+    fn transpile_native_call(&mut self, call_expr: &CallExpr) -> Result<Option<String>> {
+        let ident = match call_expr.callee.as_expr().map(|expr| expr.as_ref()) {
+            Some(Expr::Ident(ident)) => ident,
+            _ => return Ok(None),
         };
-        Ok(format!(r#"{}[{}]"#, obj, prop))
+        let param_count = match self.native_functions.get(&*ident.sym) {
+            Some(params) => params.len(),
+            None => return Ok(None),
+        };
+        if call_expr.args.len() > param_count
+            || call_expr.args.iter().any(|arg| arg.spread.is_some())
+            || call_expr
+                .args
+                .iter()
+                .filter(|arg| scope::has_side_effects(&arg.expr))
+                .count()
+                > 1
+        {
+            return Ok(None);
+        }
+        let mut args = call_expr
+            .args
+            .iter()
+            .map(|arg| {
+                Ok(format!(
+                    "JSValue{{({}).boxed_value()}}",
+                    self.transpile_operand(&arg.expr)?
+                ))
+            })
+            .collect::<Result<Vec<String>>>()?;
+        args.resize(param_count, "JSValue::undefined()".into());
+        Ok(Some(format!("js_fn_{}({})", ident.sym, args.join(", "))))
+    }
+
+    /// In optimized builds, fuses chains like `arr.map(f).filter(g).reduce(h)`
+    /// into a single pass over the array. The callbacks are evaluated before
+    /// the array is traversed and their calls get interleaved, so only
+    /// function literals whose bodies are free of side effects are fused.
+    fn transpile_pipeline(&mut self, call_expr: &CallExpr) -> Result<Option<String>> {
+        if !self.optimize {
+            return Ok(None);
+        }
+        let (method, mut object, args) = match method_call(call_expr) {
+            Some(method_call) => method_call,
+            None => return Ok(None),
+        };
+        let mut stages = vec![];
+        let reduce_args = match method {
+            "reduce" if (1..=2).contains(&args.len()) => Some(args),
+            "map" | "filter" if args.len() == 1 => {
+                stages.push((method, &*args[0].expr));
+                None
+            }
+            _ => return Ok(None),
+        };
+        if args.iter().any(|arg| arg.spread.is_some())
+            || !scope::is_pure_callback(&args[0].expr)
+            || args[1..]
+                .iter()
+                .any(|arg| scope::has_side_effects(&arg.expr))
+        {
+            return Ok(None);
+        }
+        while let Expr::Call(inner) = object {
+            match method_call(inner) {
+                Some((method @ ("map" | "filter"), inner_object, [arg]))
+                    if arg.spread.is_none() && scope::is_pure_callback(&arg.expr) =>
+                {
+                    stages.push((method, &*arg.expr));
+                    object = inner_object;
+                }
+                _ => break,
+            }
+        }
+        if stages.len() + reduce_args.iter().count() < 2 {
+            return Ok(None);
+        }
+        let stages = stages
+            .into_iter()
+            .rev()
+            .map(|(method, f)| {
+                let kind = if method == "map" { "MAP" } else { "FILTER" };
+                Ok(format!(
+                    "{{JSPipelineStage::Kind::{}, {}}}",
+                    kind,
+                    self.transpile_expr(f)?
+                ))
+            })
+            .collect::<Result<Vec<String>>>()?
+            .join(", ");
+        let object = self.transpile_expr(object)?;
+        Ok(Some(match reduce_args {
+            Some(args) => {
+                let initial = match args.get(1) {
+                    Some(arg) => format!("({}).boxed_value()", self.transpile_operand(&arg.expr)?),
+                    None => "JSValue::undefined()".into(),
+                };
+                format!(
+                    "js_pipeline_reduce({}, {{{}}}, {}, {})",
+                    object,
+                    stages,
+                    self.transpile_expr(&args[0].expr)?,
+                    initial
+                )
+            }
+            None => format!("js_pipeline_collect({}, {{{}}})", object, stages),
+        }))
     }
 
     fn transpile_call_expr(&mut self, call_expr: &CallExpr) -> Result<String> {
+        if let Some(native_call) = self.transpile_native_call(call_expr)? {
+            return Ok(native_call);
+        }
+        if let Some(pipeline) = self.transpile_pipeline(call_expr)? {
+            return Ok(pipeline);
+        }
         let callee = self.transpile_expr(
             call_expr
                 .callee
                 .as_expr()
                 .ok_or(anyhow!("Unsupported callee expr {:?}", call_expr.callee))?,
         )?;
+        // `sort` orders packed arrays natively when given one of the
+        // runtime’s numeric comparators.
+        let sorts = self.optimize && matches!(method_call(call_expr), Some(("sort", _, [_])));
         let transpiled_args: Vec<Result<String>> = call_expr
             .args
             .iter()
             .map(|arg| {
+                if let Some(ascending) = numeric_comparator(&arg.expr).filter(|_| sorts) {
+                    let order = if ascending { "ascending" } else { "descending" };
+                    return Ok(format!(
+                        "JSValue::new_function(&JSArray::numeric_{}_impl)",
+                        order
+                    ));
+                }
                 Ok(format!(
                     "({}).boxed_value()",
-                    self.transpile_expr(&arg.expr)?
+                    self.transpile_operand(&arg.expr)?
                 ))
             })
             .collect();
@@ -700,10 +2253,14 @@ impl Transpiler {
             })
             .collect();
 
-        Ok(format!(
+        let init = format!(
             "JSValue::new_array({{{}}})",
             Result::<Vec<String>>::from_iter(transpiled_elems)?.join(",")
-        ))
+        );
+        if self.optimize && is_constant_array(array_lit) {
+            return Ok(self.share_constant_literal(init));
+        }
+        Ok(init)
     }
 
     fn transpile_literal(&mut self, lit: &Lit) -> Result<String> {
@@ -711,6 +2268,7 @@ impl Transpiler {
             Lit::Num(num) => self.transpile_number(num),
             Lit::Str(str) => self.transpile_string(str),
             Lit::Bool(bool) => self.transpile_bool(bool),
+            Lit::Regex(regex) => self.transpile_regex(regex),
             _ => Err(anyhow!("Unsupported literal {:?}", lit)),
         }
     }
@@ -734,7 +2292,193 @@ impl Transpiler {
         ))
     }
 
+    /// Regular expressions are compiled to C++ matchers at build time. Each
+    /// evaluation of the literal creates a new `RegExp` object.
+    fn transpile_regex(&mut self, regex: &Regex) -> Result<String> {
+        let id = self.regexps.len();
+        self.regexps
+            .push(regexp::compile(id, &regex.exp, &regex.flags)?);
+        Ok(format!("JSRegExp::create(&js_re_{})", id))
+    }
+
     fn transpile_number(&mut self, num: &Number) -> Result<String> {
-        Ok(format!("JSValue{{static_cast<double>({})}}", num.value))
+        // `{}` spells large values as integer literals that don’t fit any C++
+        // integer type, and -0 as 0. `{:?}` always gives a valid double.
+        let value = num.value;
+        let is_safe_integer = value.fract() == 0.0 && value.abs() < 9007199254740992.0;
+        let literal = if is_safe_integer && (value != 0.0 || value.is_sign_positive()) {
+            format!("{}", value)
+        } else {
+            format!("{:?}", value)
+        };
+        Ok(format!("JSValue{{static_cast<double>({})}}", literal))
+    }
+}
+
+/// Splits `object.method(args)` into its parts.
+fn method_call(call_expr: &CallExpr) -> Option<(&str, &Expr, &[ExprOrSpread])> {
+    let member_expr = call_expr.callee.as_expr()?.as_member()?;
+    match &member_expr.prop {
+        MemberProp::Ident(ident) => Some((&*ident.sym, &*member_expr.obj, &call_expr.args)),
+        _ => None,
+    }
+}
+
+/// Whether `expr` is a number, string or boolean literal.
+fn is_constant_primitive(expr: &Expr) -> bool {
+    match expr {
+        Expr::Lit(Lit::Num(_) | Lit::Str(_) | Lit::Bool(_)) => true,
+        Expr::Unary(unary_expr) => {
+            unary_expr.op == UnaryOp::Minus && matches!(&*unary_expr.arg, Expr::Lit(Lit::Num(_)))
+        }
+        Expr::Paren(paren_expr) => is_constant_primitive(&paren_expr.expr),
+        _ => false,
+    }
+}
+
+/// Whether `array_lit` is a non-empty array of primitive literals. Nested
+/// arrays and objects are left out, as they would be shared by reference.
+fn is_constant_array(array_lit: &ArrayLit) -> bool {
+    !array_lit.elems.is_empty()
+        && array_lit.elems.iter().all(|elem| match elem {
+            Some(elem) => elem.spread.is_none() && is_constant_primitive(&elem.expr),
+            None => false,
+        })
+}
+
+/// Whether `object_lit` is a non-empty object whose properties are all
+/// named and have primitive literal values.
+fn is_constant_object(object_lit: &ObjectLit) -> bool {
+    !object_lit.props.is_empty()
+        && object_lit.props.iter().all(|prop| match prop {
+            PropOrSpread::Prop(prop) => match prop.as_ref() {
+                Prop::KeyValue(key_value) => {
+                    matches!(key_value.key, PropName::Ident(_) | PropName::Str(_))
+                        && is_constant_primitive(&key_value.value)
+                }
+                _ => false,
+            },
+            PropOrSpread::Spread(_) => false,
+        })
+}
+
+/// Recognizes `(a, b) => a - b` and `(a, b) => b - a`, returning whether the
+/// order is ascending.
+fn numeric_comparator(expr: &Expr) -> Option<bool> {
+    let arrow_expr = match expr {
+        Expr::Arrow(arrow_expr) if !arrow_expr.is_async && !arrow_expr.is_generator => arrow_expr,
+        Expr::Paren(paren_expr) => return numeric_comparator(&paren_expr.expr),
+        _ => return None,
+    };
+    let (a, b) = match &arrow_expr.params[..] {
+        [a, b] => (&a.as_ident()?.id.sym, &b.as_ident()?.id.sym),
+        _ => return None,
+    };
+    let body = match &arrow_expr.body {
+        BlockStmtOrExpr::Expr(expr) => &**expr,
+        BlockStmtOrExpr::BlockStmt(block_stmt) => match &block_stmt.stmts[..] {
+            [Stmt::Return(ReturnStmt { arg: Some(arg), .. })] => &**arg,
+            _ => return None,
+        },
+    };
+    let bin_expr = body
+        .as_bin()
+        .filter(|bin_expr| bin_expr.op == BinaryOp::Sub)?;
+    let (left, right) = (
+        &bin_expr.left.as_ident()?.sym,
+        &bin_expr.right.as_ident()?.sym,
+    );
+    if a == b {
+        None
+    } else if (left, right) == (a, b) {
+        Some(true)
+    } else if (left, right) == (b, a) {
+        Some(false)
+    } else {
+        None
+    }
+}
+
+/// `x = <expr>` as a statement, where `<expr>` may throw.
+fn checked_assignment(expr_stmt: &ExprStmt) -> Option<(&Ident, &Expr)> {
+    let assign_expr = match expr_stmt.expr.as_ref() {
+        Expr::Assign(assign_expr) => assign_expr,
+        _ => return None,
+    };
+    if assign_expr.op != AssignOp::Assign || !scope::may_throw(&assign_expr.right) {
+        return None;
+    }
+    let ident = match &assign_expr.left {
+        PatOrExpr::Pat(pat) => &pat.as_ident()?.id,
+        PatOrExpr::Expr(expr) => expr.as_ident()?,
+    };
+    Some((ident, &assign_expr.right))
+}
+
+/// Whether the part of `stmt` that runs before any nested statement may
+/// throw, e.g. the test of an `if`.
+fn head_may_throw(stmt: &Stmt) -> bool {
+    match stmt {
+        Stmt::Expr(expr_stmt) => {
+            checked_assignment(expr_stmt).is_none() && scope::may_throw(&expr_stmt.expr)
+        }
+        Stmt::Decl(Decl::Var(var_decl)) => var_decl_may_throw(var_decl),
+        Stmt::If(if_stmt) => scope::may_throw(&if_stmt.test),
+        Stmt::While(while_stmt) => scope::may_throw(&while_stmt.test),
+        Stmt::For(for_stmt) => for_head_may_throw(for_stmt),
+        Stmt::ForOf(_) => true,
+        _ => false,
+    }
+}
+
+fn for_head_may_throw(for_stmt: &ForStmt) -> bool {
+    let init = match &for_stmt.init {
+        Some(VarDeclOrExpr::Expr(expr)) => scope::may_throw(expr),
+        Some(VarDeclOrExpr::VarDecl(var_decl)) => var_decl_may_throw(var_decl),
+        None => false,
+    };
+    init || for_stmt.test.as_deref().map_or(false, scope::may_throw)
+        || for_stmt.update.as_deref().map_or(false, scope::may_throw)
+}
+
+fn var_decl_may_throw(var_decl: &VarDecl) -> bool {
+    var_decl
+        .decls
+        .iter()
+        .any(|decl| decl.init.as_deref().map_or(false, scope::may_throw))
+}
+
+/// Whether `expr` is cheap and side-effect free enough to be evaluated twice.
+fn is_trivial(expr: &Expr) -> bool {
+    match expr {
+        Expr::Ident(_) | Expr::Lit(_) | Expr::This(_) => true,
+        Expr::Paren(paren_expr) => is_trivial(&paren_expr.expr),
+        _ => false,
+    }
+}
+
+fn prop_name_hint(prop_name: &PropName) -> Option<String> {
+    match prop_name {
+        PropName::Ident(ident) => Some(format!("{}", ident.sym)),
+        PropName::Str(str) => Some(format!("{}", str.value)),
+        _ => None,
+    }
+}
+
+/// Escapes `value` for use as the body of a C++ string literal. Anything
+/// outside printable ASCII is written as octal escapes of its UTF-8 bytes,
+/// which, unlike hex escapes, can’t run into the following character.
+fn cpp_string_text(value: &str) -> String {
+    let mut text = String::with_capacity(value.len());
+    for byte in value.bytes() {
+        match byte {
+            b'"' => text.push_str("\\\""),
+            b'\\' => text.push_str("\\\\"),
+            b'\n' => text.push_str("\\n"),
+            b'\t' => text.push_str("\\t"),
+            b' '..=b'~' => text.push(byte as char),
+            byte => text.push_str(&format!("\\{:03o}", byte)),
+        }
     }
+    text
 }